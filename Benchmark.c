@@ -0,0 +1,709 @@
+/**
+* @file Benchmark.c
+* @author Aviel Shtern Aviel.Shtern@mail.huji.ac.il
+* @version 1.0
+* @date 3 jun 2020
+* @brief A benchmark driver for the Red Black Tree. Runs batches of tree operations on integer
+* and string keys and reports the time of each operation, and compares the balancing policies on
+* the integer keys. With --perf (Linux only) it also reads the hardware performance counters
+* around each batch and reports them per operation. Last, it runs a mix of operations on a
+* ConcurrentSet with 1, 2, 4... threads, up to the number of cores (at least 4), and reports the
+* time per operation of all the threads together and the speedup over one thread.
+* usage: benchmark [number of keys] [--perf]
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "RBTree.h"
+#include "Structs.h"
+#include "ConcurrentSet.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/**
+ *@def DEFAULT_KEYS 1000000
+ *@brief The number of keys in each batch when it is not given in the command line.
+ */
+#define DEFAULT_KEYS 1000000
+
+/**
+ *@def STRING_KEY_LEN 32
+ *@brief The size of the buffer of each string key.
+ */
+#define STRING_KEY_LEN 32
+
+/**
+ *@def PERF_FLAG "--perf"
+ *@brief The command line flag that turns on the hardware counters.
+ */
+#define PERF_FLAG "--perf"
+
+/**
+ *@def NUM_COUNTERS 6
+ *@brief The number of hardware counters we read around each batch.
+ */
+#define NUM_COUNTERS 6
+
+/**
+ *@def NANO_IN_SEC 1e9
+ *@brief Nanoseconds in one second.
+ */
+#define NANO_IN_SEC 1e9
+
+/**
+ *@def MIN_SCALING_THREADS 4
+ *@brief The concurrent set is run with up to this many threads also on fewer cores.
+ */
+#define MIN_SCALING_THREADS 4
+
+/**
+ *@def MAX_SCALING_THREADS 64
+ *@brief The most threads the concurrent set is run with.
+ */
+#define MAX_SCALING_THREADS 64
+
+/**
+ *@def SCALING_INSERTS 2
+ *@brief Out of 10 operations of the concurrent set, the number of inserts (then deletes, then
+ * searches).
+ */
+#define SCALING_INSERTS 2
+
+/**
+ *@def SCALING_DELETES 2
+ *@brief Out of 10 operations of the concurrent set, the number of deletes.
+ */
+#define SCALING_DELETES 2
+
+/**
+ * The hardware counters of one batch. fds[i] is -1 if the counter is not available.
+ */
+typedef struct PerfCounters
+{
+	int fds[NUM_COUNTERS];
+	long long values[NUM_COUNTERS];
+} PerfCounters;
+
+/**
+ * The names of the counters, in the order of PerfCounters.
+ */
+static const char *counterNames[NUM_COUNTERS] = {"cycles", "instr", "L1d-miss", "LLC-miss",
+												 "br-miss", "dTLB-miss"};
+
+/**
+ *@def NUM_POLICIES 4
+ *@brief The number of balancing policies that are compared.
+ */
+#define NUM_POLICIES 4
+
+/**
+ * The names of the balancing policies, in the order of BalancePolicy.
+ */
+static const char *policyNames[NUM_POLICIES] = {"rb", "avl", "wavl", "treap"};
+
+/**
+ * A set of keys to run the batches on.
+ * keys: the keys that are inserted to the tree.
+ * missing: keys of the same type that are never inserted.
+ */
+typedef struct Workload
+{
+	const char *name;
+	CompareFunc compFunc;
+	void **keys;
+	void **missing;
+	long unsigned n;
+} Workload;
+
+/**
+ * A thread of scaleConcurrentSet
+ */
+typedef struct ScalingWorker
+{
+	ConcurrentSet *set;
+	const Workload *workload;
+	unsigned seed;
+	long unsigned ops;
+	pthread_t thread;
+} ScalingWorker;
+
+/**
+ * opens the hardware counters. A counter that can not be opened (not Linux, no permission,
+ * a virtual machine without a PMU) is marked with -1 and reported as "-".
+ * @param perf the counters to open
+ * @param enabled false to mark all the counters as not available
+ */
+void openCounters(PerfCounters *perf, int enabled);
+
+/**
+ * closes the counters that openCounters opened
+ * @param perf the counters
+ */
+void closeCounters(PerfCounters *perf);
+
+/**
+ * resets and starts all the open counters
+ * @param perf the counters
+ */
+void startCounters(PerfCounters *perf);
+
+/**
+ * stops all the open counters and reads their values
+ * @param perf the counters
+ */
+void stopCounters(PerfCounters *perf);
+
+/**
+ * @return the current time in seconds, from a monotonic clock
+ */
+double now();
+
+/**
+ * prints the result of one batch. the time and all the counters are divided by the number of
+ * operations in the batch.
+ * @param workload the workload of the batch
+ * @param op the name of the operation
+ * @param seconds the time the batch took
+ * @param ops the number of operations in the batch
+ * @param perf the counters of the batch
+ */
+void report(const Workload *workload, const char *op, double seconds, long unsigned ops,
+			const PerfCounters *perf);
+
+/**
+ * runs the insert, contains, forEach and delete batches on a workload
+ * @param workload the keys
+ * @param perf the counters to read around each batch
+ */
+void runWorkload(const Workload *workload, PerfCounters *perf);
+
+/**
+ * runs insert, contains, churn (delete and insert again) and delete batches on a tree of every
+ * balancing policy, and prints the shape of each tree after the insertions
+ * @param workload the keys
+ * @param perf the counters to read around each batch
+ */
+void comparePolicies(const Workload *workload, PerfCounters *perf);
+
+/**
+ * runs the same mix of inserts, deletes and searches on a ConcurrentSet that holds half of the
+ * keys, with more and more threads, and prints the time per operation and the speedup
+ * @param workload the keys
+ */
+void scaleConcurrentSet(const Workload *workload);
+
+/**
+ * a thread of scaleConcurrentSet
+ * @param pWorker pointer to ScalingWorker
+ * @return NULL
+ */
+void *runScalingWorker(void *pWorker);
+
+/**
+ * the data items of the benchmark are owned by the benchmark, not by the tree.
+ */
+void freeNothing(void *data);
+
+/**
+ * CompFunc for long keys
+ */
+int longCompare(const void *a, const void *b);
+
+/**
+ * forEach function that does nothing, used to measure the traversal itself
+ */
+int touchItem(const void *object, void *args);
+
+/**
+ * shuffles an array of pointers (Fisher Yates)
+ * @param items the array
+ * @param n the size of the array
+ */
+void shuffle(void **items, long unsigned n);
+
+#ifdef __linux__
+/**
+ * opens one hardware counter for the calling thread
+ * @param type perf event type
+ * @param config perf event config
+ * @return the file descriptor of the counter, -1 on failure
+ */
+int openCounter(unsigned type, unsigned long long config)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+void openCounters(PerfCounters *perf, int enabled)
+{
+	for (int i = 0; i < NUM_COUNTERS; i++)
+	{
+		perf->fds[i] = -1;
+		perf->values[i] = 0;
+	}
+#ifdef __linux__
+	if (!enabled)
+	{
+		return;
+	}
+	perf->fds[0] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	perf->fds[1] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	perf->fds[2] = openCounter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+												   (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+												   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	perf->fds[3] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	perf->fds[4] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+	perf->fds[5] = openCounter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+												   (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+												   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	for (int i = 0; i < NUM_COUNTERS; i++)
+	{
+		if (perf->fds[i] < 0)
+		{
+			fprintf(stderr, "counter %s is not available\n", counterNames[i]);
+		}
+	}
+#else
+	if (enabled)
+	{
+		fprintf(stderr, "hardware counters are supported only on Linux\n");
+	}
+#endif
+}
+
+void closeCounters(PerfCounters *perf)
+{
+#ifdef __linux__
+	for (int i = 0; i < NUM_COUNTERS; i++)
+	{
+		if (perf->fds[i] >= 0)
+		{
+			close(perf->fds[i]);
+			perf->fds[i] = -1;
+		}
+	}
+#else
+	(void) perf;
+#endif
+}
+
+void startCounters(PerfCounters *perf)
+{
+#ifdef __linux__
+	for (int i = 0; i < NUM_COUNTERS; i++)
+	{
+		if (perf->fds[i] >= 0)
+		{
+			ioctl(perf->fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(perf->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#else
+	(void) perf;
+#endif
+}
+
+void stopCounters(PerfCounters *perf)
+{
+	for (int i = 0; i < NUM_COUNTERS; i++)
+	{
+		perf->values[i] = 0;
+#ifdef __linux__
+		if (perf->fds[i] >= 0)
+		{
+			ioctl(perf->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+			if (read(perf->fds[i], &perf->values[i], sizeof(long long)) != sizeof(long long))
+			{
+				perf->values[i] = 0;
+			}
+		}
+#endif
+	}
+}
+
+double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / NANO_IN_SEC;
+}
+
+void report(const Workload *workload, const char *op, double seconds, long unsigned ops,
+			const PerfCounters *perf)
+{
+	if (ops == 0)
+	{
+		ops = 1;
+	}
+	printf("%-8s %-16s %10.1f ns/op", workload->name, op, seconds * NANO_IN_SEC / ops);
+	for (int i = 0; i < NUM_COUNTERS; i++)
+	{
+		if (perf->fds[i] >= 0)
+		{
+			printf("  %s %8.2f", counterNames[i], (double) perf->values[i] / ops);
+		}
+		else if (perf->fds[0] >= 0 || perf->fds[1] >= 0)
+		{
+			printf("  %s %8s", counterNames[i], "-");
+		}
+	}
+	printf("\n");
+}
+
+void runWorkload(const Workload *workload, PerfCounters *perf)
+{
+	RBTree *tree = newRBTree(workload->compFunc, freeNothing);
+	if (tree == NULL)
+	{
+		fprintf(stderr, "allocation failed\n");
+		return;
+	}
+	long unsigned hits = 0;
+
+	double start = now();
+	startCounters(perf);
+	for (long unsigned i = 0; i < workload->n; i++)
+	{
+		insertToRBTree(tree, workload->keys[i]);
+	}
+	stopCounters(perf);
+	report(workload, "insert", now() - start, workload->n, perf);
+
+	start = now();
+	startCounters(perf);
+	for (long unsigned i = 0; i < workload->n; i++)
+	{
+		hits += RBTreeContains(tree, workload->keys[i]) != 0;
+	}
+	stopCounters(perf);
+	report(workload, "contains(hit)", now() - start, workload->n, perf);
+
+	start = now();
+	startCounters(perf);
+	for (long unsigned i = 0; i < workload->n; i++)
+	{
+		hits += RBTreeContains(tree, workload->missing[i]) != 0;
+	}
+	stopCounters(perf);
+	report(workload, "contains(miss)", now() - start, workload->n, perf);
+
+	int *results = (int *) malloc(workload->n * sizeof(int));
+	if (results != NULL)
+	{
+		start = now();
+		startCounters(perf);
+		RBTreeContainsMany(tree, (const void *const *) workload->keys, workload->n, results);
+		stopCounters(perf);
+		report(workload, "containsMany", now() - start, workload->n, perf);
+		for (long unsigned i = 0; i < workload->n; i++)
+		{
+			if (!results[i])
+			{
+				fprintf(stderr, "%s: containsMany missed key %lu\n", workload->name, i);
+				break;
+			}
+		}
+		free(results);
+	}
+
+	start = now();
+	startCounters(perf);
+	forEachRBTree(tree, touchItem, NULL);
+	stopCounters(perf);
+	report(workload, "forEach", now() - start, tree->size, perf);
+
+	start = now();
+	startCounters(perf);
+	for (long unsigned i = 0; i < workload->n; i++)
+	{
+		deleteFromRBTree(tree, workload->keys[i]);
+	}
+	stopCounters(perf);
+	report(workload, "delete", now() - start, workload->n, perf);
+
+	void **items = (void **) malloc(workload->n * sizeof(void *));
+	if (items != NULL)
+	{
+		memcpy(items, workload->keys, workload->n * sizeof(void *)); // the load reorders them
+		start = now();
+		startCounters(perf);
+		loadRBTree(tree, items, workload->n, 1);
+		stopCounters(perf);
+		report(workload, "load", now() - start, workload->n, perf);
+		free(items);
+	}
+
+	if (hits != workload->n)
+	{
+		fprintf(stderr, "%s: expected %lu hits, got %lu\n", workload->name, workload->n, hits);
+	}
+	freeRBTree(&tree);
+}
+
+void comparePolicies(const Workload *workload, PerfCounters *perf)
+{
+	char op[STRING_KEY_LEN];
+	for (int policy = 0; policy < NUM_POLICIES; policy++)
+	{
+		RBTree *tree = newRBTreeWithPolicy(workload->compFunc, freeNothing,
+										   (BalancePolicy) policy);
+		if (tree == NULL)
+		{
+			fprintf(stderr, "allocation failed\n");
+			return;
+		}
+		const char *name = policyNames[policy];
+		long unsigned hits = 0;
+
+		double start = now();
+		startCounters(perf);
+		for (long unsigned i = 0; i < workload->n; i++)
+		{
+			insertToRBTree(tree, workload->keys[i]);
+		}
+		stopCounters(perf);
+		snprintf(op, sizeof(op), "%s insert", name);
+		report(workload, op, now() - start, workload->n, perf);
+
+		RBTreeStats stats;
+		getRBTreeStats(tree, &stats);
+		printf("%-8s %-16s height %lu, average depth %.2f, rotations %lu\n", workload->name,
+			   name, stats.height, stats.averageDepth, stats.counters.rotations);
+
+		start = now();
+		startCounters(perf);
+		for (long unsigned i = 0; i < workload->n; i++)
+		{
+			hits += RBTreeContains(tree, workload->keys[i]) != 0;
+		}
+		stopCounters(perf);
+		snprintf(op, sizeof(op), "%s contains", name);
+		report(workload, op, now() - start, workload->n, perf);
+
+		// every key of the first half is deleted and inserted again, in random order
+		start = now();
+		startCounters(perf);
+		for (long unsigned i = 0; i < workload->n / 2; i++)
+		{
+			deleteFromRBTree(tree, workload->keys[i]);
+			insertToRBTree(tree, workload->keys[i]);
+		}
+		stopCounters(perf);
+		snprintf(op, sizeof(op), "%s churn", name);
+		report(workload, op, now() - start, workload->n / 2 * 2, perf);
+
+		start = now();
+		startCounters(perf);
+		for (long unsigned i = 0; i < workload->n; i++)
+		{
+			deleteFromRBTree(tree, workload->keys[i]);
+		}
+		stopCounters(perf);
+		snprintf(op, sizeof(op), "%s delete", name);
+		report(workload, op, now() - start, workload->n, perf);
+
+		if (hits != workload->n || tree->size != 0)
+		{
+			fprintf(stderr, "%s %s: wrong results\n", workload->name, name);
+		}
+		freeRBTree(&tree);
+	}
+}
+
+void *runScalingWorker(void *pWorker)
+{
+	ScalingWorker *worker = (ScalingWorker *) pWorker;
+	unsigned random = worker->seed;
+	for (long unsigned i = 0; i < worker->ops; i++)
+	{
+		random = random * 1103515245u + 12345u;
+		void *key = worker->workload->keys[(random >> 4) % worker->workload->n];
+		unsigned op = (random >> 24) % 10;
+		if (op < SCALING_INSERTS)
+		{
+			insertToConcurrentSet(worker->set, key);
+		}
+		else if (op < SCALING_INSERTS + SCALING_DELETES)
+		{
+			deleteFromConcurrentSet(worker->set, key);
+		}
+		else
+		{
+			concurrentSetContains(worker->set, key);
+		}
+	}
+	return NULL;
+}
+
+void scaleConcurrentSet(const Workload *workload)
+{
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int maxThreads = (cores < MIN_SCALING_THREADS) ? MIN_SCALING_THREADS :
+					 (cores > MAX_SCALING_THREADS) ? MAX_SCALING_THREADS : (int) cores;
+	ScalingWorker workers[MAX_SCALING_THREADS];
+	char op[STRING_KEY_LEN];
+	double single = 0;
+	for (int threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		ConcurrentSet *set = newConcurrentSet(workload->compFunc, NULL); // the keys are not owned
+		if (set == NULL)
+		{
+			fprintf(stderr, "allocation failed\n");
+			return;
+		}
+		for (long unsigned i = 0; i < workload->n / 2; i++)
+		{
+			insertToConcurrentSet(set, workload->keys[i]);
+		}
+		waitForConcurrentSetFixer(set);
+		double start = now();
+		int started = 0;
+		for (; started < threads; started++)
+		{
+			workers[started].set = set;
+			workers[started].workload = workload;
+			workers[started].seed = 7919u * (unsigned) started + 1u;
+			workers[started].ops = workload->n / threads; // the same total for every run
+			if (pthread_create(&workers[started].thread, NULL, runScalingWorker,
+							   &workers[started]) != 0)
+			{
+				break;
+			}
+		}
+		for (int t = 0; t < started; t++)
+		{
+			pthread_join(workers[t].thread, NULL);
+		}
+		double seconds = now() - start;
+		freeConcurrentSet(&set);
+		if (started < threads)
+		{
+			fprintf(stderr, "could not start %d threads\n", threads);
+			return;
+		}
+		if (threads == 1)
+		{
+			single = seconds;
+		}
+		snprintf(op, sizeof(op), "set %d threads", threads);
+		printf("%-8s %-16s %10.1f ns/op  speedup %5.2f (%ld cores)\n", workload->name, op,
+			   seconds * NANO_IN_SEC / (workload->n / threads * threads), single / seconds, cores);
+	}
+}
+
+void freeNothing(void *data)
+{
+	(void) data;
+}
+
+int longCompare(const void *a, const void *b)
+{
+	long first = *(const long *) a;
+	long second = *(const long *) b;
+	return (first > second) - (first < second);
+}
+
+int touchItem(const void *object, void *args)
+{
+	(void) object;
+	(void) args;
+	return true;
+}
+
+void shuffle(void **items, long unsigned n)
+{
+	for (long unsigned i = n; i > 1; i--)
+	{
+		long unsigned j = (long unsigned) rand() % i;
+		void *tmp = items[i - 1];
+		items[i - 1] = items[j];
+		items[j] = tmp;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	long unsigned n = DEFAULT_KEYS;
+	int usePerf = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], PERF_FLAG) == 0)
+		{
+			usePerf = true;
+		}
+		else
+		{
+			n = strtoul(argv[i], NULL, 10);
+		}
+	}
+	if (n == 0)
+	{
+		fprintf(stderr, "usage: %s [number of keys] [%s]\n", argv[0], PERF_FLAG);
+		return EXIT_FAILURE;
+	}
+
+	// even numbers are inserted, odd numbers are the misses
+	long *numbers = (long *) malloc(2 * n * sizeof(long));
+	char *strings = (char *) malloc(2 * n * STRING_KEY_LEN);
+	void **pointers = (void **) malloc(4 * n * sizeof(void *));
+	if (numbers == NULL || strings == NULL || pointers == NULL)
+	{
+		fprintf(stderr, "allocation failed\n");
+		free(numbers);
+		free(strings);
+		free(pointers);
+		return EXIT_FAILURE;
+	}
+	srand(1);
+	for (long unsigned i = 0; i < 2 * n; i++)
+	{
+		numbers[i] = (long) i;
+		snprintf(strings + i * STRING_KEY_LEN, STRING_KEY_LEN, "key-%020lu", i * 2654435761UL);
+	}
+	Workload longs = {"long", longCompare, pointers, pointers + n, n};
+	Workload texts = {"string", stringCompare, pointers + 2 * n, pointers + 3 * n, n};
+	for (long unsigned i = 0; i < n; i++)
+	{
+		longs.keys[i] = &numbers[2 * i];
+		longs.missing[i] = &numbers[2 * i + 1];
+		texts.keys[i] = strings + 2 * i * STRING_KEY_LEN;
+		texts.missing[i] = strings + (2 * i + 1) * STRING_KEY_LEN;
+	}
+	shuffle(longs.keys, n);
+	shuffle(longs.missing, n);
+	shuffle(texts.keys, n);
+	shuffle(texts.missing, n);
+
+	PerfCounters perf;
+	openCounters(&perf, usePerf);
+	printf("%lu keys\n", n);
+	runWorkload(&longs, &perf);
+	runWorkload(&texts, &perf);
+	comparePolicies(&longs, &perf);
+	closeCounters(&perf);
+	scaleConcurrentSet(&longs);
+
+	free(numbers);
+	free(strings);
+	free(pointers);
+	return EXIT_SUCCESS;
+}
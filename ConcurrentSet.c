@@ -0,0 +1,955 @@
+/**
+* @file ConcurrentSet.c
+* @author Aviel Shtern Aviel.Shtern@mail.huji.ac.il
+* @version 1.0
+* @date 3 jun 2020
+* @brief An ordered set for many threads: a binary search tree with a version lock in every node,
+* searches that take no locks, and a relaxed balance that a background thread repairs.
+* The version of a node is its lock (LOCKED), and it changes when a rotation moves the node down
+* (SHRINKING while it runs) or the node is unlinked (UNLINKED). A search remembers the version of
+* every node it passes, and checks it again after it read the next child, so it knows the child
+* was really there, and starts from the root if a rotation or an unlink moved that part of the
+* tree (the optimistic hand-over-hand validation of Bronson et al.). An insert locks only the
+* node it adds a leaf to, and a delete only marks its node, so the writers never restructure the
+* tree. The fixer thread takes the changed nodes from a queue, updates their heights (AVL heights,
+* that a single node can repair from its children), rotates, and unlinks the deleted nodes that
+* have at most one child. Unlinked nodes and replaced items are freed only after every operation
+* that may still hold them ended: the operations register in one of two epochs, and the fixer
+* flips the epoch and waits for the old one to drain.
+* Nothing else is shared by the writers. A thread counts its running operations and the items it
+* added in its own stripe (a cache line), so the fixer sums the stripes to wait for an epoch. The
+* queue of the fixer is a list that the writers push to with a compare and swap, and that the
+* fixer takes whole with one exchange (so there is no ABA problem). The fixer sleeps on the mutex
+* only when the queue is empty, and clears fixing first: a writer that pushed checks fixing after
+* the push, so either it sees that the fixer sleeps and wakes it, or the fixer sees the push.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sched.h>
+#include "ConcurrentSet.h"
+
+/**
+ *@def LOCKED 1ul
+ *@brief The bit of the version of a node that is set while a thread holds its lock.
+ */
+#define LOCKED 1ul
+
+/**
+ *@def SHRINKING 2ul
+ *@brief The bit of the version of a node that is set while a rotation moves it down.
+ */
+#define SHRINKING 2ul
+
+/**
+ *@def UNLINKED 4ul
+ *@brief The bit of the version of a node that is set when it is removed from the tree.
+ */
+#define UNLINKED 4ul
+
+/**
+ *@def VERSION_STEP 8ul
+ *@brief Added to the version of a node when its sub tree loses keys (the bits below are flags).
+ */
+#define VERSION_STEP 8ul
+
+/**
+ *@def RECLAIM_BATCH 1024
+ *@brief The fixer frees the retired nodes when there are this many of them, or when it is idle.
+ */
+#define RECLAIM_BATCH 1024
+
+/**
+ *@def LOAD(field)
+ *@brief Reads a field that other threads may write at the same time.
+ */
+#define LOAD(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+
+/**
+ *@def STORE(field, value)
+ *@brief Writes a field that other threads may read at the same time.
+ */
+#define STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
+
+/**
+ * 1 + the stripe of the thread, 0 until it uses a set for the first time
+ */
+static __thread unsigned threadStripe = 0;
+
+/**
+ * The number of threads that got a stripe so far
+ */
+static unsigned stripedThreads = 0;
+
+/**
+ * The stripe of the calling thread. The threads get the stripes in turn, so up to
+ * CONCURRENT_STRIPES threads have one each
+ * @param set the set
+ * @return the stripe
+ */
+ConcurrentStripe *stripeOfThread(ConcurrentSet *set);
+
+/**
+ * Takes the lock of a node
+ * @param node the node
+ */
+void lockNode(ConcurrentNode *node);
+
+/**
+ * Releases the lock of a node
+ * @param node the node
+ */
+void unlockNode(ConcurrentNode *node);
+
+/**
+ * Reads the version of a node when no rotation is moving it down
+ * @param node the node
+ * @return the version, without LOCKED
+ */
+long unsigned stableVersion(ConcurrentNode *node);
+
+/**
+ * Registers an operation in the current epoch, so the nodes it may see are not freed
+ * @param set the set
+ * @return the epoch, to give to exitOperation
+ */
+long unsigned enterOperation(ConcurrentSet *set);
+
+/**
+ * Ends an operation that enterOperation registered
+ * @param set the set
+ * @param epoch the epoch of the operation
+ */
+void exitOperation(ConcurrentSet *set, long unsigned epoch);
+
+/**
+ * Searches for an item
+ * @param set the set
+ * @param data the item
+ * @param parent set to the node above the result (or above the empty place of the item)
+ * @param parentVersion set to the version of parent that the search saw
+ * @param dir set to the side of parent the item is at (less than 0 for left)
+ * @return the node that holds an item equal to data (it may be deleted), NULL if there is none
+ */
+ConcurrentNode *searchConcurrentSet(ConcurrentSet *set, const void *data,
+									ConcurrentNode **parent, long unsigned *parentVersion,
+									int *dir);
+
+/**
+ * One pass of searchConcurrentSet, from the root
+ * @return true if the pass ended, false if it has to start again (see searchConcurrentSet for
+ * the other parameters)
+ */
+int trySearch(ConcurrentSet *set, const void *data, ConcurrentNode **result,
+			  ConcurrentNode **parent, long unsigned *parentVersion, int *dir);
+
+/**
+ * Allocates a leaf
+ * @param data the item of the leaf
+ * @param parent the parent of the leaf
+ * @return the leaf, NULL on failure
+ */
+ConcurrentNode *newConcurrentNode(void *data, ConcurrentNode *parent);
+
+/**
+ * Adds a node to the queue of the fixer, if it is not there already. A writer must hold the lock
+ * of the node (so it can not be unlinked meanwhile)
+ * @param set the set
+ * @param node the node
+ */
+void queueForFixer(ConcurrentSet *set, ConcurrentNode *node);
+
+/**
+ * Wakes the fixer if it sleeps, after something was queued or retired
+ * @param set the set
+ */
+void wakeFixer(ConcurrentSet *set);
+
+/**
+ * The thread that repairs the nodes in the queue
+ * @param pSet the set
+ * @return NULL
+ */
+void *runFixer(void *pSet);
+
+/**
+ * Repairs one node: unlinks it if it is deleted and has at most one child, rotates it if it is
+ * not balanced, or updates its height. The nodes whose height may change are queued again
+ * @param set the set
+ * @param node the node
+ */
+void repairNode(ConcurrentSet *set, ConcurrentNode *node);
+
+/**
+ * Moves the child of a node above it (a right rotation if the child is the left one). The caller
+ * holds the locks of parent and node
+ * @param parent the parent of node
+ * @param node the node to move down
+ * @param child the child of node to move up
+ */
+void rotateConcurrent(ConcurrentNode *parent, ConcurrentNode *node, ConcurrentNode *child);
+
+/**
+ * Removes a deleted node that has at most one child. The caller holds the locks of parent and
+ * node
+ * @param set the set
+ * @param parent the parent of node
+ * @param node the node
+ */
+void unlinkConcurrent(ConcurrentSet *set, ConcurrentNode *parent, ConcurrentNode *node);
+
+/**
+ * Adds an unlinked node to the nodes that wait to be freed
+ * @param set the set
+ * @param node the node
+ */
+void retireNode(ConcurrentSet *set, ConcurrentNode *node);
+
+/**
+ * Frees the retired nodes and items, after every operation that may hold them ended
+ * @param set the set
+ */
+void reclaimRetired(ConcurrentSet *set);
+
+/**
+ * The number of replaced items that wait to be freed
+ * @param set the set
+ * @return the number
+ */
+long unsigned retiredItemCount(ConcurrentSet *set);
+
+/**
+ * The height of a sub tree, as the fixer knows it
+ * @param node the root of the sub tree (may be NULL)
+ * @return its height, 0 for NULL
+ */
+int concurrentHeight(const ConcurrentNode *node);
+
+/**
+ * Updates the height of a node from the heights of its children
+ * @param node the node
+ * @return true if the height changed
+ */
+int updateConcurrentHeight(ConcurrentNode *node);
+
+/**
+ * Frees the nodes of a sub tree and their items (no other thread may use them)
+ * @param set the set
+ * @param node the root of the sub tree
+ */
+void freeConcurrentNodes(ConcurrentSet *set, ConcurrentNode *node);
+
+void lockNode(ConcurrentNode *node)
+{
+	while (true)
+	{
+		long unsigned version = LOAD(node->version);
+		if (!(version & LOCKED) &&
+			__atomic_compare_exchange_n(&node->version, &version, version | LOCKED, false,
+										__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		{
+			return;
+		}
+		sched_yield();
+	}
+}
+
+void unlockNode(ConcurrentNode *node)
+{
+	__atomic_fetch_and(&node->version, ~LOCKED, __ATOMIC_RELEASE);
+}
+
+long unsigned stableVersion(ConcurrentNode *node)
+{
+	long unsigned version = LOAD(node->version);
+	while (version & SHRINKING)
+	{
+		sched_yield(); // the rotation is short, and it holds the lock of the node
+		version = LOAD(node->version);
+	}
+	return version & ~LOCKED;
+}
+
+ConcurrentStripe *stripeOfThread(ConcurrentSet *set)
+{
+	if (threadStripe == 0)
+	{
+		threadStripe = 1 + __atomic_fetch_add(&stripedThreads, 1, __ATOMIC_RELAXED) %
+						   CONCURRENT_STRIPES;
+	}
+	return &set->stripes[threadStripe - 1];
+}
+
+long unsigned enterOperation(ConcurrentSet *set)
+{
+	// the stripe may be shared by more threads than CONCURRENT_STRIPES, so it is still an atomic
+	// add, but of a cache line that the other cores rarely touch
+	ConcurrentStripe *stripe = stripeOfThread(set);
+	while (true)
+	{
+		long unsigned epoch = __atomic_load_n(&set->epoch, __ATOMIC_SEQ_CST);
+		__atomic_fetch_add(&stripe->active[epoch % 2], 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&set->epoch, __ATOMIC_SEQ_CST) == epoch)
+		{
+			return epoch;
+		}
+		// the fixer flipped the epoch meanwhile, and may not wait for this one
+		__atomic_fetch_sub(&stripe->active[epoch % 2], 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+void exitOperation(ConcurrentSet *set, long unsigned epoch)
+{
+	__atomic_fetch_sub(&stripeOfThread(set)->active[epoch % 2], 1, __ATOMIC_SEQ_CST);
+}
+
+int trySearch(ConcurrentSet *set, const void *data, ConcurrentNode **result,
+			  ConcurrentNode **parent, long unsigned *parentVersion, int *dir)
+{
+	ConcurrentNode *node = &set->holder;
+	long unsigned version = stableVersion(node);
+	int cmp = 1; // every item is larger than the holder
+	while (true)
+	{
+		ConcurrentNode *child = (cmp < 0) ? LOAD(node->left) : LOAD(node->right);
+		if ((LOAD(node->version) & ~LOCKED) != version)
+		{
+			return false; // node moved down or was unlinked, child may not be its child
+		}
+		if (child == NULL)
+		{
+			*result = NULL;
+			break;
+		}
+		int childCmp = set->compFunc(data, LOAD(child->data));
+		long unsigned childVersion = stableVersion(child);
+		if ((LOAD(node->version) & ~LOCKED) != version)
+		{
+			return false;
+		}
+		if ((childVersion & UNLINKED) || child != ((cmp < 0) ? LOAD(node->left) : LOAD(node->right)))
+		{
+			continue; // node has a new child there (the old one was unlinked or rotated down)
+		}
+		if (childCmp == 0)
+		{
+			*result = child;
+			break;
+		}
+		node = child;
+		version = childVersion;
+		cmp = childCmp;
+	}
+	*parent = node;
+	*parentVersion = version;
+	*dir = cmp;
+	return true;
+}
+
+ConcurrentNode *searchConcurrentSet(ConcurrentSet *set, const void *data,
+									ConcurrentNode **parent, long unsigned *parentVersion,
+									int *dir)
+{
+	ConcurrentNode *result = NULL;
+	while (!trySearch(set, data, &result, parent, parentVersion, dir))
+	{
+	}
+	return result;
+}
+
+ConcurrentNode *newConcurrentNode(void *data, ConcurrentNode *parent)
+{
+	ConcurrentNode *node = (ConcurrentNode *) calloc(1, sizeof(ConcurrentNode));
+	if (node == NULL)
+	{
+		return NULL;
+	}
+	node->data = data;
+	node->parent = parent;
+	node->height = 1;
+	return node;
+}
+
+void queueForFixer(ConcurrentSet *set, ConcurrentNode *node)
+{
+	if (__atomic_exchange_n(&node->queued, true, __ATOMIC_ACQ_REL))
+	{
+		return; // the fixer did not take it yet
+	}
+	ConcurrentNode *head = LOAD(set->queueHead);
+	do
+	{
+		node->queueNext = head;
+	} while (!__atomic_compare_exchange_n(&set->queueHead, &head, node, true, __ATOMIC_SEQ_CST,
+										  __ATOMIC_ACQUIRE));
+	wakeFixer(set);
+}
+
+void wakeFixer(ConcurrentSet *set)
+{
+	if (!__atomic_load_n(&set->fixing, __ATOMIC_SEQ_CST))
+	{
+		pthread_mutex_lock(&set->lock);
+		pthread_cond_signal(&set->work);
+		pthread_mutex_unlock(&set->lock);
+	}
+}
+
+ConcurrentSet *newConcurrentSet(CompareFunc compFunc, FreeFunc freeFunc)
+{
+	if (compFunc == NULL)
+	{
+		return NULL;
+	}
+	ConcurrentSet *set = (ConcurrentSet *) calloc(1, sizeof(ConcurrentSet));
+	if (set == NULL)
+	{
+		return NULL;
+	}
+	set->compFunc = compFunc;
+	set->freeFunc = freeFunc;
+	set->fixing = true; // until it first goes to sleep
+	void *stripes = NULL;
+	if (posix_memalign(&stripes, CONCURRENT_LINE, CONCURRENT_STRIPES * sizeof(ConcurrentStripe))
+		!= 0)
+	{
+		free(set);
+		return NULL;
+	}
+	memset(stripes, 0, CONCURRENT_STRIPES * sizeof(ConcurrentStripe));
+	set->stripes = (ConcurrentStripe *) stripes;
+	if (pthread_mutex_init(&set->lock, NULL) != 0)
+	{
+		free(set->stripes);
+		free(set);
+		return NULL;
+	}
+	if (pthread_cond_init(&set->work, NULL) != 0)
+	{
+		pthread_mutex_destroy(&set->lock);
+		free(set->stripes);
+		free(set);
+		return NULL;
+	}
+	if (pthread_cond_init(&set->idle, NULL) != 0)
+	{
+		pthread_cond_destroy(&set->work);
+		pthread_mutex_destroy(&set->lock);
+		free(set->stripes);
+		free(set);
+		return NULL;
+	}
+	if (pthread_create(&set->fixer, NULL, runFixer, set) != 0)
+	{
+		pthread_cond_destroy(&set->idle);
+		pthread_cond_destroy(&set->work);
+		pthread_mutex_destroy(&set->lock);
+		free(set->stripes);
+		free(set);
+		return NULL;
+	}
+	return set;
+}
+
+int insertToConcurrentSet(ConcurrentSet *set, void *data)
+{
+	if (set == NULL || data == NULL)
+	{
+		return false;
+	}
+	long unsigned epoch = enterOperation(set);
+	int inserted = false;
+	while (true)
+	{
+		ConcurrentNode *parent;
+		long unsigned parentVersion;
+		int dir;
+		ConcurrentNode *node = searchConcurrentSet(set, data, &parent, &parentVersion, &dir);
+		if (node == NULL)
+		{
+			lockNode(parent);
+			ConcurrentNode **slot = (dir < 0) ? &parent->left : &parent->right;
+			if ((LOAD(parent->version) & ~LOCKED) != parentVersion || *slot != NULL)
+			{
+				unlockNode(parent); // a rotation, an unlink or another insert got there first
+				continue;
+			}
+			ConcurrentNode *leaf = newConcurrentNode(data, parent);
+			if (leaf != NULL)
+			{
+				STORE(*slot, leaf);
+				queueForFixer(set, parent);
+				inserted = true;
+			}
+			unlockNode(parent);
+			break;
+		}
+		lockNode(node);
+		if (LOAD(node->version) & UNLINKED)
+		{
+			unlockNode(node);
+			continue;
+		}
+		if (node->deleted)
+		{
+			// the node is reused, its old item may still be compared by running searches
+			RetiredItem *item = (RetiredItem *) malloc(sizeof(RetiredItem));
+			if (item != NULL)
+			{
+				item->data = node->data;
+				STORE(node->data, data);
+				STORE(node->deleted, false);
+				// the fixer takes the whole list before it frees any of it, so the head stays
+				// allocated while this operation runs
+				RetiredItem *head = LOAD(set->retiredItems);
+				do
+				{
+					item->next = head;
+					item->count = (head == NULL) ? 1 : head->count + 1;
+				} while (!__atomic_compare_exchange_n(&set->retiredItems, &head, item, true,
+													  __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+				inserted = true;
+			}
+		}
+		unlockNode(node);
+		break;
+	}
+	if (inserted)
+	{
+		__atomic_fetch_add(&stripeOfThread(set)->size, 1, __ATOMIC_RELAXED);
+	}
+	exitOperation(set, epoch);
+	return inserted;
+}
+
+int deleteFromConcurrentSet(ConcurrentSet *set, void *data)
+{
+	if (set == NULL || data == NULL)
+	{
+		return false;
+	}
+	long unsigned epoch = enterOperation(set);
+	int deleted = false;
+	while (true)
+	{
+		ConcurrentNode *parent;
+		long unsigned parentVersion;
+		int dir;
+		ConcurrentNode *node = searchConcurrentSet(set, data, &parent, &parentVersion, &dir);
+		if (node == NULL)
+		{
+			break;
+		}
+		lockNode(node);
+		if (LOAD(node->version) & UNLINKED)
+		{
+			unlockNode(node);
+			continue;
+		}
+		if (!node->deleted)
+		{
+			STORE(node->deleted, true);
+			queueForFixer(set, node); // the fixer unlinks it when it has at most one child
+			deleted = true;
+		}
+		unlockNode(node);
+		break;
+	}
+	if (deleted)
+	{
+		__atomic_fetch_sub(&stripeOfThread(set)->size, 1, __ATOMIC_RELAXED);
+	}
+	exitOperation(set, epoch);
+	return deleted;
+}
+
+int concurrentSetContains(ConcurrentSet *set, const void *data)
+{
+	if (set == NULL || data == NULL)
+	{
+		return false;
+	}
+	long unsigned epoch = enterOperation(set);
+	ConcurrentNode *parent;
+	long unsigned parentVersion;
+	int dir;
+	ConcurrentNode *node = searchConcurrentSet(set, data, &parent, &parentVersion, &dir);
+	// an unlinked node stays deleted, so the answer is right also if it was unlinked meanwhile
+	int found = node != NULL && !LOAD(node->deleted);
+	exitOperation(set, epoch);
+	return found;
+}
+
+long unsigned concurrentSetSize(ConcurrentSet *set)
+{
+	if (set == NULL)
+	{
+		return 0;
+	}
+	long size = 0;
+	for (int i = 0; i < CONCURRENT_STRIPES; i++)
+	{
+		size += __atomic_load_n(&set->stripes[i].size, __ATOMIC_RELAXED);
+	}
+	return (size < 0) ? 0 : (long unsigned) size; // a delete was counted before its insert
+}
+
+int concurrentHeight(const ConcurrentNode *node)
+{
+	return (node == NULL) ? 0 : node->height;
+}
+
+int updateConcurrentHeight(ConcurrentNode *node)
+{
+	int left = concurrentHeight(LOAD(node->left));
+	int right = concurrentHeight(LOAD(node->right));
+	int height = 1 + ((left > right) ? left : right);
+	if (height == node->height)
+	{
+		return false;
+	}
+	node->height = height;
+	return true;
+}
+
+void rotateConcurrent(ConcurrentNode *parent, ConcurrentNode *node, ConcurrentNode *child)
+{
+	lockNode(child);
+	// the searches that are in node now may be in the wrong sub tree after the rotation
+	__atomic_fetch_or(&node->version, SHRINKING, __ATOMIC_RELEASE);
+	int right = LOAD(node->left) == child;
+	ConcurrentNode *inner = right ? LOAD(child->right) : LOAD(child->left);
+	// child is linked to parent last, since its version does not change: a search that reaches it
+	// through parent must not find inner under it anymore
+	if (right)
+	{
+		STORE(node->left, inner);
+		STORE(child->right, node);
+	}
+	else
+	{
+		STORE(node->right, inner);
+		STORE(child->left, node);
+	}
+	if (inner != NULL)
+	{
+		inner->parent = node;
+	}
+	node->parent = child;
+	if (LOAD(parent->left) == node)
+	{
+		STORE(parent->left, child);
+	}
+	else
+	{
+		STORE(parent->right, child);
+	}
+	child->parent = parent;
+	updateConcurrentHeight(node);
+	updateConcurrentHeight(child);
+	long unsigned version = LOAD(node->version);
+	STORE(node->version, (version + VERSION_STEP) & ~SHRINKING);
+	unlockNode(child);
+}
+
+void unlinkConcurrent(ConcurrentSet *set, ConcurrentNode *parent, ConcurrentNode *node)
+{
+	ConcurrentNode *child = (LOAD(node->left) != NULL) ? LOAD(node->left) : LOAD(node->right);
+	if (LOAD(parent->left) == node)
+	{
+		STORE(parent->left, child);
+	}
+	else
+	{
+		STORE(parent->right, child);
+	}
+	if (child != NULL)
+	{
+		child->parent = parent;
+	}
+	long unsigned version = LOAD(node->version);
+	STORE(node->version, (version + VERSION_STEP) | UNLINKED);
+	// the writers do not queue an unlinked node, so only the fixer may still queue it
+	if (!LOAD(node->queued)) // otherwise it is retired when the fixer takes it from the queue
+	{
+		retireNode(set, node);
+	}
+}
+
+void retireNode(ConcurrentSet *set, ConcurrentNode *node)
+{
+	node->retiredNext = set->retiredNodes;
+	set->retiredNodes = node;
+	set->retiredCount++;
+}
+
+void repairNode(ConcurrentSet *set, ConcurrentNode *node)
+{
+	if (LOAD(node->version) & UNLINKED)
+	{
+		retireNode(set, node);
+		return;
+	}
+	if (node == &set->holder)
+	{
+		return;
+	}
+	// only the fixer changes the parents, so it can read them without a lock
+	ConcurrentNode *parent = node->parent;
+	lockNode(parent);
+	lockNode(node);
+	ConcurrentNode *left = LOAD(node->left);
+	ConcurrentNode *right = LOAD(node->right);
+	if (LOAD(node->deleted) && (left == NULL || right == NULL))
+	{
+		unlinkConcurrent(set, parent, node);
+		queueForFixer(set, parent);
+	}
+	else if (concurrentHeight(left) > concurrentHeight(right) + 1 ||
+			 concurrentHeight(right) > concurrentHeight(left) + 1)
+	{
+		ConcurrentNode *child = (concurrentHeight(left) > concurrentHeight(right)) ? left : right;
+		ConcurrentNode *outer = (child == left) ? LOAD(child->left) : LOAD(child->right);
+		ConcurrentNode *inner = (child == left) ? LOAD(child->right) : LOAD(child->left);
+		if (concurrentHeight(inner) > concurrentHeight(outer))
+		{
+			// a double rotation: the inner grandchild goes up to child first
+			lockNode(child);
+			rotateConcurrent(node, child, inner);
+			unlockNode(child);
+			queueForFixer(set, child);
+			child = inner;
+		}
+		rotateConcurrent(parent, node, child);
+		queueForFixer(set, node);
+		queueForFixer(set, child);
+		queueForFixer(set, parent);
+	}
+	else if (updateConcurrentHeight(node))
+	{
+		queueForFixer(set, parent);
+	}
+	unlockNode(node);
+	unlockNode(parent);
+}
+
+long unsigned retiredItemCount(ConcurrentSet *set)
+{
+	RetiredItem *head = LOAD(set->retiredItems);
+	return (head == NULL) ? 0 : head->count; // only the fixer frees the items
+}
+
+void reclaimRetired(ConcurrentSet *set)
+{
+	ConcurrentNode *nodes = set->retiredNodes;
+	RetiredItem *items = __atomic_exchange_n(&set->retiredItems, NULL, __ATOMIC_ACQUIRE);
+	set->retiredNodes = NULL;
+	set->retiredCount = 0;
+	if (nodes == NULL && items == NULL)
+	{
+		return;
+	}
+	// every operation that may hold these is registered in the current epoch
+	long unsigned epoch = __atomic_fetch_add(&set->epoch, 1, __ATOMIC_SEQ_CST);
+	for (int i = 0; i < CONCURRENT_STRIPES; i++)
+	{
+		while (__atomic_load_n(&set->stripes[i].active[epoch % 2], __ATOMIC_SEQ_CST) != 0)
+		{
+			sched_yield();
+		}
+	}
+	while (nodes != NULL)
+	{
+		ConcurrentNode *next = nodes->retiredNext;
+		if (set->freeFunc != NULL)
+		{
+			set->freeFunc(nodes->data);
+		}
+		free(nodes);
+		nodes = next;
+	}
+	while (items != NULL)
+	{
+		RetiredItem *next = items->next;
+		if (set->freeFunc != NULL)
+		{
+			set->freeFunc(items->data);
+		}
+		free(items);
+		items = next;
+	}
+}
+
+void *runFixer(void *pSet)
+{
+	ConcurrentSet *set = (ConcurrentSet *) pSet;
+	while (!LOAD(set->stopping))
+	{
+		ConcurrentNode *queue = __atomic_exchange_n(&set->queueHead, NULL, __ATOMIC_ACQUIRE);
+		if (queue == NULL)
+		{
+			if (set->retiredCount > 0 || retiredItemCount(set) > 0)
+			{
+				reclaimRetired(set);
+				continue;
+			}
+			pthread_mutex_lock(&set->lock);
+			__atomic_store_n(&set->fixing, false, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&set->queueHead, __ATOMIC_SEQ_CST) == NULL && !set->stopping)
+			{
+				pthread_cond_broadcast(&set->idle);
+				pthread_cond_wait(&set->work, &set->lock);
+			}
+			__atomic_store_n(&set->fixing, true, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&set->lock);
+			continue;
+		}
+		ConcurrentNode *batch = NULL;
+		while (queue != NULL) // the queue has the last queued first, repair in the queued order
+		{
+			ConcurrentNode *next = queue->queueNext;
+			queue->queueNext = batch;
+			batch = queue;
+			queue = next;
+		}
+		while (batch != NULL)
+		{
+			// a node stays marked until its turn, so queueing it again does not touch the batch
+			ConcurrentNode *next = batch->queueNext;
+			STORE(batch->queued, false);
+			repairNode(set, batch);
+			batch = next;
+		}
+		if (set->retiredCount >= RECLAIM_BATCH || retiredItemCount(set) >= RECLAIM_BATCH)
+		{
+			reclaimRetired(set);
+		}
+	}
+	pthread_mutex_lock(&set->lock);
+	__atomic_store_n(&set->fixing, false, __ATOMIC_SEQ_CST);
+	pthread_cond_broadcast(&set->idle);
+	pthread_mutex_unlock(&set->lock);
+	return NULL;
+}
+
+void waitForConcurrentSetFixer(ConcurrentSet *set)
+{
+	if (set == NULL)
+	{
+		return;
+	}
+	pthread_mutex_lock(&set->lock);
+	// the fixer is fixing from before it takes a queue until it finds the queue empty
+	while ((LOAD(set->queueHead) != NULL || LOAD(set->fixing)) && !set->stopping)
+	{
+		pthread_cond_wait(&set->idle, &set->lock);
+	}
+	pthread_mutex_unlock(&set->lock);
+}
+
+int forEachConcurrentSet(ConcurrentSet *set, forEachFunc func, void *args)
+{
+	if (set == NULL || func == NULL)
+	{
+		return false;
+	}
+	ConcurrentNode *node = set->holder.right;
+	while (node != NULL && node->left != NULL)
+	{
+		node = node->left;
+	}
+	while (node != NULL)
+	{
+		if (!node->deleted && func(node->data, args) == 0)
+		{
+			return false;
+		}
+		if (node->right != NULL) // the next node is the smallest of the right sub tree
+		{
+			node = node->right;
+			while (node->left != NULL)
+			{
+				node = node->left;
+			}
+			continue;
+		}
+		while (node->parent != &set->holder && node->parent->right == node)
+		{
+			node = node->parent;
+		}
+		node = (node->parent == &set->holder) ? NULL : node->parent;
+	}
+	return true;
+}
+
+void freeConcurrentNodes(ConcurrentSet *set, ConcurrentNode *node)
+{
+	// frees the leaves one by one, through the parents, without recursion
+	while (node != NULL && node != &set->holder)
+	{
+		if (node->left != NULL)
+		{
+			node = node->left;
+			continue;
+		}
+		if (node->right != NULL)
+		{
+			node = node->right;
+			continue;
+		}
+		ConcurrentNode *parent = node->parent;
+		if (parent->left == node)
+		{
+			parent->left = NULL;
+		}
+		else
+		{
+			parent->right = NULL;
+		}
+		if (set->freeFunc != NULL)
+		{
+			set->freeFunc(node->data);
+		}
+		free(node);
+		node = parent;
+	}
+}
+
+void freeConcurrentSet(ConcurrentSet **set)
+{
+	if (set == NULL || *set == NULL)
+	{
+		return;
+	}
+	ConcurrentSet *toFree = *set;
+	pthread_mutex_lock(&toFree->lock);
+	STORE(toFree->stopping, true);
+	pthread_cond_signal(&toFree->work);
+	pthread_mutex_unlock(&toFree->lock);
+	pthread_join(toFree->fixer, NULL);
+	reclaimRetired(toFree);
+	// unlinked nodes that were still queued were not retired yet
+	for (ConcurrentNode *node = toFree->queueHead; node != NULL;)
+	{
+		ConcurrentNode *next = node->queueNext;
+		if (node->version & UNLINKED)
+		{
+			if (toFree->freeFunc != NULL)
+			{
+				toFree->freeFunc(node->data);
+			}
+			free(node);
+		}
+		node = next;
+	}
+	freeConcurrentNodes(toFree, toFree->holder.right);
+	pthread_cond_destroy(&toFree->idle);
+	pthread_cond_destroy(&toFree->work);
+	pthread_mutex_destroy(&toFree->lock);
+	free(toFree->stripes);
+	free(toFree);
+	*set = NULL;
+}
@@ -0,0 +1,153 @@
+#ifndef RBTREE_CONCURRENTSET_H
+#define RBTREE_CONCURRENTSET_H
+
+#include <pthread.h>
+#include "RBTree.h"
+
+/**
+ * a node of a concurrent set. The version is the lock of the node and tells the searches that
+ * passed through it whether its sub tree changed since (see ConcurrentSet.c).
+ */
+typedef struct ConcurrentNode
+{
+	struct ConcurrentNode *parent, *left, *right;
+	void *data;
+	long unsigned version;
+	int deleted; // if not 0, the item was removed and the node only routes the searches
+	int height; // of the sub tree, kept by the fixer (may be out of date until it runs)
+	int queued; // if not 0, the node waits for the fixer
+	struct ConcurrentNode *queueNext; // in the queue of the fixer (only the fixer follows it)
+	struct ConcurrentNode *retiredNext; // in the list of the nodes that wait to be freed
+} ConcurrentNode;
+
+/**
+ * an item that was replaced in its node, and waits to be freed.
+ */
+typedef struct RetiredItem
+{
+	void *data;
+	struct RetiredItem *next;
+	long unsigned count; // the number of items in the list, from this one to the end
+} RetiredItem;
+
+/**
+ *@def CONCURRENT_STRIPES 64
+ *@brief The number of counters the threads of a set are spread over (see ConcurrentStripe).
+ */
+#define CONCURRENT_STRIPES 64
+
+/**
+ *@def CONCURRENT_LINE 64
+ *@brief The size of a cache line, so every stripe has one of its own.
+ */
+#define CONCURRENT_LINE 64
+
+/**
+ * the counters of some of the threads that use a set. Each thread always uses the same stripe,
+ * so threads on different cores do not write to the same cache line.
+ */
+typedef struct ConcurrentStripe
+{
+	long unsigned active[2]; // the running operations of the stripe, by the parity of the epoch
+	long size; // the items that the stripe inserted, less the ones it deleted
+	char padding[CONCURRENT_LINE - 2 * sizeof(long unsigned) - sizeof(long)];
+} ConcurrentStripe;
+
+/**
+ * an ordered set that many threads can change and search at once.
+ * Searches take no locks: they follow the versions of the nodes and start again if a rotation
+ * moved the part of the tree they were in. Inserts add leaves and deletes only mark their node,
+ * each under the lock of one node, so changes in different parts of the tree run in parallel.
+ * The balance is relaxed: the changed nodes are queued, and a background fixer thread repairs the
+ * heights, rotates, and unlinks the deleted nodes. Unlinked nodes are freed when every operation
+ * that was running when they were unlinked ended (epochs).
+ * The threads share no counter and no lock: the queue of the fixer and the list of the replaced
+ * items take an atomic push, the mutex is taken only to wake the fixer when it sleeps, and the
+ * running operations and the size are counted in the stripe of each thread.
+ */
+typedef struct ConcurrentSet
+{
+	ConcurrentNode holder; // its right child is the root, it is smaller than every item
+	CompareFunc compFunc;
+	FreeFunc freeFunc; // may be NULL if the set does not own its items
+	ConcurrentStripe *stripes; // CONCURRENT_STRIPES of them, each in a cache line of its own
+	long unsigned epoch; // the operations of the current epoch count in active[epoch % 2]
+	pthread_mutex_t lock; // taken to sleep and to wake the fixer
+	pthread_cond_t work; // signalled when nodes are queued or the set is freed
+	pthread_cond_t idle; // signalled when the fixer has nothing to do
+	ConcurrentNode *queueHead; // the nodes that wait for the fixer, the last queued first
+	ConcurrentNode *retiredNodes; // only the fixer uses them
+	long unsigned retiredCount;
+	RetiredItem *retiredItems;
+	int fixing; // if 0, the fixer sleeps (or is going to), and a writer that queues must wake it
+	int stopping; // if not 0, the fixer should exit
+	pthread_t fixer;
+} ConcurrentSet;
+
+/**
+ * constructs a new concurrent set, and starts its fixer thread.
+ * @param compFunc: compares the items.
+ * @param freeFunc: frees the items (may be NULL).
+ * @return: the set, NULL on failure.
+ */
+ConcurrentSet *newConcurrentSet(CompareFunc compFunc, FreeFunc freeFunc);
+
+/**
+ * add an item to the set. Safe to call from many threads at once.
+ * @param set: the set.
+ * @param data: the item, owned by the set on success.
+ * @return: 0 on failure (the item is already in the set, or an allocation failed), other on
+ * success.
+ */
+int insertToConcurrentSet(ConcurrentSet *set, void *data);
+
+/**
+ * remove an item from the set. The node of the item stays in the tree until the fixer unlinks it,
+ * and the item is freed when no running search can see it anymore. Safe to call from many
+ * threads at once.
+ * @param set: the set.
+ * @param data: an item that is equal to the one to remove.
+ * @return: 0 if the item is not in the set, other on success.
+ */
+int deleteFromConcurrentSet(ConcurrentSet *set, void *data);
+
+/**
+ * check whether the set contains an item, without taking any lock. Safe to call from many
+ * threads at once.
+ * @param set: the set.
+ * @param data: the item to check.
+ * @return: 0 if the item is not in the set, other if it is.
+ */
+int concurrentSetContains(ConcurrentSet *set, const void *data);
+
+/**
+ * @param set: the set.
+ * @return: the number of items in the set. The counters of the threads are summed one after the
+ * other, so while other threads change the set it is only close to the number at any moment.
+ */
+long unsigned concurrentSetSize(ConcurrentSet *set);
+
+/**
+ * wait until the fixer repaired every change that was made so far, so the tree is balanced (if
+ * nothing changes it meanwhile).
+ * @param set: the set.
+ */
+void waitForConcurrentSetFixer(ConcurrentSet *set);
+
+/**
+ * Activate a function on each item of the set, in an ascending order, until it returns 0. Not
+ * safe while other threads change the set.
+ * @param set: the set.
+ * @param func: the function to activate on the items.
+ * @param args: more optional arguments to the function.
+ * @return: 0 on failure, other on success.
+ */
+int forEachConcurrentSet(ConcurrentSet *set, forEachFunc func, void *args);
+
+/**
+ * stop the fixer and free the set, its nodes and its items. No other thread may use the set.
+ * @param set: pointer to the set. It is set to NULL.
+ */
+void freeConcurrentSet(ConcurrentSet **set);
+
+#endif //RBTREE_CONCURRENTSET_H
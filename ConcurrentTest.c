@@ -0,0 +1,316 @@
+/**
+* @file ConcurrentTest.c
+* @author Aviel Shtern Aviel.Shtern@mail.huji.ac.il
+* @version 1.0
+* @date 3 jun 2020
+* @brief A stress test of ConcurrentSet. Threads insert, delete and search at once while the fixer
+* runs. Each thread changes only keys of its own, so it knows the answer of each of its calls, and
+* also searches the keys of the others. The keys of the threads are first interleaved, so they
+* change the same parts of the tree, and then in separate ranges. When the threads and the fixer
+* are done, the test checks the tree: the order, the parents, the AVL heights, the size, and that
+* the deleted nodes that are left have two children. Freeing the set must free every item it took
+* exactly once. Build it with make concurrent_test SANITIZE=thread (after make
+* clean) to check the version locks and the reclamation with ThreadSanitizer.
+* usage: concurrent_test [threads] [keys] [operations per thread]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "ConcurrentSet.h"
+
+/**
+ *@def DEFAULT_THREADS 4
+ *@brief The number of threads if it is not given.
+ */
+#define DEFAULT_THREADS 4
+
+/**
+ *@def DEFAULT_KEYS 20000
+ *@brief The number of keys if it is not given.
+ */
+#define DEFAULT_KEYS 20000
+
+/**
+ *@def DEFAULT_OPS 100000
+ *@brief The number of operations of each thread if it is not given.
+ */
+#define DEFAULT_OPS 100000
+
+/**
+ *@def INSERT_SHARE 4
+ *@brief Out of 10 operations, the number of inserts (then deletes, then searches).
+ */
+#define INSERT_SHARE 4
+
+/**
+ *@def DELETE_SHARE 3
+ *@brief Out of 10 operations, the number of deletes.
+ */
+#define DELETE_SHARE 3
+
+/**
+ * The state of one thread of the test.
+ * present: present[k] is not 0 if the thread inserted its key k and did not delete it since.
+ * spread: if not 0, the keys of the thread are close in the order to the keys of the others (so
+ * the threads change the same parts of the tree), else they are in one range of their own.
+ */
+typedef struct Worker
+{
+	ConcurrentSet *set;
+	int id, threads, spread;
+	long keys, ops;
+	char *present;
+	long unsigned inserted; // the number of items the set took
+	long unsigned errors;
+	pthread_t thread;
+} Worker;
+
+/**
+ * The state of checkTree.
+ */
+typedef struct TreeCheck
+{
+	long unsigned errors;
+	long unsigned deleted; // deleted nodes that are still in the tree
+} TreeCheck;
+
+/**
+ * The number of items that freeItem freed
+ */
+static long unsigned freedItems = 0;
+
+/**
+ * Compares two longs
+ */
+int longCompare(const void *a, const void *b);
+
+/**
+ * FreeFunc that counts the items it frees
+ */
+void freeItem(void *data);
+
+/**
+ * A thread of the test
+ * @param pWorker pointer to Worker
+ * @return NULL
+ */
+void *runWorker(void *pWorker);
+
+/**
+ * Checks a sub tree of a quiet set: the parents, the AVL heights and balance, and that every
+ * deleted node has two children (the fixer unlinks the others)
+ * @param node the root of the sub tree (this function recursive)
+ * @param parent the parent node should have
+ * @param check the errors and the deleted nodes are counted in it
+ * @return the height of the sub tree
+ */
+int checkTree(const ConcurrentNode *node, const ConcurrentNode *parent, TreeCheck *check);
+
+/**
+ * forEachFunc that checks the items come in an ascending order, and counts them
+ * @param object pointer to a long
+ * @param pLast pointer to the last long and the count (an array of 2 longs)
+ * @return 0 if the order is wrong, 1 otherwise
+ */
+int checkOrder(const void *object, void *pLast);
+
+/**
+ * Runs one round of the test
+ * @param threads the number of threads
+ * @param keys the number of keys
+ * @param ops the number of operations of each thread
+ * @param spread see Worker
+ * @return true if the round passed
+ */
+int runRound(int threads, long keys, long ops, int spread);
+
+int longCompare(const void *a, const void *b)
+{
+	long first = *(const long *) a, second = *(const long *) b;
+	return (first > second) - (first < second);
+}
+
+void freeItem(void *data)
+{
+	__atomic_fetch_add(&freedItems, 1, __ATOMIC_RELAXED);
+	free(data);
+}
+
+void *runWorker(void *pWorker)
+{
+	Worker *worker = (Worker *) pWorker;
+	unsigned random = (unsigned) worker->id * 7919u + 1u;
+	long range = worker->keys / worker->threads; // the number of keys of each thread
+	for (long i = 0; i < worker->ops; i++)
+	{
+		random = random * 1103515245u + 12345u;
+		long slot = (long) (random >> 8) % range;
+		long key = worker->spread ? slot * worker->threads + worker->id :
+				   worker->id * range + slot;
+		long unsigned op = (random >> 3) % 10;
+		int expected = worker->present[slot] != 0;
+		int result;
+		if (op < INSERT_SHARE)
+		{
+			long *item = (long *) malloc(sizeof(long));
+			if (item == NULL)
+			{
+				worker->errors++;
+				return NULL;
+			}
+			*item = key;
+			result = insertToConcurrentSet(worker->set, item);
+			if (!result)
+			{
+				free(item);
+			}
+			worker->inserted += result != 0;
+			expected = !expected;
+			worker->present[slot] = (char) (worker->present[slot] || result);
+		}
+		else if (op < INSERT_SHARE + DELETE_SHARE)
+		{
+			result = deleteFromConcurrentSet(worker->set, &key);
+			worker->present[slot] = 0;
+		}
+		else
+		{
+			result = concurrentSetContains(worker->set, &key) != 0;
+			long other = (long) (random >> 5) % worker->keys; // a key of any thread
+			concurrentSetContains(worker->set, &other);
+		}
+		if ((result != 0) != expected)
+		{
+			if (worker->errors++ == 0)
+			{
+				printf("thread %d: operation %lu on key %ld returned %d\n", worker->id, op, key,
+					   result);
+			}
+		}
+	}
+	return NULL;
+}
+
+int checkTree(const ConcurrentNode *node, const ConcurrentNode *parent, TreeCheck *check)
+{
+	if (node == NULL)
+	{
+		return 0;
+	}
+	if (node->parent != parent)
+	{
+		check->errors++;
+	}
+	int left = checkTree(node->left, node, check);
+	int right = checkTree(node->right, node, check);
+	int height = 1 + ((left > right) ? left : right);
+	if (left - right > 1 || right - left > 1 || node->height != height)
+	{
+		check->errors++;
+	}
+	if (node->deleted)
+	{
+		check->deleted++;
+		if (node->left == NULL || node->right == NULL)
+		{
+			check->errors++;
+		}
+	}
+	return height;
+}
+
+int checkOrder(const void *object, void *pLast)
+{
+	long *last = (long *) pLast;
+	long value = *(const long *) object;
+	if (last[1] > 0 && value <= last[0])
+	{
+		return 0;
+	}
+	last[0] = value;
+	last[1]++;
+	return 1;
+}
+
+int runRound(int threads, long keys, long ops, int spread)
+{
+	ConcurrentSet *set = newConcurrentSet(longCompare, freeItem);
+	Worker *workers = (Worker *) calloc(threads, sizeof(Worker));
+	if (set == NULL || workers == NULL)
+	{
+		fprintf(stderr, "allocation failed\n");
+		freeConcurrentSet(&set);
+		free(workers);
+		return false;
+	}
+	freedItems = 0;
+	int started = 0;
+	for (; started < threads; started++)
+	{
+		Worker *worker = &workers[started];
+		worker->set = set;
+		worker->id = started;
+		worker->threads = threads;
+		worker->spread = spread;
+		worker->keys = keys;
+		worker->ops = ops;
+		worker->present = (char *) calloc(keys / threads + 1, 1);
+		if (worker->present == NULL ||
+			pthread_create(&worker->thread, NULL, runWorker, worker) != 0)
+		{
+			free(worker->present);
+			break;
+		}
+	}
+	long unsigned errors = (started < threads), live = 0, inserted = 0;
+	for (int t = 0; t < started; t++)
+	{
+		pthread_join(workers[t].thread, NULL);
+		errors += workers[t].errors;
+		inserted += workers[t].inserted;
+		for (long k = 0; k < keys / threads; k++)
+		{
+			live += workers[t].present[k] != 0;
+		}
+		free(workers[t].present);
+	}
+	free(workers);
+
+	waitForConcurrentSetFixer(set);
+	TreeCheck check = {0, 0};
+	int height = checkTree(set->holder.right, &set->holder, &check);
+	long last[2] = {0, 0};
+	int ordered = forEachConcurrentSet(set, checkOrder, last);
+	long unsigned size = concurrentSetSize(set);
+	int passed = errors == 0 && check.errors == 0 && ordered && (long unsigned) last[1] == live &&
+				 size == live;
+	freeConcurrentSet(&set);
+	passed = passed && freedItems == inserted; // every item the set took is freed once
+	printf("%d threads, %s keys: %lu wrong answers, %lu tree errors, %lu items (%lu expected), "
+		   "height %d, %lu deleted nodes left, %lu of %lu items freed, %s\n", threads,
+		   spread ? "spread" : "separate", errors, check.errors, size, live, height, check.deleted,
+		   freedItems, inserted, passed ? "ok" : "FAILED");
+	return passed;
+}
+
+int main(int argc, char *argv[])
+{
+	int threads = (argc > 1) ? atoi(argv[1]) : DEFAULT_THREADS;
+	long keys = (argc > 2) ? atol(argv[2]) : DEFAULT_KEYS;
+	long ops = (argc > 3) ? atol(argv[3]) : DEFAULT_OPS;
+	if (threads < 1 || keys < threads || ops < 0)
+	{
+		fprintf(stderr, "usage: %s [threads] [keys] [operations per thread]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	int passed = runRound(threads, keys, ops, true);
+	passed = runRound(threads, keys, ops, false) && passed;
+	if (!passed)
+	{
+		return EXIT_FAILURE;
+	}
+	printf("concurrent test passed\n");
+	return EXIT_SUCCESS;
+}
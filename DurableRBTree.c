@@ -0,0 +1,667 @@
+/**
+* @file DurableRBTree.c
+* @author Aviel Shtern Aviel.Shtern@mail.huji.ac.il
+* @version 1.0
+* @date 3 jun 2020
+* @brief A Red Black Tree whose changes are kept in a write-ahead log, with group commit,
+* snapshots and recovery after a crash.
+* A record in the log and in the snapshot is: the length of the item (4 bytes), a checksum of the
+* operation and of the item (4 bytes), the operation (1 byte) and the bytes of the item. The
+* numbers are in the byte order of the machine. A snapshot starts with SNAPSHOT_MAGIC and has only
+* insert records.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "DurableRBTree.h"
+
+/**
+ *@def OP_INSERT 1
+ *@brief The operation of a record that adds an item.
+ */
+#define OP_INSERT 1
+
+/**
+ *@def OP_DELETE 2
+ *@brief The operation of a record that removes an item.
+ */
+#define OP_DELETE 2
+
+/**
+ *@def RECORD_HEADER_SIZE 9
+ *@brief The size of the length, the checksum and the operation of a record.
+ */
+#define RECORD_HEADER_SIZE 9
+
+/**
+ *@def SNAPSHOT_MAGIC "RBTSNAP1"
+ *@brief The first bytes of a snapshot file.
+ */
+#define SNAPSHOT_MAGIC "RBTSNAP1"
+
+/**
+ *@def SNAPSHOT_MAGIC_SIZE 8
+ *@brief The size of SNAPSHOT_MAGIC, without the '\0'.
+ */
+#define SNAPSHOT_MAGIC_SIZE 8
+
+/**
+ *@def SNAPSHOT_FLUSH_BYTES (64 * 1024)
+ *@brief A snapshot is written to the file every time its buffer has this many bytes.
+ */
+#define SNAPSHOT_FLUSH_BYTES (64 * 1024)
+
+/**
+ *@def DEFAULT_GROUP_OPS 64
+ *@brief The number of changes that are committed together when it is not set.
+ */
+#define DEFAULT_GROUP_OPS 64
+
+/**
+ *@def DEFAULT_CHECKPOINT_BYTES (64 * 1024 * 1024)
+ *@brief The log size that starts a checkpoint when it is not set.
+ */
+#define DEFAULT_CHECKPOINT_BYTES (64 * 1024 * 1024)
+
+/**
+ *@def LOG_SUFFIX ".log"
+ *@brief Added to the path of the snapshot to make the path of the log.
+ */
+#define LOG_SUFFIX ".log"
+
+/**
+ *@def TEMP_SUFFIX ".tmp"
+ *@brief Added to the path of the snapshot to make the path a new snapshot is written to.
+ */
+#define TEMP_SUFFIX ".tmp"
+
+/**
+ *@def FNV_OFFSET_BASIS 2166136261u
+ *@brief The first value of the 32 bit FNV-1a hash.
+ */
+#define FNV_OFFSET_BASIS 2166136261u
+
+/**
+ *@def FNV_PRIME 16777619u
+ *@brief The 32 bit FNV-1a prime.
+ */
+#define FNV_PRIME 16777619u
+
+/**
+ * Writes a new snapshot (the args of writeSnapshotItem)
+ */
+typedef struct SnapshotWriter
+{
+	int fd;
+	SerializeFunc serialize;
+	RecordBuffer buffer;
+} SnapshotWriter;
+
+/**
+ * The checksum of a record
+ * @param op the operation
+ * @param payload the bytes of the item
+ * @param length the number of bytes
+ * @return the checksum
+ */
+uint32_t recordChecksum(unsigned char op, const unsigned char *payload, long unsigned length);
+
+/**
+ * Makes sure a buffer has room for more bytes
+ * @param buffer the buffer
+ * @param size the number of bytes to add
+ * @return true on success, false if the allocation failed
+ */
+int reserveRecordBuffer(RecordBuffer *buffer, long unsigned size);
+
+/**
+ * Adds a record to the end of a buffer
+ * @param buffer the buffer
+ * @param serialize writes the item
+ * @param op the operation
+ * @param data the item
+ * @return true on success, false on failure (the buffer is not changed)
+ */
+int appendRecord(RecordBuffer *buffer, SerializeFunc serialize, unsigned char op,
+				 const void *data);
+
+/**
+ * Writes bytes to a file, also if write writes only a part of them
+ * @param fd the file
+ * @param bytes the bytes
+ * @param size the number of bytes
+ * @return true on success, false on failure
+ */
+int writeBytes(int fd, const unsigned char *bytes, long unsigned size);
+
+/**
+ * Reads a whole file
+ * @param path the path of the file
+ * @param bytes set to the bytes (should be freed), NULL if the file is empty or does not exist
+ * @param size set to the number of bytes
+ * @return true on success, false on failure
+ */
+int readWholeFile(const char *path, unsigned char **bytes, long unsigned *size);
+
+/**
+ * Applies the records in bytes to the tree, until the end or until a record that is not whole
+ * @param durable the tree
+ * @param bytes the records
+ * @param size the number of bytes
+ * @param end set to the end of the last record that was applied
+ * @return true on success, false if an item could not be read or added
+ */
+int replayRecords(DurableRBTree *durable, const unsigned char *bytes, long unsigned size,
+				  long unsigned *end);
+
+/**
+ * Applies one record to the tree (not to the log)
+ * @param durable the tree
+ * @param op the operation
+ * @param payload the bytes of the item
+ * @param length the number of bytes
+ * @return true on success, false if the item could not be read
+ */
+int applyRecord(DurableRBTree *durable, unsigned char op, const unsigned char *payload,
+				long unsigned length);
+
+/**
+ * Counts a change whose record was added to the pending records, and commits if there are
+ * enough of them
+ * @param durable the tree
+ */
+void recordChange(DurableRBTree *durable);
+
+/**
+ * Syncs the directory of a file, so a rename of the file is on the disk
+ * @param path the path of the file
+ * @return true on success, false on failure
+ */
+int syncDirectory(const char *path);
+
+/**
+ * Writes an item to a new snapshot (a forEachFunc)
+ * @param object the item
+ * @param args the SnapshotWriter
+ * @return true on success, false on failure
+ */
+int writeSnapshotItem(const void *object, void *args);
+
+/**
+ * Makes a path from the path of the snapshot
+ * @param path the path of the snapshot
+ * @param suffix the suffix to add
+ * @return the new path (should be freed), NULL on failure
+ */
+char *joinPath(const char *path, const char *suffix);
+
+/**
+ * Frees a durable tree and closes its log, without committing
+ * @param durable the tree
+ */
+void freeDurableRBTree(DurableRBTree *durable);
+
+uint32_t recordChecksum(unsigned char op, const unsigned char *payload, long unsigned length)
+{
+	uint32_t hash = (FNV_OFFSET_BASIS ^ op) * FNV_PRIME;
+	for (long unsigned i = 0; i < length; i++)
+	{
+		hash = (hash ^ payload[i]) * FNV_PRIME;
+	}
+	return hash;
+}
+
+int reserveRecordBuffer(RecordBuffer *buffer, long unsigned size)
+{
+	if (buffer->used + size <= buffer->capacity)
+	{
+		return true;
+	}
+	long unsigned capacity = (buffer->capacity == 0) ? SNAPSHOT_FLUSH_BYTES : buffer->capacity;
+	while (capacity < buffer->used + size)
+	{
+		capacity *= 2;
+	}
+	unsigned char *bytes = (unsigned char *) realloc(buffer->bytes, capacity);
+	if (bytes == NULL)
+	{
+		return false;
+	}
+	buffer->bytes = bytes;
+	buffer->capacity = capacity;
+	return true;
+}
+
+int appendRecord(RecordBuffer *buffer, SerializeFunc serialize, unsigned char op,
+				 const void *data)
+{
+	if (!reserveRecordBuffer(buffer, RECORD_HEADER_SIZE))
+	{
+		return false;
+	}
+	long unsigned room = buffer->capacity - buffer->used - RECORD_HEADER_SIZE;
+	unsigned char *payload = buffer->bytes + buffer->used + RECORD_HEADER_SIZE;
+	long unsigned length = serialize(data, payload, room);
+	if (length == 0 || length > UINT32_MAX)
+	{
+		return false;
+	}
+	if (length > room)
+	{
+		if (!reserveRecordBuffer(buffer, RECORD_HEADER_SIZE + length))
+		{
+			return false;
+		}
+		payload = buffer->bytes + buffer->used + RECORD_HEADER_SIZE;
+		if (serialize(data, payload, length) != length)
+		{
+			return false;
+		}
+	}
+	uint32_t length32 = (uint32_t) length;
+	uint32_t checksum = recordChecksum(op, payload, length);
+	unsigned char *header = buffer->bytes + buffer->used;
+	memcpy(header, &length32, sizeof(length32));
+	memcpy(header + sizeof(length32), &checksum, sizeof(checksum));
+	header[2 * sizeof(uint32_t)] = op;
+	buffer->used += RECORD_HEADER_SIZE + length;
+	return true;
+}
+
+int writeBytes(int fd, const unsigned char *bytes, long unsigned size)
+{
+	while (size > 0)
+	{
+		ssize_t written = write(fd, bytes, size);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+		bytes += written;
+		size -= written;
+	}
+	return true;
+}
+
+int readWholeFile(const char *path, unsigned char **bytes, long unsigned *size)
+{
+	*bytes = NULL;
+	*size = 0;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return errno == ENOENT;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	if (info.st_size == 0)
+	{
+		close(fd);
+		return true;
+	}
+	*bytes = (unsigned char *) malloc(info.st_size);
+	long unsigned done = 0;
+	while (*bytes != NULL && done < (long unsigned) info.st_size)
+	{
+		ssize_t got = read(fd, *bytes + done, info.st_size - done);
+		if (got < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (got <= 0)
+		{
+			break;
+		}
+		done += got;
+	}
+	close(fd);
+	if (*bytes == NULL || done < (long unsigned) info.st_size)
+	{
+		free(*bytes);
+		*bytes = NULL;
+		return false;
+	}
+	*size = done;
+	return true;
+}
+
+int applyRecord(DurableRBTree *durable, unsigned char op, const unsigned char *payload,
+				long unsigned length)
+{
+	RBTree *tree = durable->tree;
+	void *data = durable->deserialize(payload, length);
+	if (data == NULL)
+	{
+		return false;
+	}
+	// replaying a change the snapshot already has is harmless, so its result is ignored
+	if (op == OP_INSERT && insertToRBTree(tree, data))
+	{
+		return true;
+	}
+	if (op == OP_DELETE)
+	{
+		deleteFromRBTree(tree, data);
+	}
+	tree->freeFunc(data); // a key to delete, or a copy of an item the tree has
+	return true;
+}
+
+int replayRecords(DurableRBTree *durable, const unsigned char *bytes, long unsigned size,
+				  long unsigned *end)
+{
+	long unsigned offset = 0;
+	while (size - offset >= RECORD_HEADER_SIZE)
+	{
+		uint32_t length, checksum;
+		memcpy(&length, bytes + offset, sizeof(length));
+		memcpy(&checksum, bytes + offset + sizeof(length), sizeof(checksum));
+		unsigned char op = bytes[offset + 2 * sizeof(uint32_t)];
+		const unsigned char *payload = bytes + offset + RECORD_HEADER_SIZE;
+		if (size - offset - RECORD_HEADER_SIZE < length || (op != OP_INSERT && op != OP_DELETE) ||
+			recordChecksum(op, payload, length) != checksum)
+		{
+			break; // a record that was not written completely
+		}
+		if (!applyRecord(durable, op, payload, length))
+		{
+			return false;
+		}
+		offset += RECORD_HEADER_SIZE + length;
+	}
+	*end = offset;
+	return true;
+}
+
+char *joinPath(const char *path, const char *suffix)
+{
+	long unsigned length = strlen(path);
+	char *joined = (char *) malloc(length + strlen(suffix) + 1);
+	if (joined != NULL)
+	{
+		memcpy(joined, path, length);
+		strcpy(joined + length, suffix);
+	}
+	return joined;
+}
+
+void freeDurableRBTree(DurableRBTree *durable)
+{
+	if (durable->logFd >= 0)
+	{
+		close(durable->logFd);
+	}
+	freeRBTree(&durable->tree);
+	free(durable->pending.bytes);
+	free(durable->snapshotPath);
+	free(durable->logPath);
+	free(durable);
+}
+
+DurableRBTree *openDurableRBTree(const char *path, CompareFunc compFunc, FreeFunc freeFunc,
+								 SerializeFunc serialize, DeserializeFunc deserialize)
+{
+	if (path == NULL || compFunc == NULL || freeFunc == NULL || serialize == NULL ||
+		deserialize == NULL)
+	{
+		return NULL; // the recovery makes items that only the tree can free
+	}
+	DurableRBTree *durable = (DurableRBTree *) calloc(1, sizeof(DurableRBTree));
+	if (durable == NULL)
+	{
+		return NULL;
+	}
+	durable->logFd = -1;
+	durable->serialize = serialize;
+	durable->deserialize = deserialize;
+	durable->groupOps = DEFAULT_GROUP_OPS;
+	durable->checkpointBytes = DEFAULT_CHECKPOINT_BYTES;
+	durable->tree = newRBTree(compFunc, freeFunc);
+	durable->snapshotPath = joinPath(path, "");
+	durable->logPath = joinPath(path, LOG_SUFFIX);
+	if (durable->tree == NULL || durable->snapshotPath == NULL || durable->logPath == NULL)
+	{
+		freeDurableRBTree(durable);
+		return NULL;
+	}
+
+	unsigned char *bytes;
+	long unsigned size, end;
+	if (!readWholeFile(durable->snapshotPath, &bytes, &size))
+	{
+		freeDurableRBTree(durable);
+		return NULL;
+	}
+	int loaded = size == 0 || (size >= SNAPSHOT_MAGIC_SIZE &&
+							   memcmp(bytes, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) == 0 &&
+							   replayRecords(durable, bytes + SNAPSHOT_MAGIC_SIZE,
+											 size - SNAPSHOT_MAGIC_SIZE, &end) &&
+							   end == size - SNAPSHOT_MAGIC_SIZE); // a snapshot is never torn
+	free(bytes);
+	if (!loaded || !readWholeFile(durable->logPath, &bytes, &size))
+	{
+		freeDurableRBTree(durable);
+		return NULL;
+	}
+	loaded = replayRecords(durable, bytes, size, &end);
+	free(bytes);
+	durable->logFd = open(durable->logPath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (!loaded || durable->logFd < 0)
+	{
+		freeDurableRBTree(durable);
+		return NULL;
+	}
+	if (end < size && (ftruncate(durable->logFd, end) != 0 || fsync(durable->logFd) != 0))
+	{
+		freeDurableRBTree(durable);
+		return NULL;
+	}
+	durable->logBytes = end;
+	return durable;
+}
+
+void setDurableRBTreeLimits(DurableRBTree *durable, long unsigned groupOps,
+							long unsigned checkpointBytes)
+{
+	if (durable != NULL)
+	{
+		durable->groupOps = (groupOps == 0) ? 1 : groupOps;
+		durable->checkpointBytes = checkpointBytes;
+	}
+}
+
+void recordChange(DurableRBTree *durable)
+{
+	durable->pendingOps++;
+	if (durable->pendingOps >= durable->groupOps)
+	{
+		commitDurableRBTree(durable); // on failure the records stay pending
+	}
+}
+
+int insertToDurableRBTree(DurableRBTree *durable, void *data)
+{
+	if (durable == NULL || data == NULL)
+	{
+		return false;
+	}
+	long unsigned mark = durable->pending.used;
+	if (!appendRecord(&durable->pending, durable->serialize, OP_INSERT, data))
+	{
+		return false;
+	}
+	if (!insertToRBTree(durable->tree, data))
+	{
+		durable->pending.used = mark;
+		return false;
+	}
+	recordChange(durable);
+	return true;
+}
+
+int deleteFromDurableRBTree(DurableRBTree *durable, void *data)
+{
+	if (durable == NULL || data == NULL)
+	{
+		return false;
+	}
+	long unsigned mark = durable->pending.used;
+	if (!appendRecord(&durable->pending, durable->serialize, OP_DELETE, data))
+	{
+		return false;
+	}
+	if (!deleteFromRBTree(durable->tree, data))
+	{
+		durable->pending.used = mark;
+		return false;
+	}
+	recordChange(durable);
+	return true;
+}
+
+int commitDurableRBTree(DurableRBTree *durable)
+{
+	if (durable == NULL)
+	{
+		return false;
+	}
+	if (durable->pending.used > 0)
+	{
+		if (!writeBytes(durable->logFd, durable->pending.bytes, durable->pending.used) ||
+			fsync(durable->logFd) != 0)
+		{
+			// remove a part that was written, so the next commit does not follow a torn record
+			int truncated = ftruncate(durable->logFd, durable->logBytes) == 0;
+			(void) truncated;
+			return false;
+		}
+		durable->logBytes += durable->pending.used;
+		durable->pending.used = 0;
+		durable->pendingOps = 0;
+	}
+	if (durable->checkpointBytes > 0 && durable->logBytes > durable->checkpointBytes)
+	{
+		return checkpointDurableRBTree(durable);
+	}
+	return true;
+}
+
+int writeSnapshotItem(const void *object, void *args)
+{
+	SnapshotWriter *writer = (SnapshotWriter *) args;
+	if (!appendRecord(&writer->buffer, writer->serialize, OP_INSERT, object))
+	{
+		return false;
+	}
+	if (writer->buffer.used >= SNAPSHOT_FLUSH_BYTES)
+	{
+		if (!writeBytes(writer->fd, writer->buffer.bytes, writer->buffer.used))
+		{
+			return false;
+		}
+		writer->buffer.used = 0;
+	}
+	return true;
+}
+
+int syncDirectory(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	char *directory = (slash == NULL) ? joinPath(".", "") : joinPath(path, "");
+	if (directory == NULL)
+	{
+		return false;
+	}
+	if (slash != NULL)
+	{
+		directory[(slash == path) ? 1 : slash - path] = '\0';
+	}
+	int fd = open(directory, O_RDONLY);
+	free(directory);
+	if (fd < 0)
+	{
+		return false;
+	}
+	int synced = fsync(fd) == 0;
+	close(fd);
+	return synced;
+}
+
+int checkpointDurableRBTree(DurableRBTree *durable)
+{
+	if (durable == NULL)
+	{
+		return false;
+	}
+	// the log must have every change of the snapshot: replaying it after a crash that comes
+	// before the log is emptied then ends in the state of the snapshot
+	long unsigned checkpointBytes = durable->checkpointBytes;
+	durable->checkpointBytes = 0;
+	int committed = commitDurableRBTree(durable);
+	durable->checkpointBytes = checkpointBytes;
+	if (!committed)
+	{
+		return false;
+	}
+	char *tempPath = joinPath(durable->snapshotPath, TEMP_SUFFIX);
+	if (tempPath == NULL)
+	{
+		return false;
+	}
+	SnapshotWriter writer = {open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644),
+							 durable->serialize, {NULL, 0, 0}};
+	int written = writer.fd >= 0 &&
+				  writeBytes(writer.fd, (const unsigned char *) SNAPSHOT_MAGIC,
+							 SNAPSHOT_MAGIC_SIZE) &&
+				  forEachRBTree(durable->tree, writeSnapshotItem, &writer) &&
+				  writeBytes(writer.fd, writer.buffer.bytes, writer.buffer.used) &&
+				  fsync(writer.fd) == 0;
+	free(writer.buffer.bytes);
+	if (writer.fd >= 0 && close(writer.fd) != 0)
+	{
+		written = false;
+	}
+	if (!written || rename(tempPath, durable->snapshotPath) != 0)
+	{
+		unlink(tempPath);
+		free(tempPath);
+		return false;
+	}
+	free(tempPath);
+	if (!syncDirectory(durable->snapshotPath) || ftruncate(durable->logFd, 0) != 0 ||
+		fsync(durable->logFd) != 0)
+	{
+		return false;
+	}
+	durable->logBytes = 0;
+	return true;
+}
+
+int closeDurableRBTree(DurableRBTree **durable)
+{
+	if (durable == NULL || *durable == NULL)
+	{
+		return true;
+	}
+	int committed = commitDurableRBTree(*durable);
+	freeDurableRBTree(*durable);
+	*durable = NULL;
+	return committed;
+}
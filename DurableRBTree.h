@@ -0,0 +1,107 @@
+#ifndef RBTREE_DURABLERBTREE_H
+#define RBTREE_DURABLERBTREE_H
+
+#include "RBTree.h"
+
+/**
+ * a buffer of log records.
+ */
+typedef struct RecordBuffer
+{
+	unsigned char *bytes;
+	long unsigned used, capacity;
+} RecordBuffer;
+
+/**
+ * a tree whose changes are written to a log on the disk, so it can be recovered after a crash.
+ * The changes are kept in memory and written together (group commit): every groupOps changes, or
+ * when commitDurableRBTree is called. A checkpoint writes the whole tree to a snapshot file and
+ * empties the log; it is done when the log grows beyond checkpointBytes.
+ */
+typedef struct DurableRBTree
+{
+	RBTree *tree;
+	SerializeFunc serialize;
+	DeserializeFunc deserialize;
+	char *snapshotPath; // the path of the snapshot, the log is at snapshotPath + ".log"
+	char *logPath;
+	int logFd;
+	RecordBuffer pending; // records that are not written to the log yet
+	long unsigned pendingOps;
+	long unsigned logBytes; // the size of the log on the disk
+	long unsigned groupOps; // commit after this many changes
+	long unsigned checkpointBytes; // checkpoint when the log is larger (0 - never)
+} DurableRBTree;
+
+/**
+ * open a durable tree. The tree is recovered from the snapshot at path and from the log at
+ * path + ".log" (the files are created if they do not exist): the snapshot is loaded and the
+ * changes in the log are applied to it. A record that was only partly written when the program
+ * crashed ends the log, and it is removed.
+ * @param path: the path of the snapshot.
+ * @param compFunc: compares the items.
+ * @param freeFunc: frees the items. The tree owns the items that deserialize makes and the items
+ * that are inserted to it, and frees the items that the recovery reads but does not keep, so it
+ * can not be NULL.
+ * @param serialize: writes an item as bytes.
+ * @param deserialize: reads an item.
+ * @return: the tree, NULL on failure (an I/O error, a damaged snapshot, or a NULL argument).
+ */
+DurableRBTree *openDurableRBTree(const char *path, CompareFunc compFunc, FreeFunc freeFunc,
+								 SerializeFunc serialize, DeserializeFunc deserialize);
+
+/**
+ * set when the changes are written to the disk.
+ * @param durable: the tree.
+ * @param groupOps: the number of changes that are written and synced together (at least 1).
+ * @param checkpointBytes: a checkpoint is done when the log is larger, 0 to never do it
+ * automatically.
+ */
+void setDurableRBTreeLimits(DurableRBTree *durable, long unsigned groupOps,
+							long unsigned checkpointBytes);
+
+/**
+ * add an item to the tree, and to the log. The change is durable after the next commit (see
+ * DurableRBTree). If a commit that the change starts fails, the changes stay in memory and the
+ * next commitDurableRBTree writes them (or reports the error).
+ * @param durable: the tree.
+ * @param data: the item.
+ * @return: 0 on failure (the item is already in the tree, or an allocation failed), other on
+ * success.
+ */
+int insertToDurableRBTree(DurableRBTree *durable, void *data);
+
+/**
+ * remove an item from the tree, and write the change to the log. The change is durable after
+ * the next commit, as in insertToDurableRBTree.
+ * @param durable: the tree.
+ * @param data: an item that is equal to the one to remove.
+ * @return: 0 on failure (the item is not in the tree, or an allocation failed), other on success.
+ */
+int deleteFromDurableRBTree(DurableRBTree *durable, void *data);
+
+/**
+ * write the changes that are not written yet to the log, and wait until they are on the disk
+ * (one fsync for all of them).
+ * @param durable: the tree.
+ * @return: 0 on failure, other on success.
+ */
+int commitDurableRBTree(DurableRBTree *durable);
+
+/**
+ * write the whole tree to a new snapshot and empty the log. The old snapshot is replaced only
+ * when the new one is on the disk, so a crash at any point leaves a snapshot and a log that
+ * recover the tree.
+ * @param durable: the tree.
+ * @return: 0 on failure, other on success.
+ */
+int checkpointDurableRBTree(DurableRBTree *durable);
+
+/**
+ * commit the changes, close the files and free the tree.
+ * @param durable: pointer to the tree. It is set to NULL.
+ * @return: 0 if the last commit failed, other on success.
+ */
+int closeDurableRBTree(DurableRBTree **durable);
+
+#endif //RBTREE_DURABLERBTREE_H
@@ -0,0 +1,447 @@
+/**
+* @file DurableTest.c
+* @author Aviel Shtern Aviel.Shtern@mail.huji.ac.il
+* @version 1.0
+* @date 3 jun 2020
+* @brief A test of the recovery of DurableRBTree. A child process inserts and deletes random keys
+* and exits without closing the tree (a crash), and the test reopens the tree and compares it with
+* the changes that were committed. Then it cuts the log in the middle of a record, and damages a
+* record, and checks that the recovery stops at the last whole record and removes the rest of the
+* log. Last, it crashes a tree that made checkpoints, so the recovery starts from a snapshot.
+* usage: durable_test [directory] [seed]
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "DurableRBTree.h"
+
+/**
+ *@def KEYS 2000
+ *@brief The keys are 0..KEYS-1.
+ */
+#define KEYS 2000
+
+/**
+ *@def OPS 6000
+ *@brief The number of operations of each crash.
+ */
+#define OPS 6000
+
+/**
+ *@def GROUP_OPS 16
+ *@brief The changes that are committed together in the first crash.
+ */
+#define GROUP_OPS 16
+
+/**
+ *@def RECORD_BYTES (9 + sizeof(long))
+ *@brief The size of a log record of a long: the header of DurableRBTree.c and the long.
+ */
+#define RECORD_BYTES (9 + sizeof(long))
+
+/**
+ *@def CHECKPOINT_BYTES (97 * RECORD_BYTES)
+ *@brief The log size that starts a checkpoint in the last crash (so the crash leaves a snapshot
+ * and a log that is not empty).
+ */
+#define CHECKPOINT_BYTES (97 * RECORD_BYTES)
+
+/**
+ *@def CUTS 200
+ *@brief The number of times the log is cut or damaged.
+ */
+#define CUTS 200
+
+/**
+ * A change that succeeded: the key, and if it was inserted (else deleted)
+ */
+typedef struct Change
+{
+	long key;
+	int inserted;
+} Change;
+
+/**
+ * The state of checkKey
+ */
+typedef struct KeyCheck
+{
+	const char *present; // the expected keys
+	long last; // the last key (-1 at first)
+	long unsigned errors;
+} KeyCheck;
+
+/**
+ * The files of the tree under test
+ */
+typedef struct TestFiles
+{
+	char snapshot[256];
+	char log[256];
+} TestFiles;
+
+/**
+ * Compares two longs
+ */
+int longCompare(const void *a, const void *b);
+
+/**
+ * SerializeFunc for longs
+ */
+long unsigned serializeLong(const void *data, void *buffer, long unsigned size);
+
+/**
+ * DeserializeFunc for longs
+ */
+void *deserializeLong(const void *buffer, long unsigned size);
+
+/**
+ * Runs random inserts and deletes
+ * @param durable the tree, or NULL to only compute the changes
+ * @param seed the seed of the operations
+ * @param ops the number of operations
+ * @param changes the changes that succeed are added to it (room for ops)
+ * @param count the number of changes in changes, updated
+ * @return false if the tree gave another answer than the changes before
+ */
+int runOps(DurableRBTree *durable, unsigned seed, long ops, Change *changes, long *count);
+
+/**
+ * The keys that are in the tree after some changes
+ * @param changes the changes
+ * @param count the number of changes to apply, from the first
+ * @param present set to true for the keys in the tree (KEYS entries)
+ */
+void stateAfter(const Change *changes, long count, char *present);
+
+/**
+ * forEachFunc that checks a key is expected and comes after the previous one
+ * @param object pointer to a long
+ * @param pCheck pointer to KeyCheck
+ * @return 1
+ */
+int checkKey(const void *object, void *pCheck);
+
+/**
+ * Reopens the tree and compares it with the expected keys
+ * @param files the files
+ * @param present the expected keys
+ * @param what the name of the check, for the message
+ * @return true if they are the same
+ */
+int checkRecovered(const TestFiles *files, const char *present, const char *what);
+
+/**
+ * Crashes a child that changed the tree, as runOps with the seed
+ * @param files the files (removed first)
+ * @param seed the seed of the operations
+ * @param groupOps see setDurableRBTreeLimits
+ * @param checkpointBytes see setDurableRBTreeLimits
+ * @return true if the child ran all the operations and got the right answers
+ */
+int crashChild(const TestFiles *files, unsigned seed, long unsigned groupOps,
+			   long unsigned checkpointBytes);
+
+/**
+ * The size of a file
+ * @param path the path
+ * @return the size, -1 if it does not exist
+ */
+long fileSize(const char *path);
+
+/**
+ * Writes bytes to a file, replacing it
+ * @param path the path
+ * @param bytes the bytes
+ * @param size their number
+ * @return true on success
+ */
+int writeFile(const char *path, const unsigned char *bytes, long unsigned size);
+
+/**
+ * Cuts the log of a crashed tree in random places (and damages a record), and checks every
+ * recovery
+ * @param files the files, with a log of whole records and no snapshot
+ * @param changes the changes in the log
+ * @param count their number
+ * @return true if all the recoveries passed
+ */
+int checkTornLogs(const TestFiles *files, const Change *changes, long count);
+
+int longCompare(const void *a, const void *b)
+{
+	long first = *(const long *) a, second = *(const long *) b;
+	return (first > second) - (first < second);
+}
+
+long unsigned serializeLong(const void *data, void *buffer, long unsigned size)
+{
+	if (size >= sizeof(long))
+	{
+		memcpy(buffer, data, sizeof(long));
+	}
+	return sizeof(long);
+}
+
+void *deserializeLong(const void *buffer, long unsigned size)
+{
+	long *item = (long *) malloc(sizeof(long));
+	if (item == NULL || size != sizeof(long))
+	{
+		free(item);
+		return NULL;
+	}
+	memcpy(item, buffer, sizeof(long));
+	return item;
+}
+
+int runOps(DurableRBTree *durable, unsigned seed, long ops, Change *changes, long *count)
+{
+	char present[KEYS];
+	stateAfter(changes, *count, present);
+	for (long i = 0; i < ops; i++)
+	{
+		seed = seed * 1103515245u + 12345u;
+		long key = (long) (seed >> 8) % KEYS;
+		int insert = (seed >> 4) % 3 != 0; // so the tree grows
+		int expected = insert ? !present[key] : present[key];
+		if (durable != NULL)
+		{
+			int result;
+			if (insert)
+			{
+				long *item = (long *) malloc(sizeof(long));
+				if (item == NULL)
+				{
+					return false;
+				}
+				*item = key;
+				result = insertToDurableRBTree(durable, item);
+				if (!result)
+				{
+					free(item);
+				}
+			}
+			else
+			{
+				result = deleteFromDurableRBTree(durable, &key);
+			}
+			if ((result != 0) != expected)
+			{
+				return false;
+			}
+		}
+		if (expected)
+		{
+			present[key] = (char) insert;
+			changes[*count].key = key;
+			changes[*count].inserted = insert;
+			(*count)++;
+		}
+	}
+	return true;
+}
+
+void stateAfter(const Change *changes, long count, char *present)
+{
+	memset(present, 0, KEYS);
+	for (long i = 0; i < count; i++)
+	{
+		present[changes[i].key] = (char) changes[i].inserted;
+	}
+}
+
+int checkKey(const void *object, void *pCheck)
+{
+	KeyCheck *check = (KeyCheck *) pCheck;
+	long key = *(const long *) object;
+	if (key <= check->last || key >= KEYS || !check->present[key])
+	{
+		check->errors++;
+	}
+	check->last = key;
+	return 1;
+}
+
+int checkRecovered(const TestFiles *files, const char *present, const char *what)
+{
+	DurableRBTree *durable = openDurableRBTree(files->snapshot, longCompare, free, serializeLong,
+											   deserializeLong);
+	if (durable == NULL)
+	{
+		printf("%s: the tree could not be opened\n", what);
+		return false;
+	}
+	long unsigned expected = 0;
+	for (long key = 0; key < KEYS; key++)
+	{
+		expected += present[key] != 0;
+	}
+	KeyCheck check = {present, -1, 0};
+	forEachRBTree(durable->tree, checkKey, &check);
+	long unsigned size = durable->tree->size;
+	int closed = closeDurableRBTree(&durable);
+	if (check.errors != 0 || size != expected || !closed)
+	{
+		printf("%s: %lu items (%lu expected), %lu wrong keys\n", what, size, expected,
+			   check.errors);
+		return false;
+	}
+	return true;
+}
+
+int crashChild(const TestFiles *files, unsigned seed, long unsigned groupOps,
+			   long unsigned checkpointBytes)
+{
+	unlink(files->snapshot);
+	unlink(files->log);
+	fflush(stdout);
+	pid_t child = fork();
+	if (child < 0)
+	{
+		return false;
+	}
+	if (child == 0)
+	{
+		Change *changes = (Change *) malloc(OPS * sizeof(Change));
+		DurableRBTree *durable = openDurableRBTree(files->snapshot, longCompare, free,
+												   serializeLong, deserializeLong);
+		long count = 0;
+		if (changes == NULL || durable == NULL)
+		{
+			_exit(EXIT_FAILURE);
+		}
+		setDurableRBTreeLimits(durable, groupOps, checkpointBytes);
+		int passed = runOps(durable, seed, OPS / 2, changes, &count) &&
+					 (checkpointBytes == 0 || checkpointDurableRBTree(durable)) &&
+					 runOps(durable, seed + 1, OPS / 2, changes, &count);
+		_exit(passed ? EXIT_SUCCESS : EXIT_FAILURE); // the crash: no close, no commit
+	}
+	int status;
+	return waitpid(child, &status, 0) == child && WIFEXITED(status) &&
+		   WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+long fileSize(const char *path)
+{
+	struct stat info;
+	return (stat(path, &info) == 0) ? (long) info.st_size : -1;
+}
+
+int writeFile(const char *path, const unsigned char *bytes, long unsigned size)
+{
+	FILE *file = fopen(path, "wb");
+	if (file == NULL)
+	{
+		return false;
+	}
+	int written = fwrite(bytes, 1, size, file) == size;
+	return (fclose(file) == 0) && written;
+}
+
+int checkTornLogs(const TestFiles *files, const Change *changes, long count)
+{
+	long unsigned size = (long unsigned) count * RECORD_BYTES;
+	unsigned char *log = (unsigned char *) malloc(size);
+	FILE *file = fopen(files->log, "rb");
+	int passed = log != NULL && file != NULL && fread(log, 1, size, file) == size &&
+				 fileSize(files->log) == (long) size;
+	if (file != NULL)
+	{
+		fclose(file);
+	}
+	char present[KEYS];
+	for (int cut = 0; cut < CUTS && passed; cut++)
+	{
+		long records = rand() % (count + 1);
+		long unsigned length = size;
+		long unsigned damage = size; // the byte that is damaged, size for none
+		if (records < count && cut % 2 == 1)
+		{
+			damage = records * RECORD_BYTES + 9 + rand() % sizeof(long); // a byte of the key
+			log[damage] ^= 1;
+		}
+		else if (records < count)
+		{
+			length = records * RECORD_BYTES + 1 + rand() % (RECORD_BYTES - 1);
+		}
+		passed = writeFile(files->log, log, length);
+		stateAfter(changes, records, present);
+		passed = passed &&
+				 checkRecovered(files, present, (damage < size) ? "damaged log" : "cut log");
+		if (passed && fileSize(files->log) != (long) (records * RECORD_BYTES))
+		{
+			printf("the log has %ld bytes after the recovery, %lu expected\n",
+				   fileSize(files->log), records * RECORD_BYTES);
+			passed = false;
+		}
+		if (damage < size)
+		{
+			log[damage] ^= 1;
+		}
+	}
+	free(log);
+	return passed;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *directory = (argc > 1) ? argv[1] : ".";
+	srand((argc > 2) ? (unsigned) strtoul(argv[2], NULL, 10) : 1);
+	TestFiles files;
+	snprintf(files.snapshot, sizeof(files.snapshot), "%s/durable_test.tree", directory);
+	snprintf(files.log, sizeof(files.log), "%s/durable_test.tree.log", directory);
+	Change *changes = (Change *) malloc(OPS * sizeof(Change));
+	if (changes == NULL)
+	{
+		fprintf(stderr, "allocation failed\n");
+		return EXIT_FAILURE;
+	}
+	char present[KEYS];
+	int passed = openDurableRBTree(files.snapshot, longCompare, NULL, serializeLong,
+								   deserializeLong) == NULL; // the tree must free the items
+
+	// a crash loses the changes after the last group commit
+	long count = 0;
+	passed = crashChild(&files, 1, GROUP_OPS, 0) && passed;
+	runOps(NULL, 1, OPS / 2, changes, &count);
+	runOps(NULL, 2, OPS / 2, changes, &count);
+	long committed = count - count % GROUP_OPS;
+	stateAfter(changes, committed, present);
+	int crashed = passed && checkRecovered(&files, present, "crash");
+	printf("crash: %ld of %ld changes committed, %s\n", committed, count, crashed ? "ok" : "FAILED");
+
+	// the log has the committed changes, one record each
+	int torn = crashed && checkTornLogs(&files, changes, committed);
+	printf("cut and damaged logs: %d recoveries, %s\n", CUTS, torn ? "ok" : "FAILED");
+
+	// every change is committed, and the recovery starts from the last checkpoint
+	count = 0;
+	int checkpointed = crashChild(&files, 3, 1, CHECKPOINT_BYTES);
+	runOps(NULL, 3, OPS / 2, changes, &count);
+	runOps(NULL, 4, OPS / 2, changes, &count);
+	stateAfter(changes, count, present);
+	long logSize = fileSize(files.log);
+	checkpointed = checkpointed && fileSize(files.snapshot) > 0 && logSize > 0 &&
+				   logSize <= (long) CHECKPOINT_BYTES &&
+				   checkRecovered(&files, present, "checkpoint");
+	printf("checkpoint: %ld changes, %ld bytes of log left, %s\n", count, logSize,
+		   checkpointed ? "ok" : "FAILED");
+
+	unlink(files.snapshot);
+	unlink(files.log);
+	free(changes);
+	if (!passed || !crashed || !torn || !checkpointed)
+	{
+		return EXIT_FAILURE;
+	}
+	printf("durable test passed\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,322 @@
+/**
+* @file KernelTest.c
+* @author Aviel Shtern Aviel.Shtern@mail.huji.ac.il
+* @version 1.0
+* @date 3 jun 2020
+* @brief Checks that every vector kernel of Structs.c that the cpu supports gives exactly the
+* results of the scalar one, bit for bit, and that the norms and the comparisons of norms are
+* exactly those of the loop that adds the squares one by one (the order of the first version of
+* the library), also when two norms are almost equal. So the norms (and the answers that depend on
+* them) do not change from one machine to another.
+* usage: kernel_test [seed]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "Structs.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(VECTOR_NO_SIMD)
+/**
+ *@def VECTOR_SIMD
+ *@brief Defined when Structs.c has the SIMD kernels (the same condition as there).
+ */
+#define VECTOR_SIMD
+#endif
+
+/**
+ *@def MAX_LEN 300
+ *@brief The longest array of the random checks.
+ */
+#define MAX_LEN 300
+
+/**
+ *@def ROUNDS 20000
+ *@brief The number of random arrays each kernel is checked on.
+ */
+#define ROUNDS 20000
+
+/**
+ *@def TIED_VECTORS 8
+ *@brief The number of vectors with almost equal norms in each round of checkNorms.
+ */
+#define TIED_VECTORS 8
+
+/**
+ *@def LONG_LEN (1 << 20)
+ *@brief The length of one long array, so the partial sums get large.
+ */
+#define LONG_LEN (1 << 20)
+
+// the kernels of Structs.c, see there
+int firstDifferenceScalar(const double *a, const double *b, int len);
+double sumOfSquaresScalar(const double *a, int len);
+double calculateTheNormSquared(const Vector *pVector);
+int compareNorm(const Vector *first, const Vector *second);
+#ifdef VECTOR_SIMD
+int firstDifferenceSse2(const double *a, const double *b, int len);
+int firstDifferenceAvx2(const double *a, const double *b, int len);
+int firstDifferenceAvx512(const double *a, const double *b, int len);
+double sumOfSquaresSse2(const double *a, int len);
+double sumOfSquaresAvx2(const double *a, int len);
+double sumOfSquaresAvx512(const double *a, int len);
+#endif
+
+/**
+ * A SIMD version of the kernels
+ */
+typedef struct Kernels
+{
+	const char *name;
+	int (*firstDifference)(const double *a, const double *b, int len);
+	double (*sumOfSquares)(const double *a, int len);
+} Kernels;
+
+/**
+ * A random double of a random magnitude, so the sums round in many places
+ * @return the number
+ */
+double randomDouble();
+
+/**
+ * Checks one version of the kernels against the scalar one
+ * @param kernels the version
+ * @param a an array of LONG_LEN doubles
+ * @param b another one
+ * @return the number of differences
+ */
+long unsigned checkKernels(const Kernels *kernels, double *a, double *b);
+
+/**
+ * The squared norm as the first version of the library computed it, one square after the other
+ * @param a the coordinates
+ * @param len their number
+ * @return the norm, squared
+ */
+double baselineNormSquared(const double *a, int len);
+
+/**
+ * forEachFunc that keeps the vector with the largest baselineNormSquared (the first of the equal
+ * ones), as getMaxNormVector should
+ * @param pVector pointer to Vector
+ * @param pMax pointer to the pointer to the max so far
+ * @return 1
+ */
+int keepBaselineMax(const void *pVector, void *pMax);
+
+/**
+ * Checks calculateTheNormSquared, compareNorm and getMaxNormVector against baselineNormSquared on
+ * vectors whose norms are almost equal: the same coordinates in other orders, some of them moved
+ * by a few units in the last place
+ * @param a an array of MAX_LEN doubles
+ * @return the number of differences
+ */
+long unsigned checkNorms(double *a);
+
+double randomDouble()
+{
+	double mantissa = (double) rand() / RAND_MAX - 0.5;
+	return ldexp(mantissa, rand() % 80 - 40);
+}
+
+long unsigned checkKernels(const Kernels *kernels, double *a, double *b)
+{
+	long unsigned failures = 0;
+	for (int round = 0; round < ROUNDS; round++)
+	{
+		int len = rand() % (MAX_LEN + 1);
+		for (int i = 0; i < len; i++)
+		{
+			a[i] = randomDouble();
+			b[i] = a[i];
+		}
+		if (len > 0 && rand() % 4 != 0)
+		{
+			int at = rand() % len;
+			// NaNs and a zero of the other sign are not differences
+			switch (rand() % 4)
+			{
+				case 0:
+					a[at] = b[at] = NAN;
+					break;
+				case 1:
+					a[at] = 0.0;
+					b[at] = -0.0;
+					break;
+				default:
+					b[at] = randomDouble();
+					break;
+			}
+		}
+		double expected = sumOfSquaresScalar(a, len);
+		double got = kernels->sumOfSquares(a, len);
+		int expectedIndex = firstDifferenceScalar(a, b, len);
+		int gotIndex = kernels->firstDifference(a, b, len);
+		if (memcmp(&expected, &got, sizeof(double)) != 0 || expectedIndex != gotIndex)
+		{
+			if (failures++ == 0)
+			{
+				printf("%s: length %d, sum %.17g instead of %.17g, index %d instead of %d\n",
+					   kernels->name, len, got, expected, gotIndex, expectedIndex);
+			}
+		}
+	}
+	for (int i = 0; i < LONG_LEN; i++)
+	{
+		a[i] = randomDouble();
+	}
+	double expected = sumOfSquaresScalar(a, LONG_LEN);
+	double got = kernels->sumOfSquares(a, LONG_LEN);
+	if (memcmp(&expected, &got, sizeof(double)) != 0)
+	{
+		printf("%s: long sum %.17g instead of %.17g\n", kernels->name, got, expected);
+		failures++;
+	}
+	return failures;
+}
+
+double baselineNormSquared(const double *a, int len)
+{
+	double normVec = 0;
+	for (int i = 0; i < len; i++)
+	{
+		normVec += a[i] * a[i];
+	}
+	return normVec;
+}
+
+int keepBaselineMax(const void *pVector, void *pMax)
+{
+	const Vector *vector = (const Vector *) pVector;
+	const Vector **max = (const Vector **) pMax;
+	if (*max == NULL || baselineNormSquared(vector->vector, vector->len) >
+						baselineNormSquared((*max)->vector, (*max)->len))
+	{
+		*max = vector;
+	}
+	return 1;
+}
+
+long unsigned checkNorms(double *a)
+{
+	long unsigned failures = 0;
+	for (int round = 0; round < ROUNDS / TIED_VECTORS; round++)
+	{
+		int len = 1 + rand() % MAX_LEN;
+		for (int i = 0; i < len; i++)
+		{
+			a[i] = randomDouble();
+		}
+		RBTree *tree = newRBTree(vectorCompare1By1, freeVector);
+		Vector *vectors[TIED_VECTORS] = {NULL};
+		for (int v = 0; v < TIED_VECTORS && tree != NULL; v++)
+		{
+			for (int i = len - 1; i > 0; i--)
+			{
+				int j = rand() % (i + 1);
+				double swap = a[i];
+				a[i] = a[j];
+				a[j] = swap;
+			}
+			Vector *vector = newVector(len, a);
+			if (vector == NULL)
+			{
+				failures++;
+				break;
+			}
+			if (rand() % 2 == 0)
+			{
+				int at = rand() % len;
+				vector->vector[at] = nextafter(vector->vector[at], (rand() % 2) ? INFINITY : 0.0);
+			}
+			double expected = baselineNormSquared(vector->vector, len);
+			double got = calculateTheNormSquared(vector);
+			if (memcmp(&expected, &got, sizeof(double)) != 0)
+			{
+				if (failures++ == 0)
+				{
+					printf("norm: length %d, %.17g instead of %.17g\n", len, got, expected);
+				}
+			}
+			for (int u = 0; u < v; u++)
+			{
+				if (vectors[u] == NULL)
+				{
+					continue;
+				}
+				double other = baselineNormSquared(vectors[u]->vector, len);
+				int expectedSign = (expected > other) - (expected < other);
+				int gotSign = (compareNorm(vector, vectors[u]) > 0) -
+							  (compareNorm(vector, vectors[u]) < 0);
+				if (expectedSign != gotSign && failures++ == 0)
+				{
+					printf("compareNorm: length %d, %d instead of %d\n", len, gotSign, expectedSign);
+				}
+			}
+			if (insertToRBTree(tree, vector))
+			{
+				vectors[v] = vector;
+			}
+			else
+			{
+				freeVector(vector); // the same coordinates as another vector
+			}
+		}
+		const Vector *expectedMax = NULL;
+		forEachRBTree(tree, keepBaselineMax, &expectedMax);
+		if (getMaxNormVector(tree) != expectedMax && failures++ == 0)
+		{
+			printf("getMaxNormVector: length %d, not the vector of the largest norm\n", len);
+		}
+		freeRBTree(&tree);
+	}
+	return failures;
+}
+
+int main(int argc, char *argv[])
+{
+	srand((argc > 1) ? (unsigned) strtoul(argv[1], NULL, 10) : 1);
+	double *a = (double *) malloc(LONG_LEN * sizeof(double));
+	double *b = (double *) malloc(LONG_LEN * sizeof(double));
+	if (a == NULL || b == NULL)
+	{
+		fprintf(stderr, "allocation failed\n");
+		free(a);
+		free(b);
+		return EXIT_FAILURE;
+	}
+	long unsigned failures = checkNorms(a);
+	printf("norms: %lu differences from the sequential sums\n", failures);
+#ifdef VECTOR_SIMD
+	Kernels versions[] = {{"sse2", firstDifferenceSse2, sumOfSquaresSse2},
+						  {"avx2", firstDifferenceAvx2, sumOfSquaresAvx2},
+						  {"avx512", firstDifferenceAvx512, sumOfSquaresAvx512}};
+	__builtin_cpu_init();
+	for (long unsigned i = 0; i < sizeof(versions) / sizeof(versions[0]); i++)
+	{
+		// __builtin_cpu_supports needs a literal
+		int supported = (i == 0) ? __builtin_cpu_supports("sse2") :
+						(i == 1) ? __builtin_cpu_supports("avx2") :
+						__builtin_cpu_supports("avx512f");
+		if (!supported)
+		{
+			printf("%s: not supported by this cpu, skipped\n", versions[i].name);
+			continue;
+		}
+		long unsigned found = checkKernels(&versions[i], a, b);
+		printf("%s: %lu differences\n", versions[i].name, found);
+		failures += found;
+	}
+#else
+	printf("no SIMD kernels, nothing to compare\n");
+#endif
+	free(a);
+	free(b);
+	if (failures > 0)
+	{
+		return EXIT_FAILURE;
+	}
+	printf("kernel test passed\n");
+	return EXIT_SUCCESS;
+}
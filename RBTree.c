@@ -9,14 +9,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "RBTree.h"
 #include <stdbool.h>
-
-/**
- *@def ONE_NODE_IN_TREE 1
- *@brief Used in case there is only one child in the tree.
- */
-#define ONE_NODE_IN_TREE 1
+#include <pthread.h>
+#include <limits.h>
 
 /**
  *@def ZERO_NODE_IN_TREE 0
@@ -45,6 +42,183 @@
  */
 #define LEFT_RED_RIGHT_BLACK 2
 
+#ifdef RBTREE_STATS
+/**
+ *@def COUNT_ADD(tree, field, amount)
+ *@brief Adds amount to one of the operation counters of the tree.
+ */
+#define COUNT_ADD(tree, field, amount) ((tree)->counters->field += (amount))
+#else
+#define COUNT_ADD(tree, field, amount) ((void) 0)
+#endif
+
+/**
+ *@def COUNT(tree, field)
+ *@brief Increments one of the operation counters of the tree. compiled out without RBTREE_STATS.
+ */
+#define COUNT(tree, field) COUNT_ADD(tree, field, 1)
+
+/**
+ *@def FIRST_CHUNK_NODES 64
+ *@brief The number of nodes in the first chunk of a node pool. every next chunk is twice larger.
+ */
+#define FIRST_CHUNK_NODES 64
+
+/**
+ *@def MAX_CHUNK_NODES (64 * 1024)
+ *@brief The maximal number of nodes in one chunk of a node pool.
+ */
+#define MAX_CHUNK_NODES (64 * 1024)
+
+/**
+ *@def FIRST_GENERATION 1
+ *@brief The generation of the chunks of a new tree. every compaction starts a new generation.
+ */
+#define FIRST_GENERATION 1
+
+/**
+ *@def LOOKUP_GROUP 16
+ *@brief The number of searches RBTreeContainsMany advances together.
+ */
+#define LOOKUP_GROUP 16
+
+#if defined(__GNUC__)
+/**
+ *@def PREFETCH(address)
+ *@brief Asks the cpu to bring address to the cache, without waiting for it.
+ */
+#define PREFETCH(address) __builtin_prefetch(address)
+#else
+#define PREFETCH(address) ((void) 0)
+#endif
+
+/**
+ *@def COMPARE(tree, a, b)
+ *@brief Calls the compare function of the tree, and counts the call.
+ */
+#define COMPARE(tree, a, b) (COUNT(tree, comparisons), (tree)->compFunc((a), (b)))
+
+/**
+ *@def TRACE(tree, op, key, key2, count)
+ *@brief Tells the tracer of the tree about a public call, if the tree is traced.
+ */
+#define TRACE(tree, op, key, key2, count) \
+	((tree)->tracer == NULL ? (void) 0 : \
+	 (tree)->tracer((tree)->traceRecorder, (op), (key), (key2), (count)))
+
+/**
+ *@def MIN_INDEX_SLOTS 64
+ *@brief The smallest number of slots of a hash index. It has at least twice as many slots as
+ * items.
+ */
+#define MIN_INDEX_SLOTS 64
+
+/**
+ *@def BLOOM_BLOCK_WORDS 8
+ *@brief The number of 64 bit words in a block of a Bloom filter (one cache line). All the bits
+ * of an item are in one block.
+ */
+#define BLOOM_BLOCK_WORDS 8
+
+/**
+ *@def BLOOM_BLOCK_BITS 512
+ *@brief The number of bits in a block of a Bloom filter.
+ */
+#define BLOOM_BLOCK_BITS 512
+
+/**
+ *@def BLOOM_BLOCK_ALIGN 64
+ *@brief The alignment of the blocks of a Bloom filter, so a block is in one cache line.
+ */
+#define BLOOM_BLOCK_ALIGN 64
+
+/**
+ *@def BLOOM_HASHES 6
+ *@brief The number of bits of an item in a Bloom filter. 9 bits of the hash choose each one.
+ */
+#define BLOOM_HASHES 6
+
+/**
+ *@def BLOOM_BITS_PER_ITEM 16
+ *@brief The number of bits of a Bloom filter per item it is built for.
+ */
+#define BLOOM_BITS_PER_ITEM 16
+
+/**
+ *@def BLOOM_MIN_ITEMS 1024
+ *@brief The smallest number of items a Bloom filter is built for.
+ */
+#define BLOOM_MIN_ITEMS 1024
+
+/**
+ *@def SORT_RUN_ITEMS 16
+ *@brief loadRBTree sorts runs of at most this many items by insertion, and merges the runs.
+ */
+#define SORT_RUN_ITEMS 16
+
+/**
+ *@def MIN_PARALLEL_LOAD (16 * 1024)
+ *@brief The smallest number of items that loadRBTree splits between two threads.
+ */
+#define MIN_PARALLEL_LOAD (16 * 1024)
+
+/**
+ * A block of nodes of a node pool
+ */
+typedef struct NodeChunk
+{
+	struct NodeChunk *next;
+	long unsigned capacity, used;
+	Node nodes[];
+} NodeChunk;
+
+/**
+ * A slot of a hash index: a node and the mixed hash of its item (node is NULL if it is empty)
+ */
+typedef struct IndexSlot
+{
+	unsigned long long hash;
+	Node *node;
+} IndexSlot;
+
+/**
+ * An open addressing hash table (linear probing) from the items of a tree to their nodes
+ * hashFunc: the hash of the items.
+ * mask: the number of slots minus 1 (a power of 2).
+ * count: the number of used slots.
+ */
+typedef struct HashIndex
+{
+	HashFunc hashFunc;
+	long unsigned mask;
+	long unsigned count;
+	IndexSlot slots[];
+} HashIndex;
+
+/**
+ * A cache line of a Bloom filter
+ */
+typedef struct BloomBlock
+{
+	unsigned long long words[BLOOM_BLOCK_WORDS];
+} BloomBlock;
+
+/**
+ * A blocked Bloom filter of the items of a tree
+ * memory: the allocation, blocks is aligned in it.
+ * blockMask: the number of blocks minus 1 (a power of 2).
+ * capacity: the number of items the filter was built for.
+ * removed: the number of items that were removed from the tree since the filter was built.
+ */
+typedef struct BloomFilter
+{
+	void *memory;
+	BloomBlock *blocks;
+	long unsigned blockMask;
+	long unsigned capacity;
+	long unsigned removed;
+} BloomFilter;
+
 /**
  * Allocates memory to a new tree
  * @return pointer of type RBTree
@@ -52,11 +226,79 @@
 RBTree *treeAlloc();
 
 /**
- * Given information, we will create a new node and format its color to red
+ * Given information, we will create a new node and format its color to red. The node is taken
+ * from the node pool of the tree if it has one.
+ * @param tree the tree
  * @param data the data
  * @return the new node. if allocata not success retuen NULL
  */
-Node *createNode(void *data);
+Node *createNode(RBTree *tree, void *data);
+
+/**
+ * Takes a node from the node pool of the tree: a node that was freed, or the next unused node of
+ * the last chunk (a new chunk is allocated if it is full).
+ * @param tree the tree
+ * @return the node, NULL if the allocation failed
+ */
+Node *takePooledNode(RBTree *tree);
+
+/**
+ * Frees a node that is not in the tree anymore (but not its data)
+ * @param tree the tree
+ * @param node the node
+ */
+void releaseNode(RBTree *tree, Node *node);
+
+/**
+ * Copies a sub tree to consecutive nodes, in the order of the tree
+ * @param node the root of the sub tree to copy (this function recursive)
+ * @param parent the copy of the parent of node
+ * @param nodes the nodes of the copy of the whole tree
+ * @param index the index in nodes of the next node to use
+ * @param size the number of nodes in the whole tree
+ * @param copyFunc copies the data (may be NULL to copy the pointers)
+ * @param failed set to true if copyFunc failed
+ * @return the copy of node
+ */
+Node *cloneNodes(const Node *node, Node *parent, Node *nodes, long unsigned *index,
+				 long unsigned size, CopyFunc copyFunc, int *failed);
+
+/**
+ * Copies all the nodes of a tree that is not empty to one chunk of its clone
+ * @param tree the tree
+ * @param clone the new empty clone
+ * @param copyFunc copies the data (may be NULL to copy the pointers)
+ * @return true on success, false on failure (the copies of the data are freed)
+ */
+int cloneAllNodes(const RBTree *tree, RBTree *clone, CopyFunc copyFunc);
+
+/**
+ * Frees all the chunks of the node pool of the tree, and the chunks of a running compaction
+ * @param tree the tree
+ */
+void freeChunks(RBTree *tree);
+
+/**
+ * Frees a list of chunks
+ * @param chunk the first chunk of the list
+ */
+void freeChunkList(NodeChunk *chunk);
+
+/**
+ * Starts a compaction: the chunks of the tree are retired, a new generation starts and a chunk
+ * for all the nodes is allocated
+ * @param tree the tree
+ * @return true on success, false if the allocation failed
+ */
+int startCompaction(RBTree *tree);
+
+/**
+ * Moves a node of the tree to another place in memory, and fixes all the pointers to it
+ * @param tree the tree
+ * @param from the node
+ * @param to the new place of the node
+ */
+void moveNode(RBTree *tree, Node *from, Node *to);
 
 /**
  * Makes the process of inserting value into a standard binary tree. Comes to where the value
@@ -123,505 +365,2781 @@ Node *getGrandpa(const Node *node);
 Node *findXNormalBST(const RBTree *tree, Node *node, const void *data);
 
 /**
- * Finds the node that contains the minimum data in the tree
- * @param node the current node Who wants to search his sub tree (this function recursive)
- * @return the node that contains the minimum data in the tree
+ * Goes down from a node to the node that contains the data, or to the node that the data should
+ * be a child of.
+ * @param tree the tree
+ * @param node the node to start from (not NULL)
+ * @param res the result of comparing data with the data of node
+ * @param data the data we search
+ * @param lastRes the result of comparing data with the data of the returned node
+ * @return the node that contains data, or the last node on the search path
+ */
+Node *searchDown(const RBTree *tree, Node *node, int res, const void *data, int *lastRes);
+
+/**
+ * Searches data starting from the finger of the tree: goes up until the sub tree must contain
+ * data and then down. The finger is not updated.
+ * @param tree the tree (with a finger)
+ * @param data the data we search
+ * @param lastRes the result of comparing data with the data of the returned node
+ * @return the node that contains data, or the last node on the search path
  */
-Node *findMin(Node *node);
+Node *searchFromFinger(const RBTree *tree, const void *data, int *lastRes);
 
 /**
- * Given a node, we return its successive node in the tree. ("successor")
- * @param n node
- * @return the successor of the node
+ * Finds the node that contains data. in finger search mode the search starts from the finger of
+ * the tree. The tree is not changed, so readers may call it at the same time.
+ * @param tree the tree
+ * @param data The information that the node contains
+ * @param last if not NULL, set to the last node on the search path in finger search mode (the
+ * callers that may change the tree move the finger there)
+ * @return NULL if the data not contain in the tree. else the node who contains tha data.
  */
-Node *getSuccessor(Node *n);
+Node *findNode(const RBTree *tree, const void *data, Node **last);
 
 /**
- * frees all the node's allocates in the tree (frees the allocate for data field)
- * @param node the current node Who wants to free his sub tree (this function recursive)
- * @param freeFunc The function who responsible for free the allocate in a data field
+ * Inserts data as a leaf, starting the search from the finger of the tree.
+ * @param tree the tree (with a finger)
+ * @param data the data we want to insert
+ * @return the new node we create and insert. and NULL if the value already there.
  */
-void freeNodes(Node **node, FreeFunc freeFunc);
+Node *insertFromFinger(RBTree *tree, void *data);
 
 /**
- * Performs the first step of deleting node from a regular binary tree. If there are two
- * children returns his successor. Otherwise, do nothing
- * @param n the node who contains the value we wont to delete
- * @return If there are two children returns his successor. Otherwise, return NULL
+ * Computes the max value of the sub tree of a node from its value and the max values of its
+ * children
+ * @param node the node
  */
-Node *deleteNormalBST(Node *node);
+void updateMaxValue(Node *node);
 
 /**
- * Before the actual deletion. We will replace the parental child we want to erase with his father.
- * @param n the node we want to delete
- * @param child the child of node we want to delete (can be NULL)
+ * Computes the max values from a node up to the root
+ * @param node the lowest node whose sub tree was changed
  */
-void replaceNode(Node *n, Node *child);
+void updateMaxValueUp(Node *node);
 
 /**
- * After the initial process of deletion. We will stay with a node that has at most one child.
- * The function will erase the node and balance the tree
+ * Computes the max values of all the nodes of a sub tree
+ * @param node the root of the sub tree (this function recursive)
+ */
+void updateMaxValues(Node *node);
+
+/**
+ * Finds the first node that is not smaller than an item
  * @param tree the tree
- * @param n the node we want to delete
+ * @param data the item
+ * @return the node, NULL if all the items are smaller
  */
-void deleteOneChild(RBTree *tree, Node **n);
+Node *lowerBound(const RBTree *tree, const void *data);
 
 /**
- * Handles the case ״N is the new root״
+ * Frees a node that was taken out of the tree and its data (with the FreeFunc of the tree)
  * @param tree the tree
- * @param node the child of node we wont to delete (after the "replaceNode")
- * @param parent the parent of node we want to delete. (after the "replaceNode" the parent of node)
+ * @param node the node, its next field is not valid after the call
  */
-void deleteLevel1(RBTree *tree, Node *node, Node *parent);
+void discardNode(RBTree *tree, Node *node);
 
 /**
- * Handles the case ״S is RED" do left rotation and after that right rotation on the parent
- * in any case we move on to deleteLevel3
+ * The number of nodes of the tree: its items and its tombstones
  * @param tree the tree
- * @param node the child of node we wont to delete (after the "replaceNode")
- * @param parent the parent of node we want to delete. (after the "replaceNode" the parent of node)
+ * @return the number of nodes
  */
-void deleteLevel2(RBTree *tree, Node *node, Node *parent);
+long unsigned nodeCount(const RBTree *tree);
 
 /**
- * Handles the case ״P is BLACK S is RED and S's children are BLACK" we replase the color of S
- * and back to deleteLevel1
+ * Marks the node of an item as a tombstone (see setRBTreeLazyDelete), and purges the tombstones if
+ * there are too many
  * @param tree the tree
- * @param node the child of node we wont to delete (after the "replaceNode")
- * @param parent the parent of node we want to delete. (after the "replaceNode" the parent of node)
+ * @param node the node, not a tombstone
  */
-void deleteLevel3(RBTree *tree, Node *node, Node *parent);
+void deleteLazily(RBTree *tree, Node *node);
 
 /**
- * Handles the case ״P is RED S is RED and S's children are BLACK" we replase the color of S and P
+ * Erases the tombstones at the ends of the order, so min and max are items
  * @param tree the tree
- * @param node the child of node we wont to delete (after the "replaceNode")
- * @param parent the parent of node we want to delete. (after the "replaceNode" the parent of node)
  */
-void deleteLevel4(RBTree *tree, Node *node, Node *parent);
+void trimTombstones(RBTree *tree);
 
 /**
- * Handles the case "S is RED and S's left ("the "closer" son) child are RED and S's right BLACK"
+ * Puts an item in the node of an equal tombstone, if there is one
  * @param tree the tree
- * @param node the child of node we wont to delete (after the "replaceNode")
- * @param parent the parent of node we want to delete. (after the "replaceNode" the parent of node)
+ * @param data the item
+ * @return true if the item was put in a tombstone, false if there is no equal tombstone
  */
-void deleteLevel5(RBTree *tree, Node *node, Node *parent);
+int reviveTombstone(RBTree *tree, void *data);
 
 /**
- * After the deleteLevel5 changes, on P and S accordingly
+ * Removes the tombstones and the items that keep rejects, links the remaining nodes, and rebuilds
+ * the tree from them, in O(n)
  * @param tree the tree
- * @param node the child of node we wont to delete (after the "replaceNode")
- * @param parent the parent of node we want to delete. (after the "replaceNode" the parent of node)
+ * @param keep returns 0 for an item to remove, NULL to keep all the items
+ * @param args the second argument of keep
+ * @return the number of removed nodes
  */
-void deleteLevel6(RBTree *tree, Node *node, Node *parent);
+long unsigned filterNodes(RBTree *tree, forEachFunc keep, void *args);
 
 /**
- * Checking the colors of the children. We refer to a BLACK "child" even if it is not a node but a
- * NULL leaf.
- * @param node object with type Node
- * @return 1 if the left child is BLACK and the right child is RED.
- *         2 if the left child is RED and the right child is BLACK.
- *         0 if tho children are BLACK.
+ * Builds the tree again from its nodes, in O(n): the nodes are taken in order through their next
+ * fields, from tree->min, and all of them are used (see nodeCount). The new shape is balanced by
+ * the policy of the tree
+ * @param tree the tree
  */
-int theColorOfchildrenAre(Node *node);
+void rebuildTree(RBTree *tree);
 
 /**
- * chack if node and to of are children BLACK
- * @param node the node we want to chack
- * @return true if the node are BLACK and two of are children BLACK. else return false
+ * Builds a balanced sub tree from consecutive nodes. Its levels are full except the last one,
+ * whose nodes are RED
+ * @param tree the tree
+ * @param next the next node to use, it is advanced past the used nodes
+ * @param n the number of nodes of the sub tree
+ * @param depth the depth of the root of the sub tree
+ * @param fullLevels the number of full levels of the whole tree
+ * @param parent the parent of the sub tree
+ * @return the root of the sub tree
  */
-int nodeAndthoSunsAreBlack(Node* node);
+Node *buildBalanced(RBTree *tree, Node **next, long unsigned n, long unsigned depth,
+					long unsigned fullLevels, Node *parent);
 
-RBTree *treeAlloc()
-{
-	RBTree *tree = (RBTree *) calloc(1, sizeof(RBTree));
-	return tree;
-}
+/**
+ * Allocates an empty Bloom filter
+ * @param capacity the number of items to build it for
+ * @return the filter, NULL if the allocation failed
+ */
+BloomFilter *newBloomFilter(long unsigned capacity);
 
-RBTree *newRBTree(CompareFunc compFunc, FreeFunc freeFunc)
-{
-	RBTree *tree = treeAlloc();
-	tree->compFunc = compFunc;
-	tree->freeFunc = freeFunc;
-	return tree;
-}
+/**
+ * Frees a Bloom filter
+ * @param filter the filter (can be NULL)
+ */
+void freeBloomFilter(BloomFilter *filter);
 
-Node *createNode(void *data)
-{
-	Node *newNode = (Node *) malloc(sizeof(Node));
-	if (newNode == NULL)
-	{
-		return NULL;
-	}
-	newNode->data = data;
-	newNode->parent = NULL;
-	newNode->left = NULL;
-	newNode->right = NULL;
-	newNode->color = RED;
+/**
+ * Mixes the bits of a hash, so all of them depend on all the bits of the hash (splitmix64)
+ * @param hash the hash
+ * @return the mixed hash
+ */
+unsigned long long mixHash(unsigned long long hash);
 
-	return newNode;
-}
+/**
+ * Adds an item to a Bloom filter
+ * @param filter the filter
+ * @param hash the hash of the item
+ */
+void addToBloomFilter(BloomFilter *filter, long unsigned hash);
 
-int insertToRBTree(RBTree *tree, void *data)
-{
-	if (data == NULL)
-	{
-		return false;
-	}
-	Node *n = insertToNormalBst(tree, NULL, &(tree->root), data); // insert normal node, after we
-	// fix from m
-	if (n == NULL)
-	{
-		return false;
-	}
-	tree->size++;
-	fixInsertToRBTree(tree, n);
-	return true;
-}
+/**
+ * Checks if a Bloom filter may have an item
+ * @param filter the filter
+ * @param hash the hash of the item
+ * @return false if the item is surely not in the filter, true otherwise
+ */
+int bloomFilterMayContain(const BloomFilter *filter, long unsigned hash);
 
+/**
+ * Allocates an empty hash index
+ * @param hashFunc the hash of the items
+ * @param slots the number of slots (a power of 2)
+ * @return the index, NULL if the allocation failed
+ */
+HashIndex *newHashIndex(HashFunc hashFunc, long unsigned slots);
 
-Node *insertToNormalBst(RBTree *tree, Node *parent, Node **node, void *data)
-{
-	if (tree == NULL)
-	{
-		return NULL;
-	}
-	if (*node == NULL)
-	{
-		*node = createNode(data);
-		if (*node == NULL)
-		{
-			return NULL;
-		}
-		(*node)->parent = parent;
-		return *node;
-	}
-	int res = tree->compFunc(data, (*node)->data);
-	if (res == 0)
-	{
-		return NULL; // data exit
-	}
-	else if (res > 0)
-	{
-		return insertToNormalBst(tree, *node, &((*node)->right), data);
-	}
-	else // res <0
-	{
-		return insertToNormalBst(tree, *node, &((*node)->left), data);
-	}
-}
+/**
+ * Adds a node to a hash index that has an empty slot
+ * @param index the index
+ * @param hash the mixed hash of the item of the node
+ * @param node the node
+ */
+void putToHashIndex(HashIndex *index, unsigned long long hash, Node *node);
 
+/**
+ * Finds the node of an item in the hash index of the tree
+ * @param tree the tree (with an index)
+ * @param data the item
+ * @return the node, NULL if the item is not in the tree
+ */
+Node *findInHashIndex(const RBTree *tree, const void *data);
 
-void rightRotation(RBTree *tree, Node *y)
-{
-	if (y == NULL || y->left == NULL)
-	{
-		return;
+/**
+ * Finds the slot of a node in the hash index of the tree
+ * @param tree the tree (with an index)
+ * @param node a node of the tree
+ * @return the slot of the node
+ */
+IndexSlot *findIndexSlot(const RBTree *tree, const Node *node);
+
+/**
+ * Moves a hash index to a new table with twice as many slots. The stored hashes are used, so the
+ * nodes are not visited
+ * @param tree the tree (with an index)
+ * @return true on success, false if the allocation failed (the old index is kept)
+ */
+int growHashIndex(RBTree *tree);
+
+/**
+ * Adds a new node of the tree to its hash index, and makes the index larger if it is half full.
+ * If it can not grow, it is turned off
+ * @param tree the tree (with an index)
+ * @param node the new node
+ */
+void addToHashIndex(RBTree *tree, Node *node);
+
+/**
+ * Removes a node from the hash index of the tree (backward shift, so there are no tombstones)
+ * @param tree the tree (with an index)
+ * @param node the node
+ */
+void removeFromHashIndex(RBTree *tree, const Node *node);
+
+/**
+ * Builds the hash index of the tree again, from the nodes of the tree
+ * @param tree the tree
+ * @param hashFunc the hash of the items
+ * @param slots the number of slots (a power of 2, more than twice the size of the tree)
+ * @return true on success, false if the allocation failed (the old index is kept)
+ */
+int rebuildHashIndex(RBTree *tree, HashFunc hashFunc, long unsigned slots);
+
+/**
+ * Checks the Bloom filter of the tree before a search
+ * @param tree the tree
+ * @param data the searched item
+ * @return false if the item is surely not in the tree, true if it may be (or there is no filter)
+ */
+int treeMayContain(const RBTree *tree, const void *data);
+
+/**
+ * Adds a new item of the tree to its Bloom filter. The filter is rebuilt, larger, if the tree
+ * has more items than it was built for
+ * @param tree the tree (with a filter)
+ * @param data the item
+ */
+void addToTreeFilter(RBTree *tree, const void *data);
+
+/**
+ * Counts items that were removed from the tree, and rebuilds its Bloom filter if there are too
+ * many of them. The tree should be valid
+ * @param tree the tree (with a filter)
+ * @param count the number of removed items
+ */
+void countRemovedFromFilter(RBTree *tree, long unsigned count);
+
+/**
+ * Builds a treap from the nodes of the tree, in order, keeping their priorities (the nodes on
+ * the right spine are the stack of the build)
+ * @param tree the tree
+ * @return the root
+ */
+Node *buildTreap(RBTree *tree);
+
+/**
+ * A part of the items that one thread of loadRBTree sorts.
+ * buffer: room for n items, used by the merges.
+ * threads: the number of threads that may sort the part.
+ */
+typedef struct SortTask
+{
+	void **items, **buffer;
+	long unsigned n;
+	CompareFunc compFunc;
+	int threads;
+} SortTask;
+
+/**
+ * A sub tree that one thread of loadRBTree builds.
+ * nodes, items: the nodes and the sorted items of the whole tree, the i-th node gets the i-th item.
+ * count: the number of the items of the whole tree.
+ * first, n: the index of the first item of the sub tree, and its number of items.
+ * root: set to the root of the sub tree.
+ */
+typedef struct BuildTask
+{
+	RBTree *tree;
+	Node *nodes;
+	void **items;
+	long unsigned count, first, n, depth, fullLevels;
+	Node *parent;
+	int threads;
+	Node *root;
+} BuildTask;
+
+/**
+ * The number of full levels of a balanced tree of n nodes (the nodes below them are RED)
+ * @param n the number of nodes
+ * @return the number of levels
+ */
+long unsigned fullLevelsOf(long unsigned n);
+
+/**
+ * Merge sorts items, stably. The second half is sorted by the calling thread and the first half
+ * by a new thread, while there are threads to split between them.
+ * @param items the items
+ * @param buffer room for n items
+ * @param n the number of items
+ * @param compFunc compares the items
+ * @param threads the number of threads that may sort
+ */
+void sortItems(void **items, void **buffer, long unsigned n, CompareFunc compFunc, int threads);
+
+/**
+ * The thread function of sortItems
+ * @param task pointer to SortTask
+ * @return NULL
+ */
+void *sortThread(void *task);
+
+/**
+ * Builds a balanced sub tree from its nodes, like buildBalanced. The right sub tree is built by
+ * the calling thread and the left one by a new thread, while there are threads to split between
+ * them.
+ * @param task the sub tree, its root is set
+ */
+void buildLoadedTree(BuildTask *task);
+
+/**
+ * The thread function of buildLoadedTree
+ * @param task pointer to BuildTask
+ * @return NULL
+ */
+void *buildThread(void *task);
+
+/**
+ * An item and its value, in the heap of findTopKByValueInRBTree
+ */
+typedef struct RankedItem
+{
+	double value;
+	void *data;
+} RankedItem;
+
+/**
+ * A min heap of at most capacity items, that keeps the items with the largest values offered to
+ * it.
+ */
+typedef struct ValueHeap
+{
+	RankedItem *items;
+	long unsigned size, capacity;
+} ValueHeap;
+
+/**
+ * A part of the tree that one thread of findTopKByValueInRBTree searches.
+ * roots: the sub trees of this thread (from roots[0], every step-th root).
+ */
+typedef struct TopKTask
+{
+	Node **roots;
+	long unsigned numRoots, step;
+	ValueHeap heap;
+} TopKTask;
+
+/**
+ * Offers an item to the heap. It is added if the heap is not full, or if it is larger than the
+ * smallest item of the heap (which is then removed).
+ * @param heap the heap
+ * @param value the value of the item
+ * @param data the item
+ */
+void offerToHeap(ValueHeap *heap, double value, void *data);
+
+/**
+ * Replaces the smallest item of a non empty heap with a new item.
+ * @param heap the heap
+ * @param value the value of the new item
+ * @param data the new item
+ */
+void replaceHeapRoot(ValueHeap *heap, double value, void *data);
+
+/**
+ * Offers the items of a sub tree to the heap, skipping the sub trees that can not improve it.
+ * @param node the root of the sub tree (this function recursive)
+ * @param heap the heap
+ */
+void collectTopK(const Node *node, ValueHeap *heap);
+
+/**
+ * The thread function of findTopKByValueInRBTree
+ * @param task pointer to TopKTask
+ * @return NULL
+ */
+void *topKThread(void *task);
+
+/**
+ * Activate a function on each item of a sub tree whose value is larger than bound.
+ * @param node the root of the sub tree (this function recursive)
+ * @return 0 if one of the activations returned 0, other on success.
+ */
+int forEachValueAbove(const Node *node, double bound, forEachFunc func, void *args);
+
+/**
+ * Links a new leaf between its previous and next nodes in the order of the tree (one of them is
+ * its parent), and updates the min and max of the tree.
+ * @param tree the tree
+ * @param n the new leaf (already a child of its parent)
+ */
+void linkNeighbours(RBTree *tree, Node *n);
+
+/**
+ * Removes a node from the order of the tree, and updates the min and max of the tree.
+ * @param tree the tree
+ * @param n the node we are going to free
+ */
+void unlinkNeighbours(RBTree *tree, Node *n);
+
+/**
+ * frees all the node's allocates in the tree (frees the allocate for data field). The nodes are
+ * visited in order through their next field, so the extra space is O(1) whatever the shape of
+ * the tree is.
+ * @param first the first node in the order of the tree
+ * @param freeFunc The function who responsible for free the allocate in a data field (may be NULL)
+ */
+void freeNodes(Node *first, FreeFunc freeFunc);
+
+/**
+ * The thread function of freeRBTreeAsync
+ * @param tree the tree to free
+ * @return NULL
+ */
+void *freeTreeThread(void *tree);
+
+/**
+ * Performs the first step of deleting node from a regular binary tree. If there are two
+ * children returns his successor. Otherwise, do nothing
+ * @param n the node who contains the value we wont to delete
+ * @return If there are two children returns his successor. Otherwise, return NULL
+ */
+Node *deleteNormalBST(RBTree *tree, Node *node);
+
+/**
+ * Before the actual deletion. We will replace the parental child we want to erase with his father.
+ * @param tree the tree (its root is replaced if n is the root)
+ * @param n the node we want to delete
+ * @param child the child of node we want to delete (can be NULL)
+ */
+void replaceNode(RBTree *tree, Node *n, Node *child);
+
+/**
+ * After the initial process of deletion. We will stay with a node that has at most one child.
+ * The function will erase the node and balance the tree
+ * @param tree the tree
+ * @param n the node we want to delete
+ * @param freeData true to free the data of the node with the FreeFunc of the tree
+ */
+void deleteOneChild(RBTree *tree, Node **n, int freeData);
+
+/**
+ * Handles the case ״N is the new root״
+ * @param tree the tree
+ * @param node the child of node we wont to delete (after the "replaceNode")
+ * @param parent the parent of node we want to delete. (after the "replaceNode" the parent of node)
+ */
+void deleteLevel1(RBTree *tree, Node *node, Node *parent);
+
+/**
+ * Handles the case ״S is RED" do left rotation and after that right rotation on the parent
+ * in any case we move on to deleteLevel3
+ * @param tree the tree
+ * @param node the child of node we wont to delete (after the "replaceNode")
+ * @param parent the parent of node we want to delete. (after the "replaceNode" the parent of node)
+ */
+void deleteLevel2(RBTree *tree, Node *node, Node *parent);
+
+/**
+ * Handles the case ״P is BLACK S is RED and S's children are BLACK" we replase the color of S
+ * and back to deleteLevel1
+ * @param tree the tree
+ * @param node the child of node we wont to delete (after the "replaceNode")
+ * @param parent the parent of node we want to delete. (after the "replaceNode" the parent of node)
+ */
+void deleteLevel3(RBTree *tree, Node *node, Node *parent);
+
+/**
+ * Handles the case ״P is RED S is RED and S's children are BLACK" we replase the color of S and P
+ * @param tree the tree
+ * @param node the child of node we wont to delete (after the "replaceNode")
+ * @param parent the parent of node we want to delete. (after the "replaceNode" the parent of node)
+ */
+void deleteLevel4(RBTree *tree, Node *node, Node *parent);
+
+/**
+ * Handles the case "S is RED and S's left ("the "closer" son) child are RED and S's right BLACK"
+ * @param tree the tree
+ * @param node the child of node we wont to delete (after the "replaceNode")
+ * @param parent the parent of node we want to delete. (after the "replaceNode" the parent of node)
+ */
+void deleteLevel5(RBTree *tree, Node *node, Node *parent);
+
+/**
+ * After the deleteLevel5 changes, on P and S accordingly
+ * @param tree the tree
+ * @param node the child of node we wont to delete (after the "replaceNode")
+ * @param parent the parent of node we want to delete. (after the "replaceNode" the parent of node)
+ */
+void deleteLevel6(RBTree *tree, Node *node, Node *parent);
+
+/**
+ * Checking the colors of the children. We refer to a BLACK "child" even if it is not a node but a
+ * NULL leaf.
+ * @param node object with type Node
+ * @return 1 if the left child is BLACK and the right child is RED.
+ *         2 if the left child is RED and the right child is BLACK.
+ *         0 if tho children are BLACK.
+ */
+int theColorOfchildrenAre(Node *node);
+
+/**
+ * chack if node and to of are children BLACK
+ * @param node the node we want to chack
+ * @return true if the node are BLACK and two of are children BLACK. else return false
+ */
+int nodeAndthoSunsAreBlack(Node* node);
+
+/**
+ * Balances the tree after a new node was inserted, by the policy of the tree
+ * @param tree the tree
+ * @param n the new node
+ */
+void fixInsert(RBTree *tree, Node *n);
+
+/**
+ * Balances the tree after a node was erased, by the policy of the tree (not for RB_POLICY)
+ * @param tree the tree
+ * @param child the child that took the place of the erased node (can be NULL)
+ * @param parent the parent of the erased node (can be NULL)
+ */
+void fixDelete(RBTree *tree, Node *child, Node *parent);
+
+/**
+ * The rank of a node in AVL_POLICY and WAVL_POLICY, -1 for NULL (so a leaf has rank 0)
+ * @param node the node (can be NULL)
+ * @return the rank
+ */
+int nodeRank(const Node *node);
+
+/**
+ * Sets the rank of a node in AVL_POLICY to its height, by the ranks of its children
+ * @param node the node
+ */
+void updateHeight(Node *node);
+
+/**
+ * Rotates at a node of an AVL tree if its children differ in height by more than 1
+ * @param tree the tree
+ * @param node the node, its children are balanced and have the right heights
+ * @return the node in the place of node after the rotations
+ */
+Node *rebalanceAvl(RBTree *tree, Node *node);
+
+/**
+ * Fixes the heights and the balance of an AVL tree from a node up, until the height of a sub
+ * tree does not change
+ * @param tree the tree
+ * @param node the lowest node that may be changed
+ */
+void fixAvl(RBTree *tree, Node *node);
+
+/**
+ * Balances a WAVL tree after an insertion: promotes the ancestors while a node and its parent
+ * have the same rank, and ends with at most 2 rotations
+ * @param tree the tree
+ * @param node the new node
+ */
+void fixInsertToWavl(RBTree *tree, Node *node);
+
+/**
+ * Balances a WAVL tree after a deletion: demotes the ancestors while a node is lower than its
+ * parent by 3, and ends with at most 2 rotations
+ * @param tree the tree
+ * @param node the child that took the place of the erased node (can be NULL)
+ * @param parent the parent of the erased node
+ */
+void fixDeleteFromWavl(RBTree *tree, Node *node, Node *parent);
+
+/**
+ * Rotates a new node of a treap up until its parent has a higher priority
+ * @param tree the tree
+ * @param node the new node
+ */
+void fixInsertToTreap(RBTree *tree, Node *node);
+
+/**
+ * The next priority of a treap (xorshift)
+ * @param tree the tree
+ * @return the priority, not negative
+ */
+int randomPriority(RBTree *tree);
+
+/**
+ * One of the searches that RBTreeContainsMany advances together.
+ * node: the next node to visit, NULL if the search is done.
+ * index: the index of the searched key.
+ * dataLoaded: false if only the node was prefetched, true if its data was prefetched too.
+ */
+typedef struct Lookup
+{
+	const Node *node;
+	long unsigned index;
+	int dataLoaded;
+} Lookup;
+
+/**
+ * Starts one of the searches of RBTreeContainsMany. A search that the Bloom filter of the tree
+ * answers starts as ended.
+ * @param tree the tree
+ * @param keys the searched keys
+ * @param lookup the search
+ * @param index the index of the key to search
+ */
+void startLookup(const RBTree *tree, const void *const *keys, Lookup *lookup, long unsigned index);
+
+/**
+ * Moves one search of RBTreeContainsMany one step forward. A step either prefetches the data of
+ * the current node or compares the key with it and prefetches the next node, so the memory
+ * access of every step was requested one round before.
+ * @param tree the tree
+ * @param keys the searched keys
+ * @param lookup the search
+ * @param results the result of the search is written here when it ends
+ * @return true if the search ended, false otherwise
+ */
+int advanceLookup(const RBTree *tree, const void *const *keys, Lookup *lookup, int *results);
+
+/**
+ * Walks over a sub tree and sums the depths of its nodes, and finds the deepest one.
+ * @param node the root of the sub tree (this function recursive)
+ * @param depth the depth of node in the tree
+ * @param stats the height field is updated to the number of nodes on the longest path
+ * @param depthSum the sum of the depths of the nodes is added to it
+ */
+void collectShape(const Node *node, long unsigned depth, RBTreeStats *stats, double *depthSum);
+
+RBTree *treeAlloc()
+{
+	RBTree *tree = (RBTree *) calloc(1, sizeof(RBTree));
+	return tree;
+}
+
+RBTree *newRBTree(CompareFunc compFunc, FreeFunc freeFunc)
+{
+	RBTree *tree = treeAlloc();
+	if (tree == NULL)
+	{
+		return NULL;
+	}
+	tree->compFunc = compFunc;
+	tree->freeFunc = freeFunc;
+	tree->generation = FIRST_GENERATION;
+#ifdef RBTREE_STATS
+	tree->counters = (RBTreeCounters *) calloc(1, sizeof(RBTreeCounters));
+	if (tree->counters == NULL)
+	{
+		free(tree);
+		return NULL;
+	}
+#endif
+	return tree;
+}
+
+RBTree *newRBTreeWithPolicy(CompareFunc compFunc, FreeFunc freeFunc, BalancePolicy policy)
+{
+	RBTree *tree = newRBTree(compFunc, freeFunc);
+	if (tree != NULL)
+	{
+		tree->policy = policy;
+		tree->randomState = (long unsigned) tree | 1; // any seed that is not 0
+	}
+	return tree;
+}
+
+RBTree *newAugmentedRBTree(CompareFunc compFunc, FreeFunc freeFunc, ValueFunc valueFunc)
+{
+	RBTree *tree = newRBTree(compFunc, freeFunc);
+	if (tree != NULL)
+	{
+		tree->valueFunc = valueFunc;
+	}
+	return tree;
+}
+
+Node *createNode(RBTree *tree, void *data)
+{
+	// freed pooled nodes are reused even without a pool (they come from a clone)
+	int pooled = tree->poolNodes || tree->freeNodes != NULL;
+	Node *newNode = pooled ? takePooledNode(tree) : (Node *) malloc(sizeof(Node));
+	if (newNode == NULL)
+	{
+		return NULL;
+	}
+	COUNT(tree, nodeAllocs);
+	newNode->pooled = pooled ? tree->generation : 0;
+	if (!newNode->pooled)
+	{
+		tree->heapNodes++;
+	}
+	newNode->data = data;
+	newNode->parent = NULL;
+	newNode->left = NULL;
+	newNode->right = NULL;
+	newNode->prev = NULL;
+	newNode->next = NULL;
+	newNode->color = RED;
+	newNode->tombstone = false;
+	newNode->rank = (tree->policy == TREAP_POLICY) ? randomPriority(tree) : 0;
+	newNode->value = 0;
+	newNode->maxValue = 0;
+
+	return newNode;
+}
+
+Node *takePooledNode(RBTree *tree)
+{
+	Node *node = tree->freeNodes;
+	if (node != NULL)
+	{
+		tree->freeNodes = node->next;
+		return node;
+	}
+	NodeChunk *chunk = tree->chunks;
+	if (chunk == NULL || chunk->used == chunk->capacity)
+	{
+		long unsigned capacity = (chunk == NULL) ? FIRST_CHUNK_NODES : 2 * chunk->capacity;
+		if (capacity > MAX_CHUNK_NODES)
+		{
+			capacity = MAX_CHUNK_NODES;
+		}
+		chunk = (NodeChunk *) malloc(sizeof(NodeChunk) + capacity * sizeof(Node));
+		if (chunk == NULL)
+		{
+			return NULL;
+		}
+		chunk->capacity = capacity;
+		chunk->used = 0;
+		chunk->next = tree->chunks;
+		tree->chunks = chunk;
+	}
+	return &chunk->nodes[chunk->used++];
+}
+
+void releaseNode(RBTree *tree, Node *node)
+{
+	COUNT(tree, nodeFrees);
+	if (node->pooled == tree->generation)
+	{
+		node->next = tree->freeNodes;
+		tree->freeNodes = node;
+		return;
+	}
+	if (node->pooled) // in a retired chunk, freed when the compaction ends
+	{
+		return;
+	}
+	tree->heapNodes--;
+	free(node);
+}
+
+void freeChunks(RBTree *tree)
+{
+	freeChunkList(tree->chunks);
+	freeChunkList(tree->retiredChunks);
+	tree->chunks = NULL;
+	tree->retiredChunks = NULL;
+	tree->freeNodes = NULL;
+}
+
+void freeChunkList(NodeChunk *chunk)
+{
+	while (chunk != NULL)
+	{
+		NodeChunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+}
+
+int startCompaction(RBTree *tree)
+{
+	NodeChunk *chunk = NULL;
+	if (nodeCount(tree) > ZERO_NODE_IN_TREE)
+	{
+		chunk = (NodeChunk *) malloc(sizeof(NodeChunk) + nodeCount(tree) * sizeof(Node));
+		if (chunk == NULL)
+		{
+			return false;
+		}
+		chunk->capacity = nodeCount(tree);
+		chunk->used = 0;
+		chunk->next = NULL;
+	}
+	// all the pooled nodes are in the retired chunks now, including the free ones
+	tree->retiredChunks = tree->chunks;
+	tree->chunks = chunk;
+	tree->freeNodes = NULL;
+	tree->generation = (tree->generation == UCHAR_MAX) ? FIRST_GENERATION : tree->generation + 1;
+	tree->compactCursor = tree->min;
+	tree->compacting = true;
+	return true;
+}
+
+void moveNode(RBTree *tree, Node *from, Node *to)
+{
+	*to = *from;
+	to->pooled = tree->generation;
+	if (from->parent == NULL)
+	{
+		tree->root = to;
+	}
+	else if (from->parent->left == from)
+	{
+		from->parent->left = to;
+	}
+	else
+	{
+		from->parent->right = to;
+	}
+	if (from->left != NULL)
+	{
+		from->left->parent = to;
+	}
+	if (from->right != NULL)
+	{
+		from->right->parent = to;
+	}
+	if (from->prev == NULL)
+	{
+		tree->min = to;
+	}
+	else
+	{
+		from->prev->next = to;
+	}
+	if (from->next == NULL)
+	{
+		tree->max = to;
+	}
+	else
+	{
+		from->next->prev = to;
+	}
+	if (tree->finger == from)
+	{
+		tree->finger = to;
+	}
+	if (tree->index != NULL)
+	{
+		findIndexSlot(tree, from)->node = to;
+	}
+	if (!from->pooled) // nodes of the retired chunks are freed with them
+	{
+		tree->heapNodes--;
+		free(from);
+	}
+}
+
+int compactRBTree(RBTree *tree, long unsigned budget)
+{
+	if (tree == NULL)
+	{
+		return COMPACTION_FAILED;
+	}
+	if (!tree->compacting && !startCompaction(tree))
+	{
+		return COMPACTION_FAILED;
+	}
+	for (; budget > 0 && tree->compactCursor != NULL; budget--)
+	{
+		Node *node = tree->compactCursor;
+		if (node->pooled != tree->generation) // not inserted after the compaction started
+		{
+			Node *moved = takePooledNode(tree);
+			if (moved == NULL)
+			{
+				return COMPACTION_FAILED;
+			}
+			moveNode(tree, node, moved);
+			node = moved;
+		}
+		tree->compactCursor = node->next;
+	}
+	if (tree->compactCursor != NULL)
+	{
+		return COMPACTION_IN_PROGRESS;
+	}
+	freeChunkList(tree->retiredChunks);
+	tree->retiredChunks = NULL;
+	tree->compacting = false;
+	return COMPACTION_DONE;
+}
+
+void setNodePool(RBTree *tree, int enable)
+{
+	if (tree != NULL)
+	{
+		tree->poolNodes = enable;
+	}
+}
+
+void setRBTreeTracer(RBTree *tree, TraceFunc tracer, void *recorder)
+{
+	if (tree != NULL)
+	{
+		tree->tracer = tracer;
+		tree->traceRecorder = recorder;
+	}
+}
+
+void setRBTreeContext(RBTree *tree, void *context, FreeFunc freeContext)
+{
+	if (tree == NULL)
+	{
+		return;
+	}
+	if (tree->context != NULL && tree->freeContext != NULL)
+	{
+		tree->freeContext(tree->context);
+	}
+	tree->context = context;
+	tree->freeContext = freeContext;
+}
+
+int insertToRBTree(RBTree *tree, void *data)
+{
+	if (tree == NULL || data == NULL)
+	{
+		return false;
+	}
+	TRACE(tree, TRACE_INSERT, data, NULL, 0);
+	Node *n;
+	if (tree->fingerSearch && tree->finger != NULL)
+	{
+		n = insertFromFinger(tree, data);
+	}
+	else
+	{
+		n = insertToNormalBst(tree, NULL, &(tree->root), data); // insert normal node, after we
+		// fix from m
+	}
+	if (n == NULL)
+	{
+		return tree->tombstones > 0 && reviveTombstone(tree, data);
+	}
+	tree->size++;
+	linkNeighbours(tree, n);
+	if (tree->filter != NULL)
+	{
+		addToTreeFilter(tree, data);
+	}
+	if (tree->index != NULL)
+	{
+		addToHashIndex(tree, n);
+	}
+	if (tree->valueFunc != NULL)
+	{
+		n->value = tree->valueFunc(data);
+		n->maxValue = n->value;
+		// the max values only grow, and they do not decrease on the way up
+		for (Node *p = n->parent; p != NULL && p->maxValue < n->value; p = p->parent)
+		{
+			p->maxValue = n->value;
+		}
+	}
+	if (tree->fingerSearch)
+	{
+		tree->finger = n;
+	}
+	fixInsert(tree, n);
+	return true;
+}
+
+
+Node *insertToNormalBst(RBTree *tree, Node *parent, Node **node, void *data)
+{
+	if (tree == NULL)
+	{
+		return NULL;
+	}
+	if (*node == NULL)
+	{
+		*node = createNode(tree, data);
+		if (*node == NULL)
+		{
+			return NULL;
+		}
+		(*node)->parent = parent;
+		return *node;
+	}
+	int res = COMPARE(tree, data, (*node)->data);
+	if (res == 0)
+	{
+		return NULL; // data exit
+	}
+	else if (res > 0)
+	{
+		return insertToNormalBst(tree, *node, &((*node)->right), data);
+	}
+	else // res <0
+	{
+		return insertToNormalBst(tree, *node, &((*node)->left), data);
+	}
+}
+
+
+void rightRotation(RBTree *tree, Node *y)
+{
+	if (y == NULL || y->left == NULL)
+	{
+		return;
+	}
+	COUNT(tree, rotations);
+	Node *x = y->left;
+	Node *t2 = x->right;
+
+	x->parent = y->parent;
+	if (x->parent != NULL)
+	{
+		if (x->parent->left == y)
+		{
+			x->parent->left = x;
+		}
+		else // y was right child
+		{
+			x->parent->right = x;
+		}
+	}
+	else // x is the new root in the tree
+	{
+		tree->root = x;
+	}
+	x->right = y;
+	y->parent = x;
+	y->left = t2;
+	if (t2 != NULL)
+	{
+		t2->parent = y;
+	}
+	if (tree->valueFunc != NULL)
+	{
+		updateMaxValue(y);
+		updateMaxValue(x);
+	}
+
+}
+
+void leftRotation(RBTree *tree, Node *x)
+{
+	if (x == NULL || x->right == NULL)
+	{
+		return;
+	}
+	COUNT(tree, rotations);
+	Node *y = x->right;
+	Node *t2 = y->left;
+
+	y->parent = x->parent;
+	if (y->parent != NULL)
+	{
+		if (y->parent->left == x)
+		{
+			y->parent->left = y;
+		}
+		else // x was right child
+		{
+			y->parent->right = y;
+		}
+	}
+	else // y is the new root in the tree
+	{
+		tree->root = y;
+	}
+	y->left = x;
+	x->parent = y;
+	x->right = t2;
+	if (t2 != NULL)
+	{
+		t2->parent = x;
+	}
+	if (tree->valueFunc != NULL)
+	{
+		updateMaxValue(x);
+		updateMaxValue(y);
+	}
+}
+
+Node *getUncle(const Node *node)
+{
+	if (node == NULL)
+	{
+		return NULL;
+	}
+	return getBrother(node->parent);
+}
+
+Node *getBrother(const Node *node)
+{
+	if (node == NULL || node->parent == NULL)
+	{
+		return NULL;
+	}
+	else if (node->parent->left == node)
+	{
+		return node->parent->right;
+	}
+	else // node is right child
+	{
+		return node->parent->left;
+	}
+}
+
+Node *getGrandpa(const Node *node)
+{
+	if (node == NULL || node->parent == NULL)
+	{
+		return NULL;
+	}
+	return node->parent->parent;
+}
+
+void fixInsertToRBTree(RBTree *tree, Node *n)
+{
+	Node *parent = n->parent;
+	Node *grandpa = getGrandpa(n);
+	Node *uncle = getUncle(n);
+	if (parent == NULL)
+	{
+		COUNT(tree, insertCases[0]);
+		COUNT(tree, recolors);
+		n->color = BLACK;
+		return;
+	}
+	else if (parent->color == BLACK)
+	{
+		COUNT(tree, insertCases[1]);
+		return;
+	}
+	else if (uncle != NULL && uncle->color == RED)
+	{
+		COUNT(tree, insertCases[2]);
+		COUNT_ADD(tree, recolors, 3);
+		parent->color = BLACK;
+		uncle->color = BLACK;
+		grandpa->color = RED;
+		return fixInsertToRBTree(tree, grandpa);
+	}
+	else if (grandpa->right == parent && parent->right == n)
+	{
+		COUNT(tree, insertCases[3]);
+		COUNT_ADD(tree, recolors, 2);
+		leftRotation(tree, grandpa);
+		parent->color = BLACK;
+		grandpa->color = RED;
+		return;
+	}
+	else if (grandpa->left == parent && parent->left == n)
+	{
+		COUNT(tree, insertCases[3]);
+		COUNT_ADD(tree, recolors, 2);
+		rightRotation(tree, grandpa);
+		parent->color = BLACK;
+		grandpa->color = RED;
+		return;
+	}
+	else if (grandpa->right == parent && parent->left == n)
+	{
+		COUNT(tree, insertCases[4]);
+		COUNT_ADD(tree, recolors, 2);
+		rightRotation(tree, parent);
+		leftRotation(tree, grandpa);
+		n->color = BLACK;
+		grandpa->color = RED;
+		return;
+	}
+	else // grandpa->left->right == n
+	{
+		COUNT(tree, insertCases[4]);
+		COUNT_ADD(tree, recolors, 2);
+		leftRotation(tree, parent);
+		rightRotation(tree, grandpa);
+		n->color = BLACK;
+		grandpa->color = RED;
+		return;
+	}
+}
+
+int forEachRBTree(const RBTree *tree, forEachFunc func, void *args)
+{
+	if (tree == NULL)
+	{
+		return false;
+	}
+	TRACE(tree, TRACE_FOR_EACH, NULL, NULL, 0);
+	if (tree->root == NULL)
+	{
+		return true;
+	}
+	for (Node *curNode = tree->min; curNode != NULL; curNode = curNode->next)
+	{
+		if (!curNode->tombstone && func(curNode->data, args) == 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+long unsigned forEachFromRBTree(const RBTree *tree, const void *from, forEachFunc func, void *args,
+								long unsigned limit)
+{
+	if (tree == NULL || from == NULL || func == NULL)
+	{
+		return 0;
+	}
+	TRACE(tree, TRACE_FOR_EACH_FROM, from, NULL, limit);
+	long unsigned visited = 0;
+	for (Node *node = lowerBound(tree, from); node != NULL && visited < limit; node = node->next)
+	{
+		if (node->tombstone)
+		{
+			continue;
+		}
+		if (func(node->data, args) == 0)
+		{
+			break;
+		}
+		visited++;
+	}
+	return visited;
+}
+
+int RBTreeContains(const RBTree *tree, const void *data)
+{
+	if (tree == NULL || data == NULL)
+	{
+		return false;
+	}
+	TRACE(tree, TRACE_CONTAINS, data, NULL, 0);
+	Node *node = findNode(tree, data, NULL);
+	return node != NULL && !node->tombstone;
+}
+
+void *RBTreeFind(const RBTree *tree, const void *data)
+{
+	if (tree == NULL || data == NULL)
+	{
+		return NULL;
+	}
+	TRACE(tree, TRACE_FIND, data, NULL, 0);
+	Node *node = findNode(tree, data, NULL);
+	return (node == NULL || node->tombstone) ? NULL : node->data;
+}
+
+Node *searchDown(const RBTree *tree, Node *node, int res, const void *data, int *lastRes)
+{
+	while (res != 0)
+	{
+		Node *child = (res > 0) ? node->right : node->left;
+		if (child == NULL)
+		{
+			break;
+		}
+		node = child;
+		res = COMPARE(tree, data, node->data);
+	}
+	*lastRes = res;
+	return node;
+}
+
+Node *searchFromFinger(const RBTree *tree, const void *data, int *lastRes)
+{
+	Node *node = tree->finger;
+	int res = COMPARE(tree, data, node->data);
+	// going up from a right child (when data is bigger) or a left child (when data is smaller)
+	// only gets further from data, so we compare only at the turns
+	while (res != 0 && node->parent != NULL)
+	{
+		Node *parent = node->parent;
+		if ((res > 0 && parent->right == node) || (res < 0 && parent->left == node))
+		{
+			node = parent;
+			continue;
+		}
+		int parentRes = COMPARE(tree, data, parent->data);
+		if (parentRes == 0 || (parentRes > 0) != (res > 0))
+		{
+			if (parentRes == 0)
+			{
+				node = parent;
+				res = 0;
+			}
+			break; // data is between node and parent, so it is in the sub tree of node
+		}
+		node = parent;
+		res = parentRes;
+	}
+	return searchDown(tree, node, res, data, lastRes);
+}
+
+Node *findNode(const RBTree *tree, const void *data, Node **last)
+{
+	if (data == NULL)
+	{
+		return NULL; // never passed to the CompareFunc or the HashFunc
+	}
+	if (tree->index != NULL)
+	{
+		return findInHashIndex(tree, data);
+	}
+	if (tree->root == NULL || !treeMayContain(tree, data))
+	{
+		return NULL;
+	}
+	if (!tree->fingerSearch)
+	{
+		return findXNormalBST(tree, tree->root, data);
+	}
+	int res;
+	Node *node = (tree->finger != NULL) ? searchFromFinger(tree, data, &res) :
+				 searchDown(tree, tree->root, COMPARE(tree, data, tree->root->data), data, &res);
+	if (last != NULL)
+	{
+		*last = node;
+	}
+	return (res == 0) ? node : NULL;
+}
+
+Node *insertFromFinger(RBTree *tree, void *data)
+{
+	int res;
+	Node *parent = searchFromFinger(tree, data, &res);
+	if (res == 0)
+	{
+		tree->finger = parent;
+		return NULL; // data exit
+	}
+	Node *node = createNode(tree, data);
+	if (node == NULL)
+	{
+		return NULL;
+	}
+	node->parent = parent;
+	if (res > 0)
+	{
+		parent->right = node;
+	}
+	else
+	{
+		parent->left = node;
+	}
+	return node;
+}
+
+void setFingerSearch(RBTree *tree, int enable)
+{
+	if (tree == NULL)
+	{
+		return;
+	}
+	tree->fingerSearch = enable;
+	tree->finger = NULL;
+}
+
+int advanceLookup(const RBTree *tree, const void *const *keys, Lookup *lookup, int *results)
+{
+	if (lookup->node == NULL)
+	{
+		results[lookup->index] = false;
+		return true;
+	}
+	if (!lookup->dataLoaded)
+	{
+		PREFETCH(lookup->node->data);
+		lookup->dataLoaded = true;
+		return false;
+	}
+	int res = COMPARE(tree, keys[lookup->index], lookup->node->data);
+	if (res == 0)
+	{
+		results[lookup->index] = !lookup->node->tombstone;
+		return true;
+	}
+	lookup->node = (res > 0) ? lookup->node->right : lookup->node->left;
+	lookup->dataLoaded = false;
+	PREFETCH(lookup->node);
+	return false;
+}
+
+void startLookup(const RBTree *tree, const void *const *keys, Lookup *lookup, long unsigned index)
+{
+	const void *key = keys[index];
+	lookup->node = (key == NULL || !treeMayContain(tree, key)) ? NULL : tree->root;
+	lookup->index = index;
+	lookup->dataLoaded = false;
+	PREFETCH(key);
+}
+
+int RBTreeContainsMany(const RBTree *tree, const void *const *keys, long unsigned n, int *results)
+{
+	if (tree == NULL || keys == NULL || results == NULL)
+	{
+		return false;
+	}
+	for (long unsigned i = 0; i < n && tree->tracer != NULL; i++)
+	{
+		if (keys[i] != NULL)
+		{
+			TRACE(tree, TRACE_CONTAINS, keys[i], NULL, 0);
+		}
+	}
+	if (tree->index != NULL)
+	{
+		for (long unsigned i = 0; i < n; i++)
+		{
+			Node *node = (keys[i] == NULL) ? NULL : findInHashIndex(tree, keys[i]);
+			results[i] = node != NULL && !node->tombstone;
+		}
+		return true;
+	}
+	Lookup lookups[LOOKUP_GROUP];
+	long unsigned next = 0;
+	int active = 0;
+	// fill the group, then every search that ends is replaced by the next key
+	while (active < LOOKUP_GROUP && next < n)
+	{
+		startLookup(tree, keys, &lookups[active++], next++);
+	}
+	while (active > 0)
+	{
+		for (int i = 0; i < active; i++)
+		{
+			if (!advanceLookup(tree, keys, &lookups[i], results))
+			{
+				continue;
+			}
+			if (next < n)
+			{
+				startLookup(tree, keys, &lookups[i], next++);
+			}
+			else
+			{
+				lookups[i--] = lookups[--active];
+			}
+		}
+	}
+	return true;
+}
+
+Node *findXNormalBST(const RBTree *tree, Node *node, const void *data)
+{
+	if (node == NULL || data == NULL)
+	{
+		return NULL;
+	}
+	int res = COMPARE(tree, data, node->data);
+	if (res == 0)
+	{
+		return node;
+	}
+	else if (res > 0)
+	{
+		return findXNormalBST(tree, node->right, data);
+	}
+	else // res <0
+	{
+		return findXNormalBST(tree, node->left, data);
+	}
+}
+
+void linkNeighbours(RBTree *tree, Node *n)
+{
+	Node *parent = n->parent;
+	if (parent == NULL)
+	{
+		n->prev = NULL;
+		n->next = NULL;
+	}
+	else if (parent->left == n)
+	{
+		n->prev = parent->prev;
+		n->next = parent;
+	}
+	else // n is right child
+	{
+		n->prev = parent;
+		n->next = parent->next;
+	}
+	if (n->prev != NULL)
+	{
+		n->prev->next = n;
+	}
+	else
+	{
+		tree->min = n;
 	}
-	Node *x = y->left;
-	Node *t2 = x->right;
+	if (n->next != NULL)
+	{
+		n->next->prev = n;
+	}
+	else
+	{
+		tree->max = n;
+	}
+}
 
-	x->parent = y->parent;
-	if (x->parent != NULL)
+void unlinkNeighbours(RBTree *tree, Node *n)
+{
+	if (n->prev != NULL)
+	{
+		n->prev->next = n->next;
+	}
+	else
+	{
+		tree->min = n->next;
+	}
+	if (n->next != NULL)
+	{
+		n->next->prev = n->prev;
+	}
+	else
+	{
+		tree->max = n->prev;
+	}
+}
+
+int deleteFromRBTree(RBTree *tree, void *data)
+{
+	if (tree == NULL || data == NULL)
+	{
+		return false;
+	}
+	TRACE(tree, TRACE_DELETE, data, NULL, 0);
+	Node *initNode = findNode(tree, data, &tree->finger);
+	if (initNode == NULL || initNode->tombstone) // the value not in tree!!
+	{
+		return false;
+	}
+	if (tree->purgeThreshold > 0)
+	{
+		deleteLazily(tree, initNode);
+		return true;
+	}
+	Node *node = deleteNormalBST(tree, initNode); // from now. to node have 1 chiled in worst case
+	deleteOneChild(tree, &node, true);
+
+	return true;
+}
+
+void updateMaxValue(Node *node)
+{
+	node->maxValue = node->value;
+	if (node->left != NULL && node->left->maxValue > node->maxValue)
+	{
+		node->maxValue = node->left->maxValue;
+	}
+	if (node->right != NULL && node->right->maxValue > node->maxValue)
+	{
+		node->maxValue = node->right->maxValue;
+	}
+}
+
+void updateMaxValueUp(Node *node)
+{
+	for (; node != NULL; node = node->parent)
+	{
+		updateMaxValue(node);
+	}
+}
+
+void updateMaxValues(Node *node)
+{
+	if (node != NULL)
+	{
+		updateMaxValues(node->left);
+		updateMaxValues(node->right);
+		updateMaxValue(node);
+	}
+}
+
+Node *lowerBound(const RBTree *tree, const void *data)
+{
+	Node *node = tree->root, *bound = NULL;
+	while (node != NULL)
+	{
+		int res = COMPARE(tree, data, node->data);
+		if (res == 0)
+		{
+			return node;
+		}
+		if (res < 0)
+		{
+			bound = node;
+			node = node->left;
+		}
+		else
+		{
+			node = node->right;
+		}
+	}
+	return bound;
+}
+
+void discardNode(RBTree *tree, Node *node)
+{
+	if (tree->index != NULL)
+	{
+		removeFromHashIndex(tree, node);
+	}
+	if (tree->freeFunc != NULL)
+	{
+		tree->freeFunc(node->data);
+	}
+	if (tree->finger == node)
+	{
+		tree->finger = NULL;
+	}
+	releaseNode(tree, node);
+}
+
+long unsigned nodeCount(const RBTree *tree)
+{
+	return tree->size + tree->tombstones;
+}
+
+void deleteLazily(RBTree *tree, Node *node)
+{
+	node->tombstone = true;
+	tree->size--;
+	tree->tombstones++;
+	trimTombstones(tree);
+	if (tree->tombstones > tree->purgeThreshold * nodeCount(tree))
+	{
+		purgeRBTree(tree);
+	}
+}
+
+void trimTombstones(RBTree *tree)
+{
+	// the ends have at most one child, so they are erased like popMinFromRBTree does
+	while (tree->min != NULL && tree->min->tombstone)
+	{
+		Node *node = tree->min;
+		deleteOneChild(tree, &node, true);
+	}
+	while (tree->max != NULL && tree->max->tombstone)
+	{
+		Node *node = tree->max;
+		deleteOneChild(tree, &node, true);
+	}
+}
+
+int reviveTombstone(RBTree *tree, void *data)
+{
+	Node *node = findNode(tree, data, &tree->finger);
+	if (node == NULL || !node->tombstone)
+	{
+		return false;
+	}
+	if (tree->freeFunc != NULL)
+	{
+		tree->freeFunc(node->data);
+	}
+	node->data = data; // an equal item, so the index slot and the filter stay right
+	node->tombstone = false;
+	tree->tombstones--;
+	tree->size++;
+	return true;
+}
+
+void rebuildTree(RBTree *tree)
+{
+	if (tree->policy == TREAP_POLICY)
+	{
+		tree->root = buildTreap(tree);
+		if (tree->valueFunc != NULL)
+		{
+			updateMaxValues(tree->root);
+		}
+		return;
+	}
+	long unsigned nodes = nodeCount(tree);
+	Node *next = tree->min;
+	tree->root = buildBalanced(tree, &next, nodes, 0, fullLevelsOf(nodes), NULL);
+}
+
+long unsigned fullLevelsOf(long unsigned n)
+{
+	long unsigned fullLevels = 0;
+	while ((2UL << fullLevels) - 1 <= n)
+	{
+		fullLevels++;
+	}
+	return fullLevels;
+}
+
+Node *buildBalanced(RBTree *tree, Node **next, long unsigned n, long unsigned depth,
+					long unsigned fullLevels, Node *parent)
+{
+	if (n == 0)
+	{
+		return NULL;
+	}
+	long unsigned leftSize = (n - 1) / 2;
+	Node *left = buildBalanced(tree, next, leftSize, depth + 1, fullLevels, NULL);
+	Node *node = *next;
+	*next = node->next;
+	node->parent = parent;
+	node->left = left;
+	if (left != NULL)
+	{
+		left->parent = node;
+	}
+	node->right = buildBalanced(tree, next, n - leftSize - 1, depth + 1, fullLevels, node);
+	node->color = (depth >= fullLevels) ? RED : BLACK;
+	if (tree->policy != RB_POLICY)
+	{
+		updateHeight(node); // the heights differ by at most 1, so it is a valid WAVL rank too
+	}
+	if (tree->valueFunc != NULL)
+	{
+		updateMaxValue(node);
+	}
+	return node;
+}
+
+Node *buildTreap(RBTree *tree)
+{
+	Node *root = NULL, *last = NULL;
+	for (Node *node = tree->min; node != NULL; node = node->next)
+	{
+		// the nodes of the right spine with lower priorities become the left sub tree of node
+		Node *child = NULL, *top = last;
+		while (top != NULL && top->rank < node->rank)
+		{
+			child = top;
+			top = top->parent;
+		}
+		node->left = child;
+		if (child != NULL)
+		{
+			child->parent = node;
+		}
+		node->right = NULL;
+		node->parent = top;
+		if (top == NULL)
+		{
+			root = node;
+		}
+		else
+		{
+			top->right = node;
+		}
+		last = node;
+	}
+	return root;
+}
+
+int loadRBTree(RBTree *tree, void **items, long unsigned n, int threads)
+{
+	if (tree == NULL || items == NULL || nodeCount(tree) > ZERO_NODE_IN_TREE)
+	{
+		return false;
+	}
+	for (long unsigned i = 0; i < n; i++)
+	{
+		if (items[i] == NULL)
+		{
+			return false;
+		}
+	}
+	if (n == 0)
+	{
+		return true;
+	}
+	void **buffer = (void **) malloc(n * sizeof(void *));
+	NodeChunk *chunk = (NodeChunk *) malloc(sizeof(NodeChunk) + n * sizeof(Node));
+	if (buffer == NULL || chunk == NULL)
+	{
+		free(buffer);
+		free(chunk);
+		return false;
+	}
+	for (long unsigned i = 0; i < n; i++)
+	{
+		TRACE(tree, TRACE_INSERT, items[i], NULL, 0);
+	}
+	sortItems(items, buffer, n, tree->compFunc, (threads < 1) ? 1 : threads);
+	// the sort is stable, so the first of equal items is the one an insert would keep
+	long unsigned unique = 1, duplicates = 0;
+	for (long unsigned i = 1; i < n; i++)
+	{
+		if (COMPARE(tree, items[unique - 1], items[i]) != 0)
+		{
+			items[unique++] = items[i];
+		}
+		else
+		{
+			buffer[duplicates++] = items[i];
+		}
+	}
+	memcpy(items + unique, buffer, duplicates * sizeof(void *)); // left to the caller
+	free(buffer);
+
+	chunk->capacity = n; // the nodes that the duplicates did not use are left to the pool
+	chunk->used = unique;
+	chunk->next = tree->chunks;
+	tree->chunks = chunk;
+	BuildTask task = {tree, chunk->nodes, items, unique, 0, unique, 0, fullLevelsOf(unique), NULL,
+					  (threads < 1) ? 1 : threads, NULL};
+	buildLoadedTree(&task);
+	tree->root = task.root;
+	tree->min = &chunk->nodes[0];
+	tree->max = &chunk->nodes[unique - 1];
+	tree->size = unique;
+	COUNT_ADD(tree, nodeAllocs, unique);
+	if (tree->policy == TREAP_POLICY)
+	{
+		for (long unsigned i = 0; i < unique; i++)
+		{
+			chunk->nodes[i].rank = randomPriority(tree);
+		}
+		rebuildTree(tree);
+	}
+	if (tree->filter != NULL)
+	{
+		setRBTreeFilter(tree, tree->hashFunc);
+	}
+	if (tree->index != NULL)
+	{
+		setRBTreeHashIndex(tree, tree->index->hashFunc);
+	}
+	return true;
+}
+
+void sortItems(void **items, void **buffer, long unsigned n, CompareFunc compFunc, int threads)
+{
+	if (n <= SORT_RUN_ITEMS)
+	{
+		for (long unsigned i = 1; i < n; i++)
+		{
+			void *item = items[i];
+			long unsigned j = i;
+			for (; j > 0 && compFunc(items[j - 1], item) > 0; j--)
+			{
+				items[j] = items[j - 1];
+			}
+			items[j] = item;
+		}
+		return;
+	}
+	long unsigned half = n / 2;
+	SortTask first = {items, buffer, half, compFunc, threads / 2};
+	pthread_t id;
+	int forked = first.threads > 0 && n >= MIN_PARALLEL_LOAD &&
+				 pthread_create(&id, NULL, sortThread, &first) == 0;
+	sortItems(items + half, buffer + half, n - half, compFunc, threads - first.threads);
+	if (forked)
+	{
+		pthread_join(id, NULL);
+	}
+	else
+	{
+		sortItems(items, buffer, half, compFunc, first.threads);
+	}
+	if (compFunc(items[half - 1], items[half]) <= 0)
+	{
+		return; // the halves are in order already, so a sorted input is sorted in O(n)
+	}
+	// only the first half is moved aside, the merge never passes the next item of the second half
+	memcpy(buffer, items, half * sizeof(void *));
+	long unsigned a = 0, b = half, out = 0;
+	while (a < half && b < n)
+	{
+		items[out++] = (compFunc(items[b], buffer[a]) < 0) ? items[b++] : buffer[a++];
+	}
+	while (a < half)
+	{
+		items[out++] = buffer[a++];
+	}
+}
+
+void *sortThread(void *task)
+{
+	SortTask *sort = (SortTask *) task;
+	sortItems(sort->items, sort->buffer, sort->n, sort->compFunc, sort->threads);
+	return NULL;
+}
+
+void buildLoadedTree(BuildTask *task)
+{
+	if (task->n == 0)
+	{
+		task->root = NULL;
+		return;
+	}
+	long unsigned leftSize = (task->n - 1) / 2, i = task->first + leftSize;
+	Node *node = &task->nodes[i];
+	BuildTask left = *task, right = *task;
+	left.n = leftSize;
+	left.threads = task->threads / 2;
+	right.first = i + 1;
+	right.n = task->n - leftSize - 1;
+	right.threads = task->threads - left.threads;
+	left.depth = right.depth = task->depth + 1;
+	left.parent = right.parent = node;
+	pthread_t id;
+	int forked = left.threads > 0 && task->n >= MIN_PARALLEL_LOAD &&
+				 pthread_create(&id, NULL, buildThread, &left) == 0;
+
+	RBTree *tree = task->tree;
+	node->data = task->items[i];
+	node->parent = task->parent;
+	node->prev = (i > 0) ? node - 1 : NULL;
+	node->next = (i + 1 < task->count) ? node + 1 : NULL;
+	node->pooled = tree->generation;
+	node->tombstone = false;
+	node->rank = 0;
+	node->value = (tree->valueFunc != NULL) ? tree->valueFunc(node->data) : 0;
+	node->maxValue = 0;
+	buildLoadedTree(&right);
+	if (forked)
+	{
+		pthread_join(id, NULL);
+	}
+	else
+	{
+		buildLoadedTree(&left);
+	}
+	node->left = left.root;
+	node->right = right.root;
+	node->color = (task->depth >= task->fullLevels) ? RED : BLACK;
+	if (tree->policy != RB_POLICY)
+	{
+		updateHeight(node);
+	}
+	if (tree->valueFunc != NULL)
+	{
+		updateMaxValue(node);
+	}
+	task->root = node;
+}
+
+void *buildThread(void *task)
+{
+	buildLoadedTree((BuildTask *) task);
+	return NULL;
+}
+
+long unsigned deleteRangeFromRBTree(RBTree *tree, const void *lo, const void *hi)
+{
+	if (tree == NULL || lo == NULL || hi == NULL)
+	{
+		return 0;
+	}
+	TRACE(tree, TRACE_DELETE_RANGE, lo, hi, 0);
+	if (COMPARE(tree, lo, hi) > 0)
+	{
+		return 0;
+	}
+	Node *first = lowerBound(tree, lo);
+	long unsigned removed = 0, tombstones = 0;
+	Node *last = NULL;
+	for (Node *node = first; node != NULL && COMPARE(tree, node->data, hi) <= 0;
+		 node = node->next)
+	{
+		last = node;
+		removed++;
+		tombstones += node->tombstone;
+	}
+	// one by one, each item costs O(1) amortized. A rebuild visits the remaining items too, so it
+	// is better only when most of the tree is removed
+	if (removed <= nodeCount(tree) - removed)
+	{
+		Node *node = first;
+		for (long unsigned i = 0; i < removed; i++)
+		{
+			Node *erased = deleteNormalBST(tree, node); // the next item moves into node, if it is erased
+			Node *next = (erased == node) ? node->next : node;
+			deleteOneChild(tree, &erased, true);
+			node = next;
+		}
+		trimTombstones(tree);
+		return removed - tombstones;
+	}
+
+	Node *before = first->prev, *after = last->next;
+	if (before != NULL)
+	{
+		before->next = after;
+	}
+	else
+	{
+		tree->min = after;
+	}
+	if (after != NULL)
+	{
+		after->prev = before;
+	}
+	else
+	{
+		tree->max = before;
+	}
+	Node *node = first;
+	for (long unsigned i = 0; i < removed; i++)
+	{
+		Node *next = node->next;
+		if (tree->compactCursor == node)
+		{
+			tree->compactCursor = after;
+		}
+		discardNode(tree, node);
+		node = next;
+	}
+	tree->size -= removed - tombstones;
+	tree->tombstones -= tombstones;
+	rebuildTree(tree);
+	if (tree->filter != NULL)
+	{
+		countRemovedFromFilter(tree, removed);
+	}
+	trimTombstones(tree);
+	return removed - tombstones;
+}
+
+long unsigned filterRBTree(RBTree *tree, forEachFunc keep, void *args)
+{
+	if (tree == NULL || keep == NULL)
+	{
+		return 0;
+	}
+	long unsigned items = tree->size;
+	filterNodes(tree, keep, args);
+	return items - tree->size;
+}
+
+long unsigned purgeRBTree(RBTree *tree)
+{
+	if (tree == NULL || tree->tombstones == 0)
+	{
+		return 0;
+	}
+	return filterNodes(tree, NULL, NULL);
+}
+
+int setRBTreeLazyDelete(RBTree *tree, double threshold)
+{
+	if (tree == NULL || tree->valueFunc != NULL || !(threshold >= 0 && threshold <= 1))
+	{
+		return false;
+	}
+	if (threshold == 0)
 	{
-		if (x->parent->left == y)
+		purgeRBTree(tree);
+	}
+	tree->purgeThreshold = threshold;
+	return true;
+}
+
+long unsigned filterNodes(RBTree *tree, forEachFunc keep, void *args)
+{
+	long unsigned removed = 0;
+	Node *lastKept = NULL;
+	int moveCursor = false;
+	Node *node = tree->min;
+	while (node != NULL)
+	{
+		Node *next = node->next;
+		if (!node->tombstone && (keep == NULL || keep(node->data, args)))
 		{
-			x->parent->left = x;
+			node->prev = lastKept;
+			if (lastKept != NULL)
+			{
+				lastKept->next = node;
+			}
+			else
+			{
+				tree->min = node;
+			}
+			lastKept = node;
+			if (moveCursor)
+			{
+				tree->compactCursor = node;
+				moveCursor = false;
+			}
 		}
-		else // y was right child
+		else
 		{
-			x->parent->right = x;
+			if (tree->compactCursor == node)
+			{
+				tree->compactCursor = NULL; // the compaction goes on from the next kept node
+				moveCursor = true;
+			}
+			if (node->tombstone)
+			{
+				tree->tombstones--;
+			}
+			else
+			{
+				tree->size--;
+			}
+			discardNode(tree, node);
+			removed++;
 		}
+		node = next;
 	}
-	else // x is the new root in the tree
+	if (removed == 0)
 	{
-		tree->root = x;
+		return 0;
 	}
-	x->right = y;
-	y->parent = x;
-	y->left = t2;
-	if (t2 != NULL)
+	if (lastKept != NULL)
 	{
-		t2->parent = y;
+		lastKept->next = NULL;
+	}
+	else
+	{
+		tree->min = NULL;
+	}
+	tree->max = lastKept;
+	rebuildTree(tree);
+	if (tree->filter != NULL)
+	{
+		countRemovedFromFilter(tree, removed);
+	}
+	return removed;
+}
+
+BloomFilter *newBloomFilter(long unsigned capacity)
+{
+	if (capacity < BLOOM_MIN_ITEMS)
+	{
+		capacity = BLOOM_MIN_ITEMS;
+	}
+	long unsigned blocks = 1;
+	while (blocks * BLOOM_BLOCK_BITS < capacity * BLOOM_BITS_PER_ITEM)
+	{
+		blocks *= 2;
+	}
+	BloomFilter *filter = (BloomFilter *) malloc(sizeof(BloomFilter));
+	if (filter == NULL)
+	{
+		return NULL;
+	}
+	filter->memory = calloc(1, blocks * sizeof(BloomBlock) + BLOOM_BLOCK_ALIGN);
+	if (filter->memory == NULL)
+	{
+		free(filter);
+		return NULL;
+	}
+	unsigned long address = (unsigned long) filter->memory;
+	filter->blocks = (BloomBlock *) ((address + BLOOM_BLOCK_ALIGN - 1) &
+									 ~(unsigned long) (BLOOM_BLOCK_ALIGN - 1));
+	filter->blockMask = blocks - 1;
+	filter->capacity = capacity;
+	filter->removed = 0;
+	return filter;
+}
+
+void freeBloomFilter(BloomFilter *filter)
+{
+	if (filter != NULL)
+	{
+		free(filter->memory);
+		free(filter);
 	}
+}
 
+unsigned long long mixHash(unsigned long long hash)
+{
+	hash += 0x9E3779B97F4A7C15ULL;
+	hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+	return hash ^ (hash >> 31);
 }
 
-void leftRotation(RBTree *tree, Node *x)
+void addToBloomFilter(BloomFilter *filter, long unsigned hash)
 {
-	if (x == NULL || x->right == NULL)
+	unsigned long long bits = mixHash(hash);
+	BloomBlock *block = &filter->blocks[bits & filter->blockMask];
+	bits = mixHash(bits); // 9 bits for each bit of the item
+	for (int i = 0; i < BLOOM_HASHES; i++, bits >>= 9)
+	{
+		block->words[(bits >> 6) & (BLOOM_BLOCK_WORDS - 1)] |= 1ULL << (bits & 63);
+	}
+}
+
+int bloomFilterMayContain(const BloomFilter *filter, long unsigned hash)
+{
+	unsigned long long bits = mixHash(hash);
+	const BloomBlock *block = &filter->blocks[bits & filter->blockMask];
+	bits = mixHash(bits); // 9 bits for each bit of the item
+	for (int i = 0; i < BLOOM_HASHES; i++, bits >>= 9)
+	{
+		if (!(block->words[(bits >> 6) & (BLOOM_BLOCK_WORDS - 1)] & (1ULL << (bits & 63))))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+int treeMayContain(const RBTree *tree, const void *data)
+{
+	if (tree->filter == NULL || bloomFilterMayContain(tree->filter, tree->hashFunc(data)))
+	{
+		return true;
+	}
+	COUNT(tree, filterRejects);
+	return false;
+}
+
+void addToTreeFilter(RBTree *tree, const void *data)
+{
+	if (nodeCount(tree) > tree->filter->capacity && rebuildRBTreeFilter(tree))
+	{
+		return; // the new filter has data
+	}
+	addToBloomFilter(tree->filter, tree->hashFunc(data));
+}
+
+void countRemovedFromFilter(RBTree *tree, long unsigned count)
+{
+	tree->filter->removed += count;
+	if (tree->filter->removed > nodeCount(tree))
+	{
+		rebuildRBTreeFilter(tree); // if it fails, the old filter is still right, only slower
+	}
+}
+
+int rebuildRBTreeFilter(RBTree *tree)
+{
+	if (tree == NULL || tree->hashFunc == NULL)
+	{
+		return false;
+	}
+	BloomFilter *filter = newBloomFilter(2 * nodeCount(tree));
+	if (filter == NULL)
+	{
+		return false;
+	}
+	for (const Node *node = tree->min; node != NULL; node = node->next)
+	{
+		addToBloomFilter(filter, tree->hashFunc(node->data));
+	}
+	freeBloomFilter(tree->filter);
+	tree->filter = filter;
+	return true;
+}
+
+int setRBTreeFilter(RBTree *tree, HashFunc hashFunc)
+{
+	if (tree == NULL)
+	{
+		return false;
+	}
+	freeBloomFilter(tree->filter);
+	tree->filter = NULL;
+	tree->hashFunc = hashFunc;
+	if (hashFunc == NULL)
+	{
+		return true;
+	}
+	if (!rebuildRBTreeFilter(tree))
 	{
+		tree->hashFunc = NULL;
+		return false;
+	}
+	return true;
+}
+
+HashIndex *newHashIndex(HashFunc hashFunc, long unsigned slots)
+{
+	HashIndex *index = (HashIndex *) calloc(1, sizeof(HashIndex) + slots * sizeof(IndexSlot));
+	if (index == NULL)
+	{
+		return NULL;
+	}
+	index->hashFunc = hashFunc;
+	index->mask = slots - 1;
+	return index;
+}
+
+void putToHashIndex(HashIndex *index, unsigned long long hash, Node *node)
+{
+	long unsigned i = hash & index->mask;
+	while (index->slots[i].node != NULL)
+	{
+		i = (i + 1) & index->mask;
+	}
+	index->slots[i].hash = hash;
+	index->slots[i].node = node;
+	index->count++;
+}
+
+Node *findInHashIndex(const RBTree *tree, const void *data)
+{
+	const HashIndex *index = tree->index;
+	unsigned long long hash = mixHash(index->hashFunc(data));
+	for (long unsigned i = hash & index->mask; index->slots[i].node != NULL;
+		 i = (i + 1) & index->mask)
+	{
+		if (index->slots[i].hash == hash && COMPARE(tree, data, index->slots[i].node->data) == 0)
+		{
+			return index->slots[i].node;
+		}
+	}
+	return NULL;
+}
+
+IndexSlot *findIndexSlot(const RBTree *tree, const Node *node)
+{
+	HashIndex *index = tree->index;
+	long unsigned i = mixHash(index->hashFunc(node->data)) & index->mask;
+	while (index->slots[i].node != node)
+	{
+		i = (i + 1) & index->mask;
+	}
+	return &index->slots[i];
+}
+
+void addToHashIndex(RBTree *tree, Node *node)
+{
+	if (2 * nodeCount(tree) > tree->index->mask + 1 && !growHashIndex(tree) &&
+		tree->index->count == tree->index->mask)
+	{
+		setRBTreeHashIndex(tree, NULL); // full, the searches fall back on the tree
 		return;
 	}
-	Node *y = x->right;
-	Node *t2 = y->left;
+	putToHashIndex(tree->index, mixHash(tree->index->hashFunc(node->data)), node);
+}
 
-	y->parent = x->parent;
-	if (y->parent != NULL)
+int growHashIndex(RBTree *tree)
+{
+	HashIndex *old = tree->index;
+	HashIndex *index = newHashIndex(old->hashFunc, 2 * (old->mask + 1));
+	if (index == NULL)
 	{
-		if (y->parent->left == x)
+		return false;
+	}
+	for (long unsigned i = 0; i <= old->mask; i++)
+	{
+		if (old->slots[i].node != NULL)
 		{
-			y->parent->left = y;
+			putToHashIndex(index, old->slots[i].hash, old->slots[i].node);
 		}
-		else // x was right child
+	}
+	free(old);
+	tree->index = index;
+	return true;
+}
+
+void removeFromHashIndex(RBTree *tree, const Node *node)
+{
+	HashIndex *index = tree->index;
+	long unsigned hole = findIndexSlot(tree, node) - index->slots;
+	long unsigned i = hole;
+	while (true)
+	{
+		i = (i + 1) & index->mask;
+		if (index->slots[i].node == NULL)
 		{
-			y->parent->right = y;
+			break;
+		}
+		// an item may fill the hole only if the hole is between its home slot and its slot
+		long unsigned home = index->slots[i].hash & index->mask;
+		if (((i - home) & index->mask) >= ((i - hole) & index->mask))
+		{
+			index->slots[hole] = index->slots[i];
+			hole = i;
 		}
 	}
-	else // y is the new root in the tree
+	index->slots[hole].node = NULL;
+	index->count--;
+}
+
+int rebuildHashIndex(RBTree *tree, HashFunc hashFunc, long unsigned slots)
+{
+	HashIndex *index = newHashIndex(hashFunc, slots);
+	if (index == NULL)
 	{
-		tree->root = y;
+		return false;
 	}
-	y->left = x;
-	x->parent = y;
-	x->right = t2;
-	if (t2 != NULL)
+	for (Node *node = tree->min; node != NULL; node = node->next)
 	{
-		t2->parent = x;
+		putToHashIndex(index, mixHash(hashFunc(node->data)), node);
 	}
+	free(tree->index);
+	tree->index = index;
+	return true;
 }
 
-Node *getUncle(const Node *node)
+int setRBTreeHashIndex(RBTree *tree, HashFunc hashFunc)
 {
-	if (node == NULL)
+	if (tree == NULL)
 	{
-		return NULL;
+		return false;
 	}
-	return getBrother(node->parent);
+	if (hashFunc == NULL)
+	{
+		free(tree->index);
+		tree->index = NULL;
+		return true;
+	}
+	long unsigned slots = MIN_INDEX_SLOTS;
+	while (slots < 2 * nodeCount(tree) + 1)
+	{
+		slots *= 2;
+	}
+	if (!rebuildHashIndex(tree, hashFunc, slots))
+	{
+		free(tree->index);
+		tree->index = NULL;
+		return false;
+	}
+	return true;
 }
 
-Node *getBrother(const Node *node)
+void *findMaxValueInRBTree(const RBTree *tree)
 {
-	if (node == NULL || node->parent == NULL)
+	if (tree == NULL || tree->valueFunc == NULL || tree->root == NULL)
 	{
 		return NULL;
 	}
-	else if (node->parent->left == node)
+	Node *node = tree->root;
+	double max = node->maxValue;
+	while (true)
 	{
-		return node->parent->right;
+		if (node->left != NULL && node->left->maxValue == max)
+		{
+			node = node->left;
+		}
+		else if (node->value == max || node->right == NULL)
+		{
+			return node->data;
+		}
+		else
+		{
+			node = node->right;
+		}
 	}
-	else // node is right child
+}
+
+void offerToHeap(ValueHeap *heap, double value, void *data)
+{
+	if (heap->size < heap->capacity)
 	{
-		return node->parent->left;
+		long unsigned i = heap->size++;
+		while (i > 0 && heap->items[(i - 1) / 2].value > value) // sift up
+		{
+			heap->items[i] = heap->items[(i - 1) / 2];
+			i = (i - 1) / 2;
+		}
+		heap->items[i].value = value;
+		heap->items[i].data = data;
+	}
+	else if (heap->capacity > 0 && value > heap->items[0].value)
+	{
+		replaceHeapRoot(heap, value, data);
 	}
 }
 
-Node *getGrandpa(const Node *node)
+void replaceHeapRoot(ValueHeap *heap, double value, void *data)
 {
-	if (node == NULL || node->parent == NULL)
+	long unsigned i = 0;
+	while (true) // sift down
 	{
-		return NULL;
+		long unsigned child = 2 * i + 1;
+		if (child >= heap->size)
+		{
+			break;
+		}
+		if (child + 1 < heap->size && heap->items[child + 1].value < heap->items[child].value)
+		{
+			child++;
+		}
+		if (heap->items[child].value >= value)
+		{
+			break;
+		}
+		heap->items[i] = heap->items[child];
+		i = child;
 	}
-	return node->parent->parent;
+	heap->items[i].value = value;
+	heap->items[i].data = data;
 }
 
-void fixInsertToRBTree(RBTree *tree, Node *n)
+void collectTopK(const Node *node, ValueHeap *heap)
 {
-	Node *parent = n->parent;
-	Node *grandpa = getGrandpa(n);
-	Node *uncle = getUncle(n);
-	if (parent == NULL)
+	if (node == NULL ||
+		(heap->size == heap->capacity && node->maxValue <= heap->items[0].value))
 	{
-		n->color = BLACK;
 		return;
 	}
-	else if (parent->color == BLACK)
+	offerToHeap(heap, node->value, node->data);
+	// the sub tree with the larger max first, it raises the bound of the heap faster
+	const Node *first = node->left, *second = node->right;
+	if (second != NULL && (first == NULL || second->maxValue > first->maxValue))
 	{
-		return;
+		first = node->right;
+		second = node->left;
 	}
-	else if (uncle != NULL && uncle->color == RED)
+	collectTopK(first, heap);
+	collectTopK(second, heap);
+}
+
+void *topKThread(void *task)
+{
+	TopKTask *topK = (TopKTask *) task;
+	for (long unsigned i = 0; i < topK->numRoots; i += topK->step)
 	{
-		parent->color = BLACK;
-		uncle->color = BLACK;
-		grandpa->color = RED;
-		return fixInsertToRBTree(tree, grandpa);
+		collectTopK(topK->roots[i], &topK->heap);
 	}
-	else if (grandpa->right == parent && parent->right == n)
+	return NULL;
+}
+
+long unsigned findTopKByValueInRBTree(const RBTree *tree, long unsigned k, void **out,
+									  int threads)
+{
+	if (tree == NULL || tree->valueFunc == NULL || out == NULL || k == 0)
 	{
-		leftRotation(tree, grandpa);
-		parent->color = BLACK;
-		grandpa->color = RED;
-		return;
+		return 0;
 	}
-	else if (grandpa->left == parent && parent->left == n)
+	if (k > tree->size)
 	{
-		rightRotation(tree, grandpa);
-		parent->color = BLACK;
-		grandpa->color = RED;
-		return;
+		k = tree->size;
 	}
-	else if (grandpa->right == parent && parent->left == n)
+	ValueHeap heap = {(RankedItem *) malloc(k * sizeof(RankedItem)), 0, k};
+	if (heap.items == NULL)
 	{
-		rightRotation(tree, parent);
-		leftRotation(tree, grandpa);
-		n->color = BLACK;
-		grandpa->color = RED;
-		return;
+		return 0;
 	}
-	else // grandpa->left->right == n
+	if (threads <= 1 || tree->size < (long unsigned) threads)
 	{
-		leftRotation(tree, parent);
-		rightRotation(tree, grandpa);
-		n->color = BLACK;
-		grandpa->color = RED;
-		return;
+		collectTopK(tree->root, &heap);
+	}
+	else
+	{
+		// go down until there are enough sub trees, the nodes above them go to the heap here
+		long unsigned numRoots = 1, wanted = 4 * (long unsigned) threads;
+		Node **roots = (Node **) malloc(4 * wanted * sizeof(Node *)); // two levels of the tree
+		TopKTask *tasks = (TopKTask *) calloc(threads, sizeof(TopKTask));
+		pthread_t *ids = (pthread_t *) calloc(threads, sizeof(pthread_t));
+		if (roots == NULL || tasks == NULL || ids == NULL)
+		{
+			free(roots);
+			free(tasks);
+			free(ids);
+			free(heap.items);
+			return 0;
+		}
+		Node **level = roots, **nextLevel = roots + 2 * wanted;
+		level[0] = tree->root;
+		while (numRoots < wanted && numRoots > 0)
+		{
+			long unsigned next = 0;
+			for (long unsigned i = 0; i < numRoots; i++)
+			{
+				Node *node = level[i];
+				offerToHeap(&heap, node->value, node->data);
+				if (node->left != NULL)
+				{
+					nextLevel[next++] = node->left;
+				}
+				if (node->right != NULL)
+				{
+					nextLevel[next++] = node->right;
+				}
+			}
+			Node **tmp = level;
+			level = nextLevel;
+			nextLevel = tmp;
+			numRoots = next;
+		}
+		for (int t = 0; t < threads; t++)
+		{
+			tasks[t].roots = level + t;
+			tasks[t].numRoots = (numRoots > (long unsigned) t) ? numRoots - t : 0;
+			tasks[t].step = threads;
+			tasks[t].heap.items = (RankedItem *) malloc(k * sizeof(RankedItem));
+			tasks[t].heap.capacity = (tasks[t].heap.items == NULL) ? 0 : k;
+			if (tasks[t].heap.items == NULL ||
+				pthread_create(&ids[t], NULL, topKThread, &tasks[t]) != 0)
+			{
+				tasks[t].heap.capacity = 0; // search its sub trees here
+				for (long unsigned i = t; i < numRoots; i += threads)
+				{
+					collectTopK(level[i], &heap);
+				}
+			}
+		}
+		for (int t = 0; t < threads; t++)
+		{
+			if (tasks[t].heap.capacity > 0)
+			{
+				pthread_join(ids[t], NULL);
+				for (long unsigned i = 0; i < tasks[t].heap.size; i++)
+				{
+					offerToHeap(&heap, tasks[t].heap.items[i].value, tasks[t].heap.items[i].data);
+				}
+			}
+			free(tasks[t].heap.items);
+		}
+		free(roots);
+		free(tasks);
+		free(ids);
 	}
+	long unsigned found = heap.size;
+	while (heap.size > 0) // the smallest leaves the heap first, so out is filled from the end
+	{
+		out[heap.size - 1] = heap.items[0].data;
+		RankedItem last = heap.items[--heap.size];
+		if (heap.size > 0)
+		{
+			replaceHeapRoot(&heap, last.value, last.data);
+		}
+	}
+	free(heap.items);
+	return found;
 }
 
-int forEachRBTree(const RBTree *tree, forEachFunc func, void *args)
+int forEachValueAbove(const Node *node, double bound, forEachFunc func, void *args)
 {
-	if (tree == NULL)
+	if (node == NULL || !(node->maxValue > bound))
 	{
-		return false;
+		return true;
 	}
-	if (tree->root == NULL)
+	if (!forEachValueAbove(node->left, bound, func, args))
 	{
-		return true;
+		return false;
 	}
-	Node *curNode = findMin(tree->root);
-	while (curNode != NULL)
+	if (node->value > bound && func(node->data, args) == 0)
 	{
-		if (func(curNode->data, args) == 0)
-		{
-			return false;
-		};
-		curNode = getSuccessor(curNode);
+		return false;
 	}
-	return true;
+	return forEachValueAbove(node->right, bound, func, args);
 }
 
-int RBTreeContains(const RBTree *tree, const void *data)
+int forEachValueAboveRBTree(const RBTree *tree, double bound, forEachFunc func, void *args)
 {
-	if (tree == NULL || data == NULL || findXNormalBST(tree, tree->root, data) == NULL)
+	if (tree == NULL || tree->valueFunc == NULL || func == NULL)
 	{
 		return false;
 	}
-	return true;
+	return forEachValueAbove(tree->root, bound, func, args);
 }
 
-Node *findXNormalBST(const RBTree *tree, Node *node, const void *data)
+void *peekMinRBTree(const RBTree *tree)
 {
-	if (node == NULL || data == NULL)
+	if (tree == NULL || tree->min == NULL)
 	{
 		return NULL;
 	}
-	int res = tree->compFunc(data, node->data);
-	if (res == 0)
-	{
-		return node;
-	}
-	else if (res > 0)
-	{
-		return findXNormalBST(tree, node->right, data);
-	}
-	else // res <0
-	{
-		return findXNormalBST(tree, node->left, data);
-	}
+	return tree->min->data;
 }
 
-Node *findMin(Node *node)
+void *peekMaxRBTree(const RBTree *tree)
 {
-	if (node->left == NULL)
+	if (tree == NULL || tree->max == NULL)
 	{
-		return node;
+		return NULL;
 	}
-	return findMin(node->left);
+	return tree->max->data;
 }
 
-Node *getSuccessor(Node *n)
+void *popMinFromRBTree(RBTree *tree)
 {
-	if (n->right != NULL)
+	if (tree == NULL)
 	{
-		return findMin(n->right);
+		return NULL;
 	}
-	Node *p = n->parent;
-	while (p != NULL && n == p->right)
+	TRACE(tree, TRACE_POP_MIN, NULL, NULL, 0);
+	if (tree->min == NULL)
 	{
-		n = p;
-		p = p->parent;
+		return NULL;
 	}
-	return p;
+	Node *node = tree->min; // has no left child, so it can be erased as is
+	void *data = node->data;
+	deleteOneChild(tree, &node, false);
+	trimTombstones(tree);
+	return data;
 }
 
-int deleteFromRBTree(RBTree *tree, void *data)
+void *popMaxFromRBTree(RBTree *tree)
 {
 	if (tree == NULL)
 	{
-		return false;
+		return NULL;
 	}
-	Node *initNode = findXNormalBST(tree, tree->root, data);
-	if (initNode == NULL) // the value not in tree!!
+	TRACE(tree, TRACE_POP_MAX, NULL, NULL, 0);
+	if (tree->max == NULL)
 	{
-		return false;
+		return NULL;
 	}
-	Node *node = deleteNormalBST(initNode); // from now. to node have 1 chiled in worst case
-	deleteOneChild(tree, &node);
-
-	return true;
+	Node *node = tree->max; // has no right child, so it can be erased as is
+	void *data = node->data;
+	deleteOneChild(tree, &node, false);
+	trimTombstones(tree);
+	return data;
 }
 
-Node *deleteNormalBST(Node *node)
+Node *deleteNormalBST(RBTree *tree, Node *node)
 {
 	if (node->left != NULL && node->right != NULL)
 	{
-		Node *successor = getSuccessor(node);
+		Node *successor = node->next; // the right sub tree is not empty, so it is there
+		if (tree->index != NULL)
+		{
+			// the items change nodes, so their slots do too
+			IndexSlot *nodeSlot = findIndexSlot(tree, node);
+			IndexSlot *successorSlot = findIndexSlot(tree, successor);
+			nodeSlot->node = successor;
+			successorSlot->node = node;
+		}
 		void *nodeData = node->data;
 		node->data = successor->data;
 		successor->data = nodeData;
+		double nodeValue = node->value;
+		node->value = successor->value;
+		successor->value = nodeValue;
+		unsigned char nodeTombstone = node->tombstone;
+		node->tombstone = successor->tombstone;
+		successor->tombstone = nodeTombstone;
 		return successor;
 	}
 	return node;
 }
 
-void replaceNode(Node *n, Node *child)
+void replaceNode(RBTree *tree, Node *n, Node *child)
 {
 	Node *parent = n->parent;
-	if (child == NULL && parent == NULL)
+	if (child != NULL)
 	{
-		return;
+		child->parent = parent;
 	}
-	else if (child != NULL && parent == NULL)
+	if (parent == NULL)
 	{
-		child->parent = parent;
-		return;
+		tree->root = child;
 	}
-	else if (child == NULL) // parent != NULL
+	else if (parent->left == n)
 	{
-		if (n->parent->left == n)
-		{
-			n->parent->left = child;
-		}
-		else // n is right sum
-		{
-			n->parent->right = child;
-		}
+		parent->left = child;
 	}
-	else // child != NULL && parent != NULL
+	else // n is right sum
 	{
-		child->parent = parent;
-		if (n->parent->left == n)
-		{
-			n->parent->left = child;
-		}
-		else // n is right sum
-		{
-			n->parent->right = child;
-		}
+		parent->right = child;
 	}
 }
 
 
-void deleteOneChild(RBTree *tree, Node **n)
+void deleteOneChild(RBTree *tree, Node **n, int freeData)
 {
 	Node *child = ((*n)->right == NULL) ? (*n)->left : (*n)->right;
+	Node *parent = (*n)->parent;
 
-	replaceNode(*n, child);
-	if ((*n)->color == BLACK)
+	replaceNode(tree, *n, child);
+	if (tree->policy != RB_POLICY)
+	{
+		fixDelete(tree, child, parent);
+	}
+	else if ((*n)->color == BLACK)
 	{
 		if (child != NULL && child->color == RED)
 		{
+			COUNT(tree, recolors);
 			child->color = BLACK;
 		}
 		else
@@ -630,22 +3148,46 @@ void deleteOneChild(RBTree *tree, Node **n)
 		}
 	}
 
-	tree->freeFunc((*n)->data);
-	free(*n);
+	if (tree->finger == *n)
+	{
+		tree->finger = (*n)->parent;
+	}
+	if (tree->compactCursor == *n)
+	{
+		tree->compactCursor = (*n)->next;
+	}
+	unlinkNeighbours(tree, *n);
+	if (tree->index != NULL)
+	{
+		removeFromHashIndex(tree, *n);
+	}
+	if (freeData && tree->freeFunc != NULL)
+	{
+		tree->freeFunc((*n)->data);
+	}
+	if ((*n)->tombstone)
+	{
+		tree->tombstones--;
+	}
+	else
+	{
+		tree->size = tree->size - 1;
+	}
+	releaseNode(tree, *n);
 	*n = NULL;
-	tree->size = tree->size - 1;
-	if (tree->size == ONE_NODE_IN_TREE && child != NULL)
+	if (tree->valueFunc != NULL)
 	{
-		tree->root = child;
+		updateMaxValueUp(parent); // only the ancestors of n may hold its old value
 	}
-	if (tree->size == ZERO_NODE_IN_TREE)
+	if (tree->filter != NULL)
 	{
-		tree->root = NULL;
+		countRemovedFromFilter(tree, 1);
 	}
 }
 
 void deleteLevel1(RBTree *tree, Node *node, Node *parent)
 {
+	COUNT(tree, deleteCases[0]);
 	if (parent != NULL)
 	{
 		deleteLevel2(tree, node, parent);
@@ -654,9 +3196,11 @@ void deleteLevel1(RBTree *tree, Node *node, Node *parent)
 
 void deleteLevel2(RBTree *tree, Node *node, Node *parent)
 {
+	COUNT(tree, deleteCases[1]);
 	Node *s = (parent->left == node) ? parent->right : parent->left;
 	if (s != NULL && s->color == RED)
 	{
+		COUNT_ADD(tree, recolors, 2);
 		parent->color = RED;
 		s->color = BLACK;
 		if (parent->left == node)
@@ -687,11 +3231,13 @@ int nodeAndthoSunsAreBlack(Node* node)
 }
 void deleteLevel3(RBTree *tree, Node *node, Node *parent)
 {
+	COUNT(tree, deleteCases[2]);
 	Node *s = (parent->left == node) ? parent->right : parent->left;
 	if (parent->color == BLACK && nodeAndthoSunsAreBlack(s) == 1)
 	{
 		if (s != NULL)
 		{
+			COUNT(tree, recolors);
 			s->color = RED;
 		}
 		deleteLevel1(tree, parent, parent->parent);
@@ -704,13 +3250,16 @@ void deleteLevel3(RBTree *tree, Node *node, Node *parent)
 
 void deleteLevel4(RBTree *tree, Node *node, Node *parent)
 {
+	COUNT(tree, deleteCases[3]);
 	Node *s = (parent->left == node) ? parent->right : parent->left;
 	if (parent->color == RED && nodeAndthoSunsAreBlack(s) == 1)
 	{
 		if (s != NULL)
 		{
+			COUNT(tree, recolors);
 			s->color = RED;
 		}
+		COUNT(tree, recolors);
 		parent->color = BLACK;
 	}
 	else
@@ -740,11 +3289,13 @@ int theColorOfchildrenAre(Node *node)
 
 void deleteLevel5(RBTree *tree, Node *node, Node *parent)
 {
+	COUNT(tree, deleteCases[4]);
 	Node *s = (parent->left == node) ? parent->right : parent->left;
 	if (s == NULL || s->color == BLACK)
 	{
 		if (parent->left == node && theColorOfchildrenAre(s) == 2)
 		{
+			COUNT_ADD(tree, recolors, 2);
 			s->color = RED;
 			s->left->color = BLACK;
 			rightRotation(tree, s);
@@ -752,6 +3303,7 @@ void deleteLevel5(RBTree *tree, Node *node, Node *parent)
 		}
 		else if (parent->right == node && theColorOfchildrenAre(s) == 1)
 		{
+			COUNT_ADD(tree, recolors, 2);
 			s->color = RED;
 			s->right->color = BLACK;
 			leftRotation(tree, s);
@@ -762,6 +3314,8 @@ void deleteLevel5(RBTree *tree, Node *node, Node *parent)
 
 void deleteLevel6(RBTree *tree, Node *node, Node *parent)
 {
+	COUNT(tree, deleteCases[5]);
+	COUNT_ADD(tree, recolors, 3);
 	Node *s = (parent->left == node) ? parent->right : parent->left;
 	s->color = parent->color;
 	parent->color = BLACK;
@@ -777,17 +3331,228 @@ void deleteLevel6(RBTree *tree, Node *node, Node *parent)
 	}
 }
 
-void freeNodes(Node **node, FreeFunc freeFunc)
+void fixInsert(RBTree *tree, Node *n)
+{
+	switch (tree->policy)
+	{
+		case AVL_POLICY:
+			fixAvl(tree, n->parent);
+			break;
+		case WAVL_POLICY:
+			fixInsertToWavl(tree, n);
+			break;
+		case TREAP_POLICY:
+			fixInsertToTreap(tree, n);
+			break;
+		default:
+			fixInsertToRBTree(tree, n);
+	}
+}
+
+void fixDelete(RBTree *tree, Node *child, Node *parent)
+{
+	if (tree->policy == AVL_POLICY)
+	{
+		fixAvl(tree, parent);
+	}
+	else if (tree->policy == WAVL_POLICY)
+	{
+		fixDeleteFromWavl(tree, child, parent);
+	}
+	// a treap stays a heap of priorities when a node with one child is erased
+}
+
+int nodeRank(const Node *node)
+{
+	return (node == NULL) ? -1 : node->rank;
+}
+
+void updateHeight(Node *node)
+{
+	int left = nodeRank(node->left), right = nodeRank(node->right);
+	node->rank = 1 + ((left > right) ? left : right);
+}
+
+Node *rebalanceAvl(RBTree *tree, Node *node)
+{
+	int balance = nodeRank(node->left) - nodeRank(node->right);
+	if (balance > 1)
+	{
+		Node *left = node->left;
+		if (nodeRank(left->left) < nodeRank(left->right))
+		{
+			leftRotation(tree, left);
+			updateHeight(left);
+			updateHeight(node->left);
+		}
+		rightRotation(tree, node);
+	}
+	else if (balance < -1)
+	{
+		Node *right = node->right;
+		if (nodeRank(right->right) < nodeRank(right->left))
+		{
+			rightRotation(tree, right);
+			updateHeight(right);
+			updateHeight(node->right);
+		}
+		leftRotation(tree, node);
+	}
+	else
+	{
+		return node;
+	}
+	updateHeight(node);
+	updateHeight(node->parent);
+	return node->parent;
+}
+
+void fixAvl(RBTree *tree, Node *node)
+{
+	while (node != NULL)
+	{
+		int oldHeight = node->rank;
+		updateHeight(node);
+		node = rebalanceAvl(tree, node);
+		if (node->rank == oldHeight)
+		{
+			return; // the ancestors did not change
+		}
+		node = node->parent;
+	}
+}
+
+void fixInsertToWavl(RBTree *tree, Node *node)
+{
+	Node *parent = node->parent;
+	// node is a 0-child: it has the rank of its parent
+	while (parent != NULL && parent->rank == node->rank)
+	{
+		Node *brother = (parent->left == node) ? parent->right : parent->left;
+		if (parent->rank - nodeRank(brother) == 1)
+		{
+			parent->rank++;
+			node = parent;
+			parent = node->parent;
+			continue;
+		}
+		// the brother is a 2-child, so one or two rotations end the fix
+		int isLeft = parent->left == node;
+		Node *inner = isLeft ? node->right : node->left;
+		if (inner == NULL || node->rank - inner->rank == 2)
+		{
+			isLeft ? rightRotation(tree, parent) : leftRotation(tree, parent);
+			parent->rank--;
+		}
+		else
+		{
+			isLeft ? leftRotation(tree, node) : rightRotation(tree, node);
+			isLeft ? rightRotation(tree, parent) : leftRotation(tree, parent);
+			inner->rank++;
+			node->rank--;
+			parent->rank--;
+		}
+		return;
+	}
+}
+
+void fixDeleteFromWavl(RBTree *tree, Node *node, Node *parent)
 {
-	if ((*node) == NULL)
+	if (parent == NULL)
+	{
+		return;
+	}
+	if (parent->left == NULL && parent->right == NULL && parent->rank == 1)
 	{
+		parent->rank = 0; // a leaf is not a 2,2 node
+		node = parent;
+		parent = node->parent;
+	}
+	// node is a 3-child: it is lower than its parent by 3
+	while (parent != NULL && parent->rank - nodeRank(node) == 3)
+	{
+		int isLeft = parent->left == node;
+		Node *brother = isLeft ? parent->right : parent->left;
+		if (parent->rank - brother->rank == 2)
+		{
+			parent->rank--;
+			node = parent;
+			parent = node->parent;
+			continue;
+		}
+		Node *outer = isLeft ? brother->right : brother->left;
+		Node *inner = isLeft ? brother->left : brother->right;
+		if (brother->rank - nodeRank(outer) == 2 && brother->rank - nodeRank(inner) == 2)
+		{
+			parent->rank--;
+			brother->rank--;
+			node = parent;
+			parent = node->parent;
+			continue;
+		}
+		if (brother->rank - nodeRank(outer) == 1)
+		{
+			isLeft ? leftRotation(tree, parent) : rightRotation(tree, parent);
+			brother->rank++;
+			parent->rank--;
+			if (parent->left == NULL && parent->right == NULL)
+			{
+				parent->rank--;
+			}
+		}
+		else
+		{
+			isLeft ? rightRotation(tree, brother) : leftRotation(tree, brother);
+			isLeft ? leftRotation(tree, parent) : rightRotation(tree, parent);
+			inner->rank += 2;
+			brother->rank--;
+			parent->rank -= 2;
+		}
 		return;
 	}
-	freeNodes(&((*node)->left), freeFunc);
-	freeNodes(&((*node)->right), freeFunc);
-	freeFunc((*node)->data);
-	free(*node);
-	*node = NULL;
+}
+
+void fixInsertToTreap(RBTree *tree, Node *node)
+{
+	while (node->parent != NULL && node->parent->rank < node->rank)
+	{
+		if (node->parent->left == node)
+		{
+			rightRotation(tree, node->parent);
+		}
+		else
+		{
+			leftRotation(tree, node->parent);
+		}
+	}
+}
+
+int randomPriority(RBTree *tree)
+{
+	long unsigned x = tree->randomState;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	tree->randomState = x;
+	return (int) ((x >> 1) & INT_MAX);
+}
+
+void freeNodes(Node *first, FreeFunc freeFunc)
+{
+	Node *node = first;
+	while (node != NULL)
+	{
+		Node *next = node->next;
+		if (freeFunc != NULL)
+		{
+			freeFunc(node->data);
+		}
+		if (!node->pooled) // pooled nodes are freed with their chunks
+		{
+			free(node);
+		}
+		node = next;
+	}
 }
 
 void freeRBTree(RBTree **tree)
@@ -796,16 +3561,225 @@ void freeRBTree(RBTree **tree)
 	{
 		return;
 	}
-	else if ((*tree)->root == NULL)
+	// without a FreeFunc, only nodes that were allocated one by one need a visit
+	if ((*tree)->root != NULL && ((*tree)->freeFunc != NULL || (*tree)->heapNodes > 0))
+	{
+		freeNodes((*tree)->min, (*tree)->freeFunc);
+	}
+	(*tree)->root = NULL;
+	freeChunks(*tree);
+	freeBloomFilter((*tree)->filter);
+	free((*tree)->index);
+	setRBTreeContext(*tree, NULL, NULL);
+	free((*tree)->counters);
+	free(*tree);
+	*tree = NULL;
+}
+
+Node *cloneNodes(const Node *node, Node *parent, Node *nodes, long unsigned *index,
+				 long unsigned size, CopyFunc copyFunc, int *failed)
+{
+	if (node == NULL || *failed)
+	{
+		return NULL;
+	}
+	Node *left = cloneNodes(node->left, NULL, nodes, index, size, copyFunc, failed);
+	if (*failed)
+	{
+		return NULL;
+	}
+	long unsigned i = *index;
+	Node *copy = &nodes[i];
+	copy->data = (copyFunc == NULL) ? node->data : copyFunc(node->data);
+	if (copy->data == NULL)
+	{
+		*failed = true;
+		return NULL;
+	}
+	(*index)++;
+	copy->parent = parent;
+	copy->left = left;
+	if (left != NULL)
+	{
+		left->parent = copy;
+	}
+	copy->prev = (i > 0) ? &nodes[i - 1] : NULL;
+	copy->next = (i + 1 < size) ? &nodes[i + 1] : NULL;
+	copy->color = node->color;
+	copy->tombstone = node->tombstone;
+	copy->rank = node->rank;
+	copy->pooled = FIRST_GENERATION;
+	copy->value = node->value;
+	copy->maxValue = node->maxValue;
+	copy->right = cloneNodes(node->right, copy, nodes, index, size, copyFunc, failed);
+	return copy;
+}
+
+RBTree *cloneRBTree(const RBTree *tree, CopyFunc copyFunc)
+{
+	if (tree == NULL)
+	{
+		return NULL;
+	}
+	RBTree *clone = newAugmentedRBTree(tree->compFunc, (copyFunc == NULL) ? NULL : tree->freeFunc,
+									   tree->valueFunc);
+	if (clone == NULL)
+	{
+		return NULL;
+	}
+	clone->policy = tree->policy;
+	clone->randomState = tree->randomState;
+	clone->fingerSearch = tree->fingerSearch;
+	clone->poolNodes = tree->poolNodes;
+	clone->purgeThreshold = tree->purgeThreshold;
+	if (tree->root != NULL && !cloneAllNodes(tree, clone, copyFunc))
+	{
+		freeRBTree(&clone);
+		return NULL;
+	}
+	if (copyFunc == NULL)
+	{
+		purgeRBTree(clone); // the items of the tombstones may be freed by tree at any time
+	}
+	if ((tree->filter != NULL && !setRBTreeFilter(clone, tree->hashFunc)) ||
+		(tree->index != NULL && !setRBTreeHashIndex(clone, tree->index->hashFunc)))
+	{
+		freeRBTree(&clone);
+		return NULL;
+	}
+	return clone;
+}
+
+int cloneAllNodes(const RBTree *tree, RBTree *clone, CopyFunc copyFunc)
+{
+	long unsigned nodes = nodeCount(tree);
+	NodeChunk *chunk = (NodeChunk *) malloc(sizeof(NodeChunk) + nodes * sizeof(Node));
+	if (chunk == NULL)
+	{
+		return false;
+	}
+	chunk->next = NULL;
+	chunk->capacity = nodes;
+	chunk->used = nodes;
+	clone->chunks = chunk;
+	long unsigned copied = 0;
+	int failed = false;
+	clone->root = cloneNodes(tree->root, NULL, chunk->nodes, &copied, nodes, copyFunc, &failed);
+	if (failed)
+	{
+		for (long unsigned i = 0; i < copied && clone->freeFunc != NULL; i++)
+		{
+			clone->freeFunc(chunk->nodes[i].data);
+		}
+		clone->root = NULL;
+		return false;
+	}
+	clone->size = tree->size;
+	clone->tombstones = tree->tombstones;
+	clone->min = &chunk->nodes[0];
+	clone->max = &chunk->nodes[nodes - 1];
+	COUNT_ADD(clone, nodeAllocs, nodes);
+	return true;
+}
+
+void *freeTreeThread(void *tree)
+{
+	RBTree *toFree = (RBTree *) tree;
+	freeRBTree(&toFree);
+	return NULL;
+}
+
+void freeRBTreeAsync(RBTree **tree)
+{
+	if (tree == NULL || *tree == NULL)
+	{
+		return;
+	}
+	RBTree *toFree = *tree;
+	*tree = NULL;
+	pthread_attr_t attr;
+	pthread_t thread;
+	if (pthread_attr_init(&attr) == 0)
+	{
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		int started = pthread_create(&thread, &attr, freeTreeThread, toFree) == 0;
+		pthread_attr_destroy(&attr);
+		if (started)
+		{
+			return;
+		}
+	}
+	freeRBTree(&toFree);
+}
+
+void collectShape(const Node *node, long unsigned depth, RBTreeStats *stats, double *depthSum)
+{
+	if (node == NULL)
 	{
-		free(*tree);
-		*tree = NULL;
 		return;
 	}
-	else// there are node to be free allocated
+	*depthSum += depth;
+	if (depth + 1 > stats->height)
+	{
+		stats->height = depth + 1;
+	}
+	collectShape(node->left, depth + 1, stats, depthSum);
+	collectShape(node->right, depth + 1, stats, depthSum);
+}
+
+int getRBTreeStats(const RBTree *tree, RBTreeStats *stats)
+{
+	if (tree == NULL || stats == NULL)
+	{
+		return false;
+	}
+	memset(stats, 0, sizeof(RBTreeStats));
+	if (tree->counters != NULL)
+	{
+		stats->counters = *tree->counters;
+	}
+	double depthSum = 0;
+	collectShape(tree->root, 0, stats, &depthSum);
+	if (nodeCount(tree) > ZERO_NODE_IN_TREE)
+	{
+		stats->averageDepth = depthSum / nodeCount(tree);
+	}
+	for (const Node *node = tree->root; node != NULL; node = node->left)
+	{
+		if (node->color == BLACK)
+		{
+			stats->blackHeight++;
+		}
+	}
+	stats->memoryBytes = sizeof(RBTree) + tree->heapNodes * sizeof(Node);
+	for (const NodeChunk *chunk = tree->chunks; chunk != NULL; chunk = chunk->next)
+	{
+		stats->memoryBytes += sizeof(NodeChunk) + chunk->capacity * sizeof(Node);
+	}
+	for (const NodeChunk *chunk = tree->retiredChunks; chunk != NULL; chunk = chunk->next)
+	{
+		stats->memoryBytes += sizeof(NodeChunk) + chunk->capacity * sizeof(Node);
+	}
+	if (tree->counters != NULL)
+	{
+		stats->memoryBytes += sizeof(RBTreeCounters);
+	}
+	if (tree->filter != NULL)
+	{
+		stats->memoryBytes += sizeof(BloomFilter) + BLOOM_BLOCK_ALIGN +
+							  (tree->filter->blockMask + 1) * sizeof(BloomBlock);
+	}
+	if (tree->index != NULL)
+	{
+		stats->memoryBytes += sizeof(HashIndex) + (tree->index->mask + 1) * sizeof(IndexSlot);
+	}
+	return true;
+}
+
+void resetRBTreeCounters(RBTree *tree)
+{
+	if (tree != NULL && tree->counters != NULL)
 	{
-		freeNodes(&(*tree)->root, (*tree)->freeFunc);
-		free(*tree);
-		*tree = NULL;
+		memset(tree->counters, 0, sizeof(RBTreeCounters));
 	}
 }
\ No newline at end of file
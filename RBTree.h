@@ -10,6 +10,21 @@ typedef enum Color
 	RED, BLACK
 } Color;
 
+/**
+ * the way a tree keeps itself balanced (see newRBTreeWithPolicy).
+ * RB_POLICY: red-black tree, the default. Height up to 2log(n), O(1) rotations per change.
+ * AVL_POLICY: AVL tree. Height up to 1.44log(n), so searches are faster, but a deletion may
+ * rotate O(log(n)) times.
+ * WAVL_POLICY: weak AVL tree. Height up to 1.44log(n) while there are only insertions and
+ * 2log(n) otherwise, and at most 2 rotations per change.
+ * TREAP_POLICY: treap with random priorities. Expected height O(log(n)), expected O(1)
+ * rotations per insertion and none per deletion.
+ */
+typedef enum BalancePolicy
+{
+	RB_POLICY, AVL_POLICY, WAVL_POLICY, TREAP_POLICY
+} BalancePolicy;
+
 /**
  * pointer to a function that compares tree items.
  * @a, @b: two items.
@@ -31,25 +46,176 @@ typedef int (*forEachFunc)(const void *object, void *args);
  */
 typedef void (*FreeFunc)(void *data);
 
+/**
+ * pointer to a function that makes a deep copy of a data item
+ * @data: a pointer to an item of the tree.
+ * @return: the copy, NULL on failure.
+ */
+typedef void *(*CopyFunc)(const void *data);
+
+/**
+ * a block of nodes that the tree allocates at once (see setNodePool).
+ */
+struct NodeChunk;
+
+/**
+ * pointer to a function that maps a data item to a number. A tree with a ValueFunc keeps in every
+ * node the maximal value of its sub tree.
+ * @data: a pointer to an item of the tree.
+ * @return: the value of the item.
+ */
+typedef double (*ValueFunc)(const void *data);
+
+/**
+ * pointer to a function that hashes a data item. Items that are equal by the CompareFunc of the
+ * tree must have equal hashes.
+ * @data: a pointer to an item of the tree.
+ * @return: the hash of the item.
+ */
+typedef long unsigned (*HashFunc)(const void *data);
+
+/**
+ * pointer to a function that writes an item as bytes.
+ * @data: a pointer to an item of the tree.
+ * @buffer: where to write the bytes.
+ * @size: the size of buffer.
+ * @return: the number of bytes of the item (it is written only if it is not larger than size),
+ * 0 on failure.
+ */
+typedef long unsigned (*SerializeFunc)(const void *data, void *buffer, long unsigned size);
+
+/**
+ * pointer to a function that makes an item from the bytes that a SerializeFunc wrote.
+ * @buffer: the bytes.
+ * @size: the number of bytes.
+ * @return: a new item, NULL on failure.
+ */
+typedef void *(*DeserializeFunc)(const void *buffer, long unsigned size);
+
+/**
+ * the public calls that a tracer of a tree sees (see setRBTreeTracer).
+ */
+typedef enum TraceOp
+{
+	TRACE_INSERT, TRACE_DELETE, TRACE_CONTAINS, TRACE_FIND, TRACE_POP_MIN, TRACE_POP_MAX,
+	TRACE_DELETE_RANGE, TRACE_FOR_EACH, TRACE_FOR_EACH_FROM, NUM_TRACE_OPS
+} TraceOp;
+
+/**
+ * pointer to a function that is told about every traced call of a tree, before it runs. Calls
+ * whose arguments are NULL fail before they are traced, so the keys of the calls that have keys
+ * are never NULL.
+ * @recorder: the recorder that was given to setRBTreeTracer.
+ * @op: the call.
+ * @key: the item of the call (lo of TRACE_DELETE_RANGE, from of TRACE_FOR_EACH_FROM), NULL for
+ * TRACE_POP_MIN, TRACE_POP_MAX and TRACE_FOR_EACH.
+ * @key2: hi of TRACE_DELETE_RANGE, NULL for the other calls.
+ * @count: the limit of TRACE_FOR_EACH_FROM, 0 for the other calls.
+ */
+typedef void (*TraceFunc)(void *recorder, TraceOp op, const void *key, const void *key2,
+						  long unsigned count);
+
+/**
+ * a Bloom filter of the items of a tree (see setRBTreeFilter).
+ */
+struct BloomFilter;
+
+/**
+ * a hash table from the items of a tree to their nodes (see setRBTreeHashIndex).
+ */
+struct HashIndex;
+
 /*
  * a node of the tree.
  */
 typedef struct Node
 {
 	struct Node *parent, *left, *right;
-	Color color;
+	struct Node *prev, *next; // the previous and the next nodes in the order of the tree
+	Color color; // used only by RB_POLICY
+	int rank; // the height in AVL_POLICY, the rank in WAVL_POLICY, the priority in TREAP_POLICY
+	unsigned char pooled; // 0 if allocated by itself, else the generation of its chunk
+	unsigned char tombstone; // if not 0, the item was deleted lazily (see setRBTreeLazyDelete)
 	void *data;
+	double value, maxValue; // the value of data and the max value in the sub tree (see ValueFunc)
 } Node;
 
+/**
+ * number of cases in fixInsertToRBTree: new root, BLACK parent, RED uncle, outer grandchild and
+ * inner grandchild.
+ */
+#define INSERT_FIX_CASES 5
+
+/**
+ * number of cases in the deletion fix-up (deleteLevel1..deleteLevel6).
+ */
+#define DELETE_FIX_CASES 6
+
+/**
+ * operation counters of a tree. They are collected only when RBTree.c is compiled with
+ * RBTREE_STATS defined (make DEFINES=-DRBTREE_STATS), otherwise they always stay 0.
+ */
+typedef struct RBTreeCounters
+{
+	long unsigned comparisons;
+	long unsigned rotations;
+	long unsigned recolors;
+	long unsigned insertCases[INSERT_FIX_CASES];
+	long unsigned deleteCases[DELETE_FIX_CASES];
+	long unsigned nodeAllocs;
+	long unsigned nodeFrees;
+	long unsigned filterRejects; // searches that the Bloom filter answered (see setRBTreeFilter)
+} RBTreeCounters;
+
+/**
+ * a snapshot of the counters and of the shape of a tree.
+ * height: number of nodes on the longest path from the root (0 for an empty tree).
+ * blackHeight: number of BLACK nodes on a path from the root to a NULL leaf.
+ * averageDepth: average depth of the nodes (the root is in depth 0).
+ * memoryBytes: memory used by the tree itself, without the memory of the data items.
+ */
+typedef struct RBTreeStats
+{
+	RBTreeCounters counters;
+	long unsigned height;
+	long unsigned blackHeight;
+	double averageDepth;
+	long unsigned memoryBytes;
+} RBTreeStats;
+
 /**
  * represents the tree
  */
 typedef struct RBTree
 {
 	Node *root;
+	Node *min, *max; // the first and the last nodes in the order of the tree
 	CompareFunc compFunc;
-	FreeFunc freeFunc;
-	long unsigned size;
+	FreeFunc freeFunc; // may be NULL if the tree does not own its items
+	ValueFunc valueFunc; // may be NULL
+	long unsigned size; // the number of items, without the tombstones
+	long unsigned tombstones; // nodes whose items were deleted lazily (see setRBTreeLazyDelete)
+	double purgeThreshold; // 0 unless lazy deletes are on
+	BalancePolicy policy;
+	long unsigned randomState; // the priorities of TREAP_POLICY
+	RBTreeCounters *counters; // NULL unless compiled with RBTREE_STATS
+	int fingerSearch; // if not 0, searches start from the last accessed node
+	Node *finger; // the last accessed node (may be NULL)
+	int poolNodes; // if not 0, new nodes are allocated from chunks (see setNodePool)
+	struct NodeChunk *chunks; // the chunks of the pooled nodes
+	Node *freeNodes; // pooled nodes that were freed, linked by their next field
+	long unsigned heapNodes; // number of nodes that were allocated one by one
+	unsigned char generation; // the generation of the chunks (see compactRBTree)
+	struct NodeChunk *retiredChunks; // chunks that a running compaction moves the nodes out of
+	Node *compactCursor; // the next node that the running compaction moves
+	int compacting; // if not 0, a compaction is running
+	HashFunc hashFunc; // the hash of the Bloom filter (may be NULL)
+	struct BloomFilter *filter; // NULL unless setRBTreeFilter turned it on
+	struct HashIndex *index; // NULL unless setRBTreeHashIndex turned it on
+	TraceFunc tracer; // NULL unless setRBTreeTracer turned it on
+	void *traceRecorder; // the first argument of tracer
+	void *context; // something else the tree owns, freed with it (may be NULL)
+	FreeFunc freeContext;
 } RBTree;
 
 /**
@@ -58,6 +224,26 @@ typedef struct RBTree
  */
 RBTree *newRBTree(CompareFunc compFunc, FreeFunc freeFunc); // implement it in RBTree.c
 
+/**
+ * constructs a new tree that is balanced by the given policy instead of by the red-black rules.
+ * All the functions of this file work on it the same way. The insertCases, deleteCases and
+ * recolors counters and the blackHeight of the stats are only of RB_POLICY.
+ * @param compFunc: a function two compare two variables.
+ * @param freeFunc: a function to free an item.
+ * @param policy: the balancing policy.
+ * @return: the tree, NULL on failure.
+ */
+RBTree *newRBTreeWithPolicy(CompareFunc compFunc, FreeFunc freeFunc, BalancePolicy policy);
+
+/**
+ * constructs a new RBTree that keeps the max value of every sub tree, so the item with the max
+ * value can be found in O(logn). The cost of insert and delete stays O(logn).
+ * @param compFunc: a function two compare two variables.
+ * @param freeFunc: a function to free an item.
+ * @param valueFunc: the value of an item. It is called once, when the item is inserted.
+ */
+RBTree *newAugmentedRBTree(CompareFunc compFunc, FreeFunc freeFunc, ValueFunc valueFunc);
+
 /**
  * add an item to the tree
  * @param tree: the tree to add an item to.
@@ -66,6 +252,27 @@ RBTree *newRBTree(CompareFunc compFunc, FreeFunc freeFunc); // implement it in R
  */
 int insertToRBTree(RBTree *tree, void *data); // implement it in RBTree.c
 
+/**
+ * add many items, in any order, to an empty tree in O(n log n) (O(n) if they are sorted). The
+ * items are merge sorted with the CompareFunc of the tree, and the tree is built balanced from
+ * them bottom up, in one block of nodes. Of equal items the first one (in the order of items)
+ * is added, as if they were inserted one by one (the tracer of the tree sees an insert of every
+ * item, in the order of items). The others are not added, and like an item that insertToRBTree
+ * rejects they stay owned by the caller.
+ * @param tree: an empty tree.
+ * @param items: the items (not NULL). On success the array is reordered: items[0..size) are the
+ * added items in the order of the tree, owned by the tree, and items[size..n) are the duplicates
+ * that were not added (size is the size of the tree after the load).
+ * @param n: the number of items.
+ * @param threads: number of threads to sort and build with. 1 (or less) works in the calling
+ * thread, more threads split the sort and the build between them. The CompareFunc and the
+ * ValueFunc are then called from several threads at once.
+ * @return: 0 on failure (the tree is not empty, an item is NULL, or an allocation failed, and
+ * then nothing was added), other on success. If the Bloom filter or the hash index of
+ * the tree can not be rebuilt for the new items, they are turned off.
+ */
+int loadRBTree(RBTree *tree, void **items, long unsigned n, int threads);
+
 /**
  * remove an item from the tree
  * @param tree: the tree to remove an item from.
@@ -82,6 +289,113 @@ int deleteFromRBTree(RBTree *tree, void *data); // implement it in RBTree.c
  */
 int RBTreeContains(const RBTree *tree, const void *data); // implement it in RBTree.c
 
+/**
+ * find the item of the tree that is equal to data.
+ * @param tree: the tree.
+ * @param data: the item to find.
+ * @return: the item in the tree, NULL if there is none.
+ */
+void *RBTreeFind(const RBTree *tree, const void *data);
+
+/**
+ * get the smallest item of the tree, in O(1).
+ * @param tree: the tree.
+ * @return: the smallest item, NULL if the tree is empty.
+ */
+void *peekMinRBTree(const RBTree *tree);
+
+/**
+ * get the biggest item of the tree, in O(1).
+ * @param tree: the tree.
+ * @return: the biggest item, NULL if the tree is empty.
+ */
+void *peekMaxRBTree(const RBTree *tree);
+
+/**
+ * remove the smallest item from the tree and return it. The item is NOT freed, the caller owns
+ * it from now on. No comparisons are made, and the rebalancing is amortized O(1).
+ * @param tree: the tree.
+ * @return: the smallest item, NULL if the tree is empty.
+ */
+void *popMinFromRBTree(RBTree *tree);
+
+/**
+ * remove the biggest item from the tree and return it. The item is NOT freed, the caller owns
+ * it from now on. No comparisons are made, and the rebalancing is amortized O(1).
+ * @param tree: the tree.
+ * @return: the biggest item, NULL if the tree is empty.
+ */
+void *popMaxFromRBTree(RBTree *tree);
+
+/**
+ * remove all the items from lo to hi (including both) and free them with the FreeFunc of the
+ * tree. The first item is found once, and the next ones are reached through the order links, so
+ * removing k items costs O(logn + k) without a search per item. If most of the tree is removed,
+ * the remaining items are rebuilt into a balanced tree in O(n) instead.
+ * @param tree: the tree.
+ * @param lo: the smallest item to remove (it does not have to be in the tree).
+ * @param hi: the biggest item to remove (it does not have to be in the tree).
+ * @return: the number of removed items.
+ */
+long unsigned deleteRangeFromRBTree(RBTree *tree, const void *lo, const void *hi);
+
+/**
+ * keep only the items that keep returns true for. The removed items are freed with the FreeFunc
+ * of the tree, and the remaining ones are rebuilt into a balanced tree, all in O(n).
+ * @param tree: the tree.
+ * @param keep: returns other than 0 for an item to keep, 0 for an item to remove.
+ * @param args: the second argument of keep.
+ * @return: the number of removed items.
+ */
+long unsigned filterRBTree(RBTree *tree, forEachFunc keep, void *args);
+
+/**
+ * find the item with the max value (see newAugmentedRBTree), in O(logn). If some items have the
+ * max value, the smallest of them is returned.
+ * @param tree: a tree with a ValueFunc.
+ * @return: the item with the max value, NULL if the tree is empty or has no ValueFunc.
+ */
+void *findMaxValueInRBTree(const RBTree *tree);
+
+/**
+ * find the k items with the largest values (see newAugmentedRBTree). The search keeps the k best
+ * items in a bounded heap and skips every sub tree whose max value can not enter the heap.
+ * @param tree: a tree with a ValueFunc.
+ * @param k: the number of items to find.
+ * @param out: array of (at least) k pointers, filled with the items (owned by the tree) from the
+ * largest value to the smallest.
+ * @param threads: number of threads to search with. 1 (or less) searches in the calling thread,
+ * more threads split the tree between them, which helps only for very large trees.
+ * @return: the number of items written to out (less than k if the tree has less items), 0 on
+ * failure or if the tree has no ValueFunc.
+ */
+long unsigned findTopKByValueInRBTree(const RBTree *tree, long unsigned k, void **out,
+									  int threads);
+
+/**
+ * Activate a function on each item whose value (see newAugmentedRBTree) is larger than bound, in
+ * an ascending order. Sub trees whose max value is not larger than bound are skipped. if one of
+ * the activations of the function returns 0, the process stops.
+ * @param tree: a tree with a ValueFunc.
+ * @param bound: only items with a larger value are visited.
+ * @param func: the function to activate on the items.
+ * @param args: more optional arguments to the function.
+ * @return: 0 on failure (or if the tree has no ValueFunc), other on success.
+ */
+int forEachValueAboveRBTree(const RBTree *tree, double bound, forEachFunc func, void *args);
+
+/**
+ * check for many items whether the tree contains them. The searches are advanced together and
+ * the next node of each search is prefetched, so the cache misses of different searches overlap
+ * instead of being paid one after the other.
+ * @param tree: the tree to check the items in.
+ * @param keys: the items to check.
+ * @param n: the number of items.
+ * @param results: results[i] is set to 0 if keys[i] is not in the tree, other if it is.
+ * @return: 0 on failure, other on success.
+ */
+int RBTreeContainsMany(const RBTree *tree, const void *const *keys, long unsigned n, int *results);
+
 
 
 /**
@@ -94,11 +408,196 @@ int RBTreeContains(const RBTree *tree, const void *data); // implement it in RBT
  */
 int forEachRBTree(const RBTree *tree, forEachFunc func, void *args); // implement it in RBTree.c
 
+/**
+ * Activate a function on the items that are not smaller than from, in an ascending order, until
+ * it returns 0 or limit items were visited. The first item is found with one search and the next
+ * ones through the order links, so visiting k items costs O(logn + k). For example, a scan of the
+ * keys that start with a prefix starts from the prefix and stops at the first key without it.
+ * @param tree: the tree.
+ * @param from: where to start (it does not have to be in the tree).
+ * @param func: the function to activate, returns 0 to stop (that item is not counted).
+ * @param args: more optional arguments to the function.
+ * @param limit: the max number of items to visit.
+ * @return: the number of items that the function accepted.
+ */
+long unsigned forEachFromRBTree(const RBTree *tree, const void *from, forEachFunc func, void *args,
+								long unsigned limit);
+
 /**
  * free all memory of the data structure.
  * @param tree: pointer to the tree to free.
  */
 void freeRBTree(RBTree **tree); // implement it in RBTree.c
 
+/**
+ * make a copy of the tree with the same structure and colors, node for node, in O(n) and without
+ * calling the compare function. All the nodes of the copy are allocated in one block, in the order
+ * of the tree. The copy has the same CompareFunc, ValueFunc and modes as the tree, but not its
+ * context (see setRBTreeContext), so functions that need the context, like insertStringToRBTree,
+ * fail on it (use cloneStringRBTree of Structs.h for string trees).
+ * @param tree: the tree to copy.
+ * @param copyFunc: makes the copies of the items, that the new tree owns and frees with the
+ * FreeFunc of tree. If NULL, the new tree points to the same items as tree and does not own
+ * them (it has no FreeFunc), so tree must keep them alive while the copy is used. Such a copy
+ * does not get the tombstones of tree (see setRBTreeLazyDelete), whose items tree may free.
+ * @return: the new tree, NULL on failure.
+ */
+RBTree *cloneRBTree(const RBTree *tree, CopyFunc copyFunc);
+
+/**
+ * free all memory of the data structure on a background thread. *tree is set to NULL at once, so
+ * the caller does not wait for the nodes to be freed. The FreeFunc of the tree is called from the
+ * background thread, so it must be safe to call it from another thread. If the thread can not be
+ * started, the tree is freed before the function returns.
+ * @param tree: pointer to the tree to free.
+ */
+void freeRBTreeAsync(RBTree **tree);
+
+/**
+ * turn the finger search mode of the tree on or off. In this mode the tree remembers the last
+ * node that was accessed, and insertions, deletions and searches start from it: they go up until
+ * the sub tree contains the item, and then down. An access to an item that is close to the
+ * previous one (in the order of the tree) costs O(log d) instead of O(log n), where d is the
+ * distance between them. Only insertions and deletions move the finger: the searches of the
+ * functions that take a const tree start from it but do not change it, so threads may still
+ * search the same tree at the same time.
+ * @param tree: the tree.
+ * @param enable: 0 to turn the mode off, other to turn it on.
+ */
+void setFingerSearch(RBTree *tree, int enable);
+
+/**
+ * turn the node pool of the tree on or off. When it is on, new nodes are allocated from large
+ * chunks that the tree owns, a freed node is kept for the next insertion, and all the chunks are
+ * freed together by freeRBTree. If in addition the tree has no FreeFunc, freeRBTree does not
+ * visit the nodes at all, so its cost is the number of chunks and not the number of nodes.
+ * @param tree: the tree.
+ * @param enable: 0 to allocate each new node by itself, other to allocate from the chunks.
+ */
+void setNodePool(RBTree *tree, int enable);
+
+/**
+ * compactRBTree returned: the allocation of a new chunk failed. The tree is not changed by the
+ * failed step, and a later call continues the compaction.
+ */
+#define COMPACTION_FAILED 0
+
+/**
+ * compactRBTree returned: the budget ran out before all the nodes were moved.
+ */
+#define COMPACTION_IN_PROGRESS 1
+
+/**
+ * compactRBTree returned: all the nodes were moved and the old memory was freed.
+ */
+#define COMPACTION_DONE 2
+
+/**
+ * move the nodes of the tree to consecutive memory, in the order of the tree, so scans and
+ * searches touch fewer cache lines and pages. The work is incremental: each call moves at most
+ * budget nodes, and the tree may be used and changed between the calls. The first call of a
+ * compaction allocates one chunk for all the nodes, and the last one frees the memory the nodes
+ * were moved out of. Pointers to nodes are not valid after a call, pointers to items are.
+ * @param tree: the tree.
+ * @param budget: the maximal number of nodes to move in this call.
+ * @return: COMPACTION_DONE, COMPACTION_IN_PROGRESS or COMPACTION_FAILED.
+ */
+int compactRBTree(RBTree *tree, long unsigned budget);
+
+/**
+ * turn the Bloom filter of the tree on or off. The filter keeps a few bits per item, in one cache
+ * line per item, and a search for an item that the filter does not have ends without visiting
+ * the tree (RBTreeContains, RBTreeContainsMany and deleteFromRBTree). Insertions add the item
+ * to the filter. A removed item stays in the filter and only makes its false positives more
+ * likely, so the filter is rebuilt when as many items were removed as there are in the tree, or
+ * when the tree grows beyond the size the filter was built for.
+ * @param tree: the tree.
+ * @param hashFunc: hashes the items, NULL to turn the filter off.
+ * @return: 0 on failure (the filter could not be allocated, and it is off), other on success.
+ */
+int setRBTreeFilter(RBTree *tree, HashFunc hashFunc);
+
+/**
+ * build the Bloom filter of the tree again from the items in it, in O(n), removing the items
+ * that were removed from the tree since it was built.
+ * @param tree: the tree (with a filter).
+ * @return: 0 on failure (no filter, or an allocation failed and the old filter is kept), other
+ * on success.
+ */
+int rebuildRBTreeFilter(RBTree *tree);
+
+/**
+ * turn the hash index of the tree on or off. The index is an open addressing hash table from the
+ * items to their nodes, kept by every change of the tree, so RBTreeContains, RBTreeFind,
+ * RBTreeContainsMany and the search of deleteFromRBTree cost O(1) expected instead of O(logn)
+ * comparisons. Every insert also writes a slot of the index, so inserts are slower. The order of
+ * the tree is still used by everything else (forEachRBTree, the ranges, min and max). If the index
+ * can not grow when the tree does, it is turned off.
+ * @param tree: the tree.
+ * @param hashFunc: hashes the items, NULL to turn the index off.
+ * @return: 0 on failure (the index could not be allocated, and it is off), other on success.
+ */
+int setRBTreeHashIndex(RBTree *tree, HashFunc hashFunc);
+
+/**
+ * turn the lazy delete mode of the tree on or off. In this mode deleteFromRBTree only marks the
+ * node of the item as a tombstone, after one search and without any rotation or recoloring, and
+ * the searches and iterations skip the tombstones (min and max are never tombstones, so popping
+ * erases the node as before). An insert of an item that is equal to a tombstone reuses its node.
+ * When more than threshold of the nodes are tombstones, the delete purges them all (see
+ * purgeRBTree), so each delete costs O(1 / threshold) amortized for the purges. The item of a
+ * tombstone is freed with the FreeFunc of the tree when it is purged or reused. A tree with a
+ * ValueFunc can not use this mode, since its max values would count the tombstones.
+ * @param tree: the tree.
+ * @param threshold: the share of the nodes (more than 0, up to 1) that may be tombstones before
+ * they are purged, 1 to purge only with purgeRBTree. 0 turns the mode off and purges at once.
+ * @return: 0 on failure (a tree with a ValueFunc, or a threshold out of range), other on success.
+ */
+int setRBTreeLazyDelete(RBTree *tree, double threshold);
+
+/**
+ * remove all the tombstones of the tree (see setRBTreeLazyDelete) and free their items, in one
+ * pass over the nodes that links the remaining ones and rebuilds them into a balanced tree, O(n).
+ * @param tree: the tree.
+ * @return: the number of removed tombstones.
+ */
+long unsigned purgeRBTree(RBTree *tree);
+
+/**
+ * turn tracing of the tree on or off. When it is on, the tracer is called at the start of
+ * insertToRBTree, deleteFromRBTree, RBTreeContains, RBTreeFind, popMinFromRBTree,
+ * popMaxFromRBTree, deleteRangeFromRBTree, forEachRBTree and forEachFromRBTree, and once for every
+ * key of RBTreeContainsMany (see TraceRBTree.h for a recorder that writes them to a file). A clone
+ * of the tree is not traced.
+ * @param tree: the tree.
+ * @param tracer: the function to call, NULL to turn tracing off.
+ * @param recorder: the first argument of tracer.
+ */
+void setRBTreeTracer(RBTree *tree, TraceFunc tracer, void *recorder);
+
+/**
+ * give the tree something to own, that freeRBTree frees after all the nodes (for example, memory
+ * that all the items point into). A previous context is freed first.
+ * @param tree: the tree.
+ * @param context: the object to own.
+ * @param freeContext: the function that frees it.
+ */
+void setRBTreeContext(RBTree *tree, void *context, FreeFunc freeContext);
+
+/**
+ * fill stats with the operation counters and the shape of the tree. The shape is computed by a
+ * walk over all the nodes, so the running time is O(n).
+ * @param tree: the tree.
+ * @param stats: where to write the statistics.
+ * @return: 0 on failure, other on success.
+ */
+int getRBTreeStats(const RBTree *tree, RBTreeStats *stats);
+
+/**
+ * set all the operation counters of the tree to 0.
+ * @param tree: the tree.
+ */
+void resetRBTreeCounters(RBTree *tree);
+
 
 #endif //RBTREE_RBTREE_H
\ No newline at end of file
@@ -0,0 +1,467 @@
+/**
+* @file Replay.c
+* @author Aviel Shtern Aviel.Shtern@mail.huji.ac.il
+* @version 1.0
+* @date 3 jun 2020
+* @brief Replays a trace of tree calls (see TraceRBTree.h) against a tree of the given
+* configuration, in the order of the trace and as fast as it can, and reports the throughput and
+* the latency percentiles of each call. The keys of the trace are read as longs (8 bytes in the
+* byte order of the machine) or as strings (their characters). Every latency includes one read of
+* the clock.
+* usage: replay trace [--keys long|string] [--policy rb|avl|wavl|treap] [--pool] [--finger]
+* [--filter] [--index]
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include "RBTree.h"
+#include "Structs.h"
+#include "TraceRBTree.h"
+
+/**
+ *@def NANO_IN_SEC 1e9
+ *@brief Nanoseconds in one second.
+ */
+#define NANO_IN_SEC 1e9
+
+/**
+ *@def NUM_PERCENTILES 4
+ *@brief The number of latency percentiles that are reported.
+ */
+#define NUM_PERCENTILES 4
+
+/**
+ *@def NUM_POLICIES 4
+ *@brief The number of balancing policies.
+ */
+#define NUM_POLICIES 4
+
+/**
+ * The percentiles that are reported.
+ */
+static const double percentiles[NUM_PERCENTILES] = {50, 90, 99, 99.9};
+
+/**
+ * The names of the calls, in the order of TraceOp.
+ */
+static const char *opNames[NUM_TRACE_OPS] = {"insert", "delete", "contains", "find", "popMin",
+											 "popMax", "deleteRange", "forEach", "forEachFrom"};
+
+/**
+ * The names of the balancing policies, in the order of BalancePolicy.
+ */
+static const char *policyNames[NUM_POLICIES] = {"rb", "avl", "wavl", "treap"};
+
+/**
+ * The configuration of the tree that the trace is replayed against.
+ */
+typedef struct ReplayConfig
+{
+	const char *path;
+	int stringKeys; // if not 0 the keys are strings, otherwise longs
+	BalancePolicy policy;
+	int pool, finger, filter, index;
+} ReplayConfig;
+
+/**
+ * The keys of a trace, made from the bytes of its records.
+ * keys[i] and keys2[i] are the keys of record i (NULL if it has none).
+ */
+typedef struct ReplayKeys
+{
+	void **keys;
+	void **keys2;
+	void *block; // all the keys, in one allocation
+} ReplayKeys;
+
+/**
+ * reads the command line
+ * @param argc the number of arguments
+ * @param argv the arguments
+ * @param config set to the configuration
+ * @return 0 if the command line is wrong, other on success
+ */
+int parseArgs(int argc, char *argv[], ReplayConfig *config);
+
+/**
+ * makes the keys of all the records of a trace
+ * @param trace the trace
+ * @param stringKeys if not 0 the keys are strings, otherwise longs
+ * @param keys set to the keys
+ * @return 0 on failure (an allocation, or a long key that is not 8 bytes), other on success
+ */
+int makeKeys(const Trace *trace, int stringKeys, ReplayKeys *keys);
+
+/**
+ * frees the keys that makeKeys made
+ * @param keys the keys
+ */
+void freeKeys(ReplayKeys *keys);
+
+/**
+ * makes an empty tree of the configuration
+ * @param config the configuration
+ * @return the tree, NULL on failure
+ */
+RBTree *newReplayTree(const ReplayConfig *config);
+
+/**
+ * runs one call of the trace on the tree
+ * @param tree the tree
+ * @param op the call
+ * @param key the key of the call (may be NULL)
+ * @param key2 the second key of the call (may be NULL)
+ * @param count the limit of the call
+ */
+void runCall(RBTree *tree, TraceOp op, void *key, void *key2, long unsigned count);
+
+/**
+ * prints the count and the latency percentiles of one call
+ * @param name the name of the call
+ * @param latencies the latencies of all its runs, in nanoseconds (they are sorted)
+ * @param n the number of runs
+ */
+void reportLatencies(const char *name, long unsigned *latencies, long unsigned n);
+
+/**
+ * @return the current time in nanoseconds, from a monotonic clock
+ */
+long unsigned nowNs();
+
+/**
+ * the keys are owned by the replay, not by the tree.
+ */
+void freeNothing(void *data);
+
+/**
+ * CompFunc for long keys
+ */
+int longCompare(const void *a, const void *b);
+
+/**
+ * HashFunc for long keys
+ */
+long unsigned longHash(const void *a);
+
+/**
+ * compares two latencies, for qsort
+ */
+int compareLatencies(const void *a, const void *b);
+
+/**
+ * forEach function that does nothing, the scans of the trace only walk the tree
+ */
+int touchItem(const void *object, void *args);
+
+int parseArgs(int argc, char *argv[], ReplayConfig *config)
+{
+	memset(config, 0, sizeof(ReplayConfig));
+	config->policy = RB_POLICY;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--keys") == 0 && i + 1 < argc)
+		{
+			config->stringKeys = strcmp(argv[++i], "string") == 0;
+			if (!config->stringKeys && strcmp(argv[i], "long") != 0)
+			{
+				return false;
+			}
+		}
+		else if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc)
+		{
+			i++;
+			int policy = 0;
+			while (policy < NUM_POLICIES && strcmp(argv[i], policyNames[policy]) != 0)
+			{
+				policy++;
+			}
+			if (policy == NUM_POLICIES)
+			{
+				return false;
+			}
+			config->policy = (BalancePolicy) policy;
+		}
+		else if (strcmp(argv[i], "--pool") == 0)
+		{
+			config->pool = true;
+		}
+		else if (strcmp(argv[i], "--finger") == 0)
+		{
+			config->finger = true;
+		}
+		else if (strcmp(argv[i], "--filter") == 0)
+		{
+			config->filter = true;
+		}
+		else if (strcmp(argv[i], "--index") == 0)
+		{
+			config->index = true;
+		}
+		else if (config->path == NULL && argv[i][0] != '-')
+		{
+			config->path = argv[i];
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return config->path != NULL;
+}
+
+int makeKeys(const Trace *trace, int stringKeys, ReplayKeys *keys)
+{
+	long unsigned bytes = 0;
+	for (long unsigned i = 0; i < trace->count; i++)
+	{
+		const TraceRecord *record = &trace->records[i];
+		if (!stringKeys && ((record->key != NULL && record->keyLen != sizeof(long)) ||
+							(record->key2 != NULL && record->key2Len != sizeof(long))))
+		{
+			return false;
+		}
+		// a string gets a '\0', a long is 8 bytes and keeps them aligned
+		bytes += stringKeys ? record->keyLen + record->key2Len + 2 : 2 * sizeof(long);
+	}
+	keys->keys = (void **) calloc(trace->count + 1, sizeof(void *));
+	keys->keys2 = (void **) calloc(trace->count + 1, sizeof(void *));
+	keys->block = malloc(bytes + 1);
+	if (keys->keys == NULL || keys->keys2 == NULL || keys->block == NULL)
+	{
+		freeKeys(keys);
+		return false;
+	}
+	char *cursor = (char *) keys->block;
+	for (long unsigned i = 0; i < trace->count; i++)
+	{
+		const TraceRecord *record = &trace->records[i];
+		const unsigned char *bytesOf[2] = {record->key, record->key2};
+		long unsigned lengths[2] = {record->keyLen, record->key2Len};
+		void **out[2] = {&keys->keys[i], &keys->keys2[i]};
+		for (int k = 0; k < 2; k++)
+		{
+			if (bytesOf[k] == NULL)
+			{
+				continue;
+			}
+			memcpy(cursor, bytesOf[k], lengths[k]);
+			*out[k] = cursor;
+			if (stringKeys)
+			{
+				cursor[lengths[k]] = '\0';
+				cursor += lengths[k] + 1;
+			}
+			else
+			{
+				cursor += sizeof(long);
+			}
+		}
+	}
+	return true;
+}
+
+void freeKeys(ReplayKeys *keys)
+{
+	free(keys->keys);
+	free(keys->keys2);
+	free(keys->block);
+	memset(keys, 0, sizeof(ReplayKeys));
+}
+
+RBTree *newReplayTree(const ReplayConfig *config)
+{
+	RBTree *tree = newRBTreeWithPolicy(config->stringKeys ? stringCompare : longCompare,
+									   freeNothing, config->policy);
+	if (tree == NULL)
+	{
+		return NULL;
+	}
+	setNodePool(tree, config->pool);
+	setFingerSearch(tree, config->finger);
+	HashFunc hash = config->stringKeys ? stringHash : longHash;
+	if ((config->filter && !setRBTreeFilter(tree, hash)) ||
+		(config->index && !setRBTreeHashIndex(tree, hash)))
+	{
+		freeRBTree(&tree);
+		return NULL;
+	}
+	return tree;
+}
+
+void runCall(RBTree *tree, TraceOp op, void *key, void *key2, long unsigned count)
+{
+	switch (op)
+	{
+		case TRACE_INSERT:
+			insertToRBTree(tree, key);
+			break;
+		case TRACE_DELETE:
+			deleteFromRBTree(tree, key);
+			break;
+		case TRACE_CONTAINS:
+			RBTreeContains(tree, key);
+			break;
+		case TRACE_FIND:
+			RBTreeFind(tree, key);
+			break;
+		case TRACE_POP_MIN:
+			popMinFromRBTree(tree);
+			break;
+		case TRACE_POP_MAX:
+			popMaxFromRBTree(tree);
+			break;
+		case TRACE_DELETE_RANGE:
+			deleteRangeFromRBTree(tree, key, key2);
+			break;
+		case TRACE_FOR_EACH:
+			forEachRBTree(tree, touchItem, NULL);
+			break;
+		case TRACE_FOR_EACH_FROM:
+			forEachFromRBTree(tree, key, touchItem, NULL, count);
+			break;
+		default:
+			break;
+	}
+}
+
+void reportLatencies(const char *name, long unsigned *latencies, long unsigned n)
+{
+	if (n == 0)
+	{
+		return;
+	}
+	qsort(latencies, n, sizeof(long unsigned), compareLatencies);
+	double sum = 0;
+	for (long unsigned i = 0; i < n; i++)
+	{
+		sum += (double) latencies[i];
+	}
+	printf("%-12s %10lu %10.1f", name, n, sum / n);
+	for (int i = 0; i < NUM_PERCENTILES; i++)
+	{
+		long unsigned rank = (long unsigned) (percentiles[i] / 100 * (n - 1) + 0.5);
+		printf(" %10lu", latencies[rank]);
+	}
+	printf(" %10lu\n", latencies[n - 1]);
+}
+
+long unsigned nowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long unsigned) ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void freeNothing(void *data)
+{
+	(void) data;
+}
+
+int longCompare(const void *a, const void *b)
+{
+	long first = *(const long *) a;
+	long second = *(const long *) b;
+	return (first > second) - (first < second);
+}
+
+long unsigned longHash(const void *a)
+{
+	return (long unsigned) *(const long *) a;
+}
+
+int compareLatencies(const void *a, const void *b)
+{
+	long unsigned first = *(const long unsigned *) a;
+	long unsigned second = *(const long unsigned *) b;
+	return (first > second) - (first < second);
+}
+
+int touchItem(const void *object, void *args)
+{
+	(void) object;
+	(void) args;
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	ReplayConfig config;
+	if (!parseArgs(argc, argv, &config))
+	{
+		fprintf(stderr, "usage: %s trace [--keys long|string] [--policy rb|avl|wavl|treap] "
+						"[--pool] [--finger] [--filter] [--index]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	Trace *trace = loadTrace(config.path);
+	if (trace == NULL)
+	{
+		fprintf(stderr, "can not read the trace %s\n", config.path);
+		return EXIT_FAILURE;
+	}
+	ReplayKeys keys = {NULL, NULL, NULL};
+	RBTree *tree = NULL;
+	long unsigned *latencies = (long unsigned *) malloc((trace->count + 1) * sizeof(long unsigned));
+	if (latencies == NULL || !makeKeys(trace, config.stringKeys, &keys) ||
+		(tree = newReplayTree(&config)) == NULL)
+	{
+		fprintf(stderr, "can not make the keys or the tree (allocation, or not %s keys)\n",
+				config.stringKeys ? "string" : "long");
+		free(latencies);
+		freeKeys(&keys);
+		freeTrace(&trace);
+		return EXIT_FAILURE;
+	}
+
+	long unsigned start = nowNs();
+	long unsigned last = start;
+	for (long unsigned i = 0; i < trace->count; i++)
+	{
+		const TraceRecord *record = &trace->records[i];
+		runCall(tree, record->op, keys.keys[i], keys.keys2[i], record->count);
+		long unsigned end = nowNs();
+		latencies[i] = end - last;
+		last = end;
+	}
+	double seconds = (last - start) / NANO_IN_SEC;
+
+	printf("%s: %lu calls in %.3f s, %.0f calls/s, final size %lu (policy %s%s%s%s%s)\n",
+		   config.path, trace->count, seconds, trace->count / (seconds > 0 ? seconds : 1),
+		   tree->size, policyNames[config.policy], config.pool ? ", pool" : "",
+		   config.finger ? ", finger" : "", config.filter ? ", filter" : "",
+		   config.index ? ", index" : "");
+	printf("%-12s %10s %10s", "call (ns)", "count", "mean");
+	for (int i = 0; i < NUM_PERCENTILES; i++)
+	{
+		char label[NUM_PERCENTILES * 4];
+		snprintf(label, sizeof(label), "p%g", percentiles[i]);
+		printf(" %10s", label);
+	}
+	printf(" %10s\n", "max");
+	// the latencies of one call at a time
+	long unsigned *byOp = (long unsigned *) malloc((trace->count + 1) * sizeof(long unsigned));
+	for (int op = 0; op < NUM_TRACE_OPS && byOp != NULL; op++)
+	{
+		long unsigned n = 0;
+		for (long unsigned i = 0; i < trace->count; i++)
+		{
+			if (trace->records[i].op == (TraceOp) op)
+			{
+				byOp[n++] = latencies[i];
+			}
+		}
+		reportLatencies(opNames[op], byOp, n);
+	}
+	reportLatencies("all", latencies, trace->count);
+
+	free(byOp);
+	free(latencies);
+	freeRBTree(&tree);
+	freeKeys(&keys);
+	freeTrace(&trace);
+	return EXIT_SUCCESS;
+}
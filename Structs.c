@@ -6,10 +6,57 @@
 * @brief A Library that realizes binary tree uses. Vectors and strings.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include "Structs.h"
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <float.h>
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(VECTOR_NO_SIMD)
+/**
+ *@def VECTOR_SIMD
+ *@brief Defined when the vector kernels have SSE2, AVX2 and AVX-512 versions, that are chosen
+ * in runtime by the features of the cpu. Compile with -DVECTOR_NO_SIMD to use only the scalar
+ * versions.
+ */
+#define VECTOR_SIMD
+#include <immintrin.h>
+#endif
+
+/**
+ *@def SUM_LANES 8
+ *@brief The number of partial sums of sumOfSquares. Element i of the array is added to partial
+ * sum i % SUM_LANES, in the same order by every kernel, so they all give the same result. This
+ * order is not the order of calculateTheNormSquared, so the kernels are used only to compare norms
+ * whose sums are far apart (see sumsAreApart).
+ */
+#define SUM_LANES 8
+
+/*
+ * A multiplication and an addition fused to one FMA round once instead of twice, and so change the
+ * sums. The Makefile compiles this file with -ffp-contract=off, and the pragma and NO_FP_CONTRACT
+ * keep the contraction off for the compilers that get other flags.
+ */
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+/**
+ *@def NO_FP_CONTRACT
+ *@brief Keeps GCC from fusing a multiplication and an addition of a kernel to one FMA, even if the
+ * file is compiled with -ffp-contract=fast.
+ */
+#define NO_FP_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define NO_FP_CONTRACT
+#endif
 
 /**
  *@def LESS (-1)
@@ -33,12 +80,251 @@
 #define GREATER (1)
 
 /**
- * Calculates the norm (in squared!!!) of the vector
+ *@def NO_NORM_BOUND (-1.0)
+ *@brief A bound of a squared norm that every vector is above (a squared norm is never negative).
+ */
+#define NO_NORM_BOUND (-1.0)
+
+/**
+ *@def WRITE_BUFFER_SIZE (64 * 1024)
+ *@brief The size of the buffer writeStringTree writes through.
+ */
+#define WRITE_BUFFER_SIZE (64 * 1024)
+
+/**
+ *@def ARENA_CHUNK_SIZE (64 * 1024)
+ *@brief The size of a chunk of a string arena. Longer strings get a chunk of their own.
+ */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+/**
+ *@def FIRST_INTERN_CAPACITY 256
+ *@brief The first size of the table of the interned strings of an arena (a power of 2).
+ */
+#define FIRST_INTERN_CAPACITY 256
+
+/**
+ * A chunk of a string arena
+ */
+typedef struct ArenaChunk
+{
+	struct ArenaChunk *next;
+	char bytes[];
+} ArenaChunk;
+
+/**
+ * Owns the keys of a tree from newStringRBTree. The keys are copied to chunks, and the table
+ * (open addressing, linear probing) finds the copy of a key that was already interned.
+ */
+typedef struct StringArena
+{
+	ArenaChunk *chunks;
+	char *cursor;
+	long unsigned left;
+	const char **table;
+	long unsigned capacity, count;
+} StringArena;
+
+/**
+ * FreeFunc for StringArena
+ */
+void freeStringArena(void *pArena);
+
+/**
+ * hashes a string (FNV-1a)
+ * @param s the string
+ * @return the hash
+ */
+long unsigned hashString(const char *s);
+
+/**
+ * doubles the table of the interned strings of an arena
+ * @param arena the arena
+ * @return 0 on failure, other on success
+ */
+int growInternTable(StringArena *arena);
+
+/**
+ * Finds the copy of s in the arena, or copies s to the arena
+ * @param arena the arena
+ * @param s the string
+ * @return the copy of s in the arena, NULL on failure
+ */
+const char *internString(StringArena *arena, const char *s);
+
+/**
+ * The state of writeStringTree
+ */
+typedef struct StringWriter
+{
+	int fd;
+	char *buffer;
+	long unsigned used;
+} StringWriter;
+
+/**
+ * ForEach function that adds the length of word and \n to *pLength
+ * @param word - char*
+ * @param pLength - long unsigned*
+ * @return 0 on failure, other on success
+ */
+int addDumpLength(const void *word, void *pLength);
+
+/**
+ * ForEach function that copies word and \n to the cursor and moves the cursor after them
+ * @param word - char*
+ * @param pCursor - char**
+ * @return 0 on failure, other on success
+ */
+int copyToCursor(const void *word, void *pCursor);
+
+/**
+ * Writes all of a block to a file descriptor (write may write only a part of it)
+ * @param fd the file descriptor
+ * @param block the bytes to write
+ * @param len the number of bytes
+ * @return 0 on failure, other on success
+ */
+int writeAll(int fd, const char *block, long unsigned len);
+
+/**
+ * ForEach function that adds word and \n to the buffer of the writer, and writes the buffer when
+ * it is full. A word that is larger than the buffer is written directly.
+ * @param word - char*
+ * @param pWriter - StringWriter*
+ * @return 0 on failure, other on success
+ */
+int writeToBuffer(const void *word, void *pWriter);
+
+/**
+ * The state of findStringsWithPrefix
+ */
+typedef struct PrefixSearch
+{
+	const char *prefix;
+	long unsigned prefixLen;
+	const char **out;
+	long unsigned found;
+} PrefixSearch;
+
+/**
+ * ForEach function that adds word to the matches of the search if it starts with the prefix
+ * @param word - char*
+ * @param pSearch - PrefixSearch*
+ * @return 0 if word does not start with the prefix (so no later word does), other otherwise
+ */
+int addIfPrefixMatches(const void *word, void *pSearch);
+
+/**
+ * Calculates the norm (in squared!!!) of the vector, adding the squares one by one from the first,
+ * so it gives the same result on every machine.
  * @param pVector object with type Vector
  * @return the norm (in squared!!) of the vector
  */
 double calculateTheNormSquared(const Vector *pVector);
 
+/**
+ * Checks if two sums of squares of sumOfSquares are far enough apart that the sums of
+ * calculateTheNormSquared are in the same order. Each sum of n squares is at most about
+ * n * DBL_EPSILON / 2 of its value from the exact sum in any order of addition, so the two orders
+ * differ by at most n * DBL_EPSILON of it (and the bound takes a little more).
+ * @param first a sum of sumOfSquares
+ * @param firstLen the number of its squares
+ * @param second another sum of sumOfSquares
+ * @param secondLen the number of its squares
+ * @return true if they are finite and apart, false if calculateTheNormSquared must decide
+ */
+int sumsAreApart(double first, int firstLen, double second, int secondLen);
+
+/**
+ * pointer to a kernel that finds the first index in which two arrays of doubles are different,
+ * (one element is smaller than the other, so NaNs and 0.0 against -0.0 are not different).
+ * @param a first array
+ * @param b second array
+ * @param len the length of the arrays
+ * @return the first index in which the arrays are different, len if there is no such index
+ */
+typedef int (*FirstDifferenceFunc)(const double *a, const double *b, int len);
+
+/**
+ * pointer to a kernel that sums the squares of an array of doubles
+ * @param a the array
+ * @param len the length of the array
+ * @return the sum of the squares
+ */
+typedef double (*SumOfSquaresFunc)(const double *a, int len);
+
+/**
+ * The kernels the vector functions use, chosen by selectKernels on the first use.
+ */
+static FirstDifferenceFunc firstDifference = NULL;
+static SumOfSquaresFunc sumOfSquares = NULL;
+static pthread_once_t kernelsSelected = PTHREAD_ONCE_INIT;
+
+/**
+ * Chooses the best kernels for the cpu we run on. Called once, through kernelsSelected, since
+ * the first uses may come from several threads at once.
+ */
+void selectKernels();
+
+/**
+ * Adds the squares of an array to the partial sums of sumOfSquares, element i to lanes[i %
+ * SUM_LANES]
+ * @param lanes the SUM_LANES partial sums
+ * @param a the array, it starts at a multiple of SUM_LANES
+ * @param len the length of the array
+ */
+void addSquaresToLanes(double *lanes, const double *a, int len);
+
+/**
+ * Adds the partial sums of sumOfSquares, in the same order in every kernel
+ * @param lanes the SUM_LANES partial sums
+ * @return the sum
+ */
+double sumLanes(const double *lanes);
+
+/**
+ * FirstDifferenceFunc without SIMD
+ */
+int firstDifferenceScalar(const double *a, const double *b, int len);
+
+/**
+ * SumOfSquaresFunc without SIMD
+ */
+double sumOfSquaresScalar(const double *a, int len);
+
+#ifdef VECTOR_SIMD
+/**
+ * FirstDifferenceFunc with SSE2 (2 doubles in each step)
+ */
+int firstDifferenceSse2(const double *a, const double *b, int len);
+
+/**
+ * FirstDifferenceFunc with AVX2 (4 doubles in each step)
+ */
+int firstDifferenceAvx2(const double *a, const double *b, int len);
+
+/**
+ * FirstDifferenceFunc with AVX-512 (8 doubles in each step)
+ */
+int firstDifferenceAvx512(const double *a, const double *b, int len);
+
+/**
+ * SumOfSquaresFunc with SSE2 (each register holds 2 of the partial sums)
+ */
+double sumOfSquaresSse2(const double *a, int len);
+
+/**
+ * SumOfSquaresFunc with AVX2 (each register holds 4 of the partial sums)
+ */
+double sumOfSquaresAvx2(const double *a, int len);
+
+/**
+ * SumOfSquaresFunc with AVX-512 (one register holds the partial sums)
+ */
+double sumOfSquaresAvx512(const double *a, int len);
+#endif
+
 /**
  * receive two vectors and returns who has the larger norm
  * @param first object with type Vector
@@ -48,25 +334,221 @@ double calculateTheNormSquared(const Vector *pVector);
  */
 int compareNorm(const Vector *first, const Vector *second);
 
-int vectorCompare1By1(const void *a, const void *b)
+/**
+ * The state of the pass of getMaxNormVector over a tree that does not cache the norms.
+ * maxNorm is the sum of sumOfSquares of max, exactNorm its calculateTheNormSquared (negative until
+ * it is needed).
+ */
+typedef struct MaxNormSearch
 {
-	Vector *first = (Vector *) a;
-	Vector *second = (Vector *) b;
-	int range = (first->len < second->len) ? first->len : second->len;
-	for (int i = 0; i < range; i++)
+	const Vector *max;
+	double maxNorm;
+	double exactNorm;
+} MaxNormSearch;
+
+/**
+ * ForEach function that keeps a pointer to pVector if its norm is larger than the norm of the
+ * max vector found so far.
+ * @param pVector pointer to Vector
+ * @param pSearch pointer to MaxNormSearch
+ * @return 1 on success, 0 on failure
+ */
+int keepIfNormIsLarger(const void *pVector, void *pSearch);
+
+void selectKernels()
+{
+	FirstDifferenceFunc difference = firstDifferenceScalar;
+	SumOfSquaresFunc squares = sumOfSquaresScalar;
+#ifdef VECTOR_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+	{
+		difference = firstDifferenceAvx512;
+		squares = sumOfSquaresAvx512;
+	}
+	else if (__builtin_cpu_supports("avx2"))
+	{
+		difference = firstDifferenceAvx2;
+		squares = sumOfSquaresAvx2;
+	}
+	else if (__builtin_cpu_supports("sse2"))
 	{
-		if (first->vector[i] < second->vector[i])
+		difference = firstDifferenceSse2;
+		squares = sumOfSquaresSse2;
+	}
+#endif
+	firstDifference = difference;
+	sumOfSquares = squares;
+}
+
+int firstDifferenceScalar(const double *a, const double *b, int len)
+{
+	for (int i = 0; i < len; i++)
+	{
+		if (a[i] < b[i] || a[i] > b[i])
 		{
-			return LESS;
+			return i;
 		}
-		else if (first->vector[i] > second->vector[i])
+	}
+	return len;
+}
+
+NO_FP_CONTRACT
+void addSquaresToLanes(double *lanes, const double *a, int len)
+{
+	for (int i = 0; i < len; i++)
+	{
+		lanes[i % SUM_LANES] += a[i] * a[i];
+	}
+}
+
+double sumLanes(const double *lanes)
+{
+	return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+		   ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+double sumOfSquaresScalar(const double *a, int len)
+{
+	double lanes[SUM_LANES] = {0};
+	addSquaresToLanes(lanes, a, len);
+	return sumLanes(lanes);
+}
+
+#ifdef VECTOR_SIMD
+__attribute__((target("sse2")))
+int firstDifferenceSse2(const double *a, const double *b, int len)
+{
+	int i = 0;
+	for (; i + 2 <= len; i += 2)
+	{
+		__m128d x = _mm_loadu_pd(a + i);
+		__m128d y = _mm_loadu_pd(b + i);
+		// cmplt and cmpgt are false for NaNs, like the < and > of the scalar version
+		int mask = _mm_movemask_pd(_mm_or_pd(_mm_cmplt_pd(x, y), _mm_cmpgt_pd(x, y)));
+		if (mask != 0)
 		{
-			return GREATER;
+			return i + __builtin_ctz(mask);
 		}
 	}
+	return i + firstDifferenceScalar(a + i, b + i, len - i);
+}
+
+__attribute__((target("avx2")))
+int firstDifferenceAvx2(const double *a, const double *b, int len)
+{
+	int i = 0;
+	for (; i + 4 <= len; i += 4)
+	{
+		__m256d x = _mm256_loadu_pd(a + i);
+		__m256d y = _mm256_loadu_pd(b + i);
+		int mask = _mm256_movemask_pd(_mm256_cmp_pd(x, y, _CMP_NEQ_OQ)); // ordered, so no NaNs
+		if (mask != 0)
+		{
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return i + firstDifferenceScalar(a + i, b + i, len - i);
+}
+
+__attribute__((target("avx512f")))
+int firstDifferenceAvx512(const double *a, const double *b, int len)
+{
+	int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		__m512d x = _mm512_loadu_pd(a + i);
+		__m512d y = _mm512_loadu_pd(b + i);
+		__mmask8 mask = _mm512_cmp_pd_mask(x, y, _CMP_NEQ_OQ);
+		if (mask != 0)
+		{
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return i + firstDifferenceScalar(a + i, b + i, len - i);
+}
+
+__attribute__((target("sse2"))) NO_FP_CONTRACT
+double sumOfSquaresSse2(const double *a, int len)
+{
+	__m128d acc0 = _mm_setzero_pd();
+	__m128d acc1 = _mm_setzero_pd();
+	__m128d acc2 = _mm_setzero_pd();
+	__m128d acc3 = _mm_setzero_pd();
+	int i = 0;
+	for (; i + SUM_LANES <= len; i += SUM_LANES)
+	{
+		__m128d x0 = _mm_loadu_pd(a + i);
+		__m128d x1 = _mm_loadu_pd(a + i + 2);
+		__m128d x2 = _mm_loadu_pd(a + i + 4);
+		__m128d x3 = _mm_loadu_pd(a + i + 6);
+		acc0 = _mm_add_pd(acc0, _mm_mul_pd(x0, x0));
+		acc1 = _mm_add_pd(acc1, _mm_mul_pd(x1, x1));
+		acc2 = _mm_add_pd(acc2, _mm_mul_pd(x2, x2));
+		acc3 = _mm_add_pd(acc3, _mm_mul_pd(x3, x3));
+	}
+	double lanes[SUM_LANES];
+	_mm_storeu_pd(lanes, acc0);
+	_mm_storeu_pd(lanes + 2, acc1);
+	_mm_storeu_pd(lanes + 4, acc2);
+	_mm_storeu_pd(lanes + 6, acc3);
+	addSquaresToLanes(lanes, a + i, len - i);
+	return sumLanes(lanes);
+}
+
+__attribute__((target("avx2"))) NO_FP_CONTRACT
+double sumOfSquaresAvx2(const double *a, int len)
+{
+	__m256d acc0 = _mm256_setzero_pd();
+	__m256d acc1 = _mm256_setzero_pd();
+	int i = 0;
+	for (; i + SUM_LANES <= len; i += SUM_LANES)
+	{
+		__m256d x0 = _mm256_loadu_pd(a + i);
+		__m256d x1 = _mm256_loadu_pd(a + i + 4);
+		acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(x0, x0));
+		acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(x1, x1));
+	}
+	double lanes[SUM_LANES];
+	_mm256_storeu_pd(lanes, acc0);
+	_mm256_storeu_pd(lanes + 4, acc1);
+	addSquaresToLanes(lanes, a + i, len - i);
+	return sumLanes(lanes);
+}
+
+__attribute__((target("avx512f"))) NO_FP_CONTRACT
+double sumOfSquaresAvx512(const double *a, int len)
+{
+	// AVX-512 has FMA, so the multiplication and the addition are kept apart on purpose
+	__m512d acc = _mm512_setzero_pd();
+	int i = 0;
+	for (; i + SUM_LANES <= len; i += SUM_LANES)
+	{
+		__m512d x = _mm512_loadu_pd(a + i);
+		acc = _mm512_add_pd(acc, _mm512_mul_pd(x, x));
+	}
+	double lanes[SUM_LANES];
+	_mm512_storeu_pd(lanes, acc);
+	addSquaresToLanes(lanes, a + i, len - i);
+	return sumLanes(lanes);
+}
+#endif
+
+int vectorCompare1By1(const void *a, const void *b)
+{
+	Vector *first = (Vector *) a;
+	Vector *second = (Vector *) b;
+	int range = (first->len < second->len) ? first->len : second->len;
+	pthread_once(&kernelsSelected, selectKernels);
+	int i = firstDifference(first->vector, second->vector, range);
+	if (i < range)
+	{
+		return (first->vector[i] < second->vector[i]) ? LESS : GREATER;
+	}
 	return first->len - second->len; // in this case Whoever is longer is bound to be the bigger one
 }
 
+NO_FP_CONTRACT
 double calculateTheNormSquared(const Vector *pVector)
 {
 	double normVec = 0;
@@ -77,10 +559,28 @@ double calculateTheNormSquared(const Vector *pVector)
 	return normVec;
 }
 
+int sumsAreApart(double first, int firstLen, double second, int secondLen)
+{
+	if (!isfinite(first) || !isfinite(second))
+	{
+		return false;
+	}
+	double firstError = first * ((double) firstLen + 2) * DBL_EPSILON;
+	double secondError = second * ((double) secondLen + 2) * DBL_EPSILON;
+	double gap = (first > second) ? first - second : second - first;
+	return gap > firstError + secondError;
+}
+
 int compareNorm(const Vector *first, const Vector *second)
 {
-	double normOfFirst = calculateTheNormSquared(first);
-	double normOfSecond = calculateTheNormSquared(second);
+	pthread_once(&kernelsSelected, selectKernels);
+	double normOfFirst = sumOfSquares(first->vector, first->len);
+	double normOfSecond = sumOfSquares(second->vector, second->len);
+	if (!sumsAreApart(normOfFirst, first->len, normOfSecond, second->len))
+	{
+		normOfFirst = calculateTheNormSquared(first);
+		normOfSecond = calculateTheNormSquared(second);
+	}
 	if (normOfFirst > normOfSecond)
 	{
 		return GREATER;
@@ -102,10 +602,18 @@ int copyIfNormIsLarger(const void *pVector, void *pMaxVector)
 	}
 	else if (maxVector->vector == NULL || compareNorm(curVec, maxVector) == GREATER)
 	{
-		maxVector->vector = (double *) realloc(maxVector->vector, (curVec->len) * sizeof(double));
-		if (maxVector->vector == NULL)
+		if (maxVector->vector == maxVector->data && curVec->len > maxVector->len)
 		{
-			return false;
+			maxVector->vector = NULL; // the inline coordinates are too short, move to a buffer
+		}
+		if (maxVector->vector != maxVector->data)
+		{
+			maxVector->vector = (double *) realloc(maxVector->vector,
+												   (curVec->len) * sizeof(double));
+			if (maxVector->vector == NULL)
+			{
+				return false;
+			}
 		}
 		memcpy(maxVector->vector, curVec->vector, curVec->len * sizeof(double)); // deep copy
 		maxVector->len = curVec->len; // we copy just the field "vector" in memcpy function
@@ -124,11 +632,124 @@ Vector *findMaxNormVectorInTree(RBTree *tree)
 	{
 		return NULL;
 	}
+	if (tree->valueFunc == vectorNormSquared) // the max is known, copy only it
+	{
+		const Vector *max = getMaxNormVector(tree);
+		if (max != NULL)
+		{
+			copyIfNormIsLarger(max, pMaxVector);
+		}
+		return pMaxVector;
+	}
 	forEachRBTree(tree, copyIfNormIsLarger, pMaxVector);
 	return pMaxVector;
 
 }
 
+double vectorNormSquared(const void *pVector)
+{
+	return calculateTheNormSquared((const Vector *) pVector);
+}
+
+RBTree *newVectorRBTree()
+{
+	return newAugmentedRBTree(vectorCompare1By1, freeVector, vectorNormSquared);
+}
+
+int keepIfNormIsLarger(const void *pVector, void *pSearch)
+{
+	const Vector *curVec = (const Vector *) pVector;
+	MaxNormSearch *search = (MaxNormSearch *) pSearch;
+	if (curVec == NULL || search == NULL || curVec->vector == NULL)
+	{
+		return false;
+	}
+	pthread_once(&kernelsSelected, selectKernels);
+	double norm = sumOfSquares(curVec->vector, curVec->len);
+	int apart = search->max != NULL &&
+				sumsAreApart(norm, curVec->len, search->maxNorm, search->max->len);
+	if (search->max == NULL || (apart && norm > search->maxNorm))
+	{
+		search->max = curVec;
+		search->maxNorm = norm;
+		search->exactNorm = -1;
+	}
+	else if (!apart)
+	{
+		if (search->exactNorm < 0)
+		{
+			search->exactNorm = calculateTheNormSquared(search->max);
+		}
+		double exactNorm = calculateTheNormSquared(curVec);
+		if (exactNorm > search->exactNorm)
+		{
+			search->max = curVec;
+			search->maxNorm = norm;
+			search->exactNorm = exactNorm;
+		}
+	}
+	return true;
+}
+
+const Vector *getMaxNormVector(const RBTree *tree)
+{
+	if (tree == NULL)
+	{
+		return NULL;
+	}
+	if (tree->valueFunc == vectorNormSquared)
+	{
+		return (const Vector *) findMaxValueInRBTree(tree);
+	}
+	MaxNormSearch search = {NULL, 0, -1};
+	forEachRBTree(tree, keepIfNormIsLarger, &search);
+	return search.max;
+}
+
+long unsigned findTopKNormVectors(const RBTree *tree, long unsigned k, const Vector **out,
+								  int threads)
+{
+	if (tree == NULL || tree->valueFunc != vectorNormSquared)
+	{
+		return 0;
+	}
+	return findTopKByValueInRBTree(tree, k, (void **) out, threads);
+}
+
+int forEachVectorAboveNorm(const RBTree *tree, double norm, forEachFunc func, void *args)
+{
+	if (tree == NULL || tree->valueFunc != vectorNormSquared)
+	{
+		return false;
+	}
+	double bound = (norm < 0) ? NO_NORM_BOUND : norm * norm;
+	return forEachValueAboveRBTree(tree, bound, func, args);
+}
+
+Vector *newVector(int len, const double *values)
+{
+	if (len < 0)
+	{
+		return NULL;
+	}
+	Vector *pVector = (Vector *) malloc(sizeof(Vector) + len * sizeof(double));
+	if (pVector == NULL)
+	{
+		return NULL;
+	}
+	pVector->len = len;
+	pVector->vector = pVector->data;
+	if (values != NULL)
+	{
+		memcpy(pVector->data, values, len * sizeof(double));
+	}
+	else
+	{
+		memset(pVector->data, 0, len * sizeof(double));
+	}
+	return pVector;
+}
+
 void freeVector(void *pVector)
 {
 	if (pVector == NULL)
@@ -136,11 +757,163 @@ void freeVector(void *pVector)
 		return;
 	}
 	Vector *vector = (Vector *) pVector;
-	free(vector->vector);
+	if (vector->vector != vector->data) // the coordinates of vectors from newVector are inline
+	{
+		free(vector->vector);
+	}
 	vector->vector = NULL;
 	free(vector);
 }
 
+void freeStringArena(void *pArena)
+{
+	StringArena *arena = (StringArena *) pArena;
+	if (arena == NULL)
+	{
+		return;
+	}
+	while (arena->chunks != NULL)
+	{
+		ArenaChunk *next = arena->chunks->next;
+		free(arena->chunks);
+		arena->chunks = next;
+	}
+	free(arena->table);
+	free(arena);
+}
+
+long unsigned hashString(const char *s)
+{
+	long unsigned hash = 14695981039346656037UL;
+	for (; *s != '\0'; s++)
+	{
+		hash = (hash ^ (unsigned char) *s) * 1099511628211UL;
+	}
+	return hash;
+}
+
+int growInternTable(StringArena *arena)
+{
+	long unsigned capacity = (arena->capacity == 0) ? FIRST_INTERN_CAPACITY : 2 * arena->capacity;
+	const char **table = (const char **) calloc(capacity, sizeof(const char *));
+	if (table == NULL)
+	{
+		return false;
+	}
+	for (long unsigned i = 0; i < arena->capacity; i++)
+	{
+		if (arena->table[i] != NULL)
+		{
+			long unsigned j = hashString(arena->table[i]) & (capacity - 1);
+			while (table[j] != NULL)
+			{
+				j = (j + 1) & (capacity - 1);
+			}
+			table[j] = arena->table[i];
+		}
+	}
+	free(arena->table);
+	arena->table = table;
+	arena->capacity = capacity;
+	return true;
+}
+
+const char *internString(StringArena *arena, const char *s)
+{
+	if (2 * (arena->count + 1) > arena->capacity && !growInternTable(arena))
+	{
+		return NULL;
+	}
+	long unsigned i = hashString(s) & (arena->capacity - 1);
+	while (arena->table[i] != NULL)
+	{
+		if (strcmp(arena->table[i], s) == 0)
+		{
+			return arena->table[i];
+		}
+		i = (i + 1) & (arena->capacity - 1);
+	}
+	long unsigned size = strlen(s) + 1;
+	if (size > arena->left)
+	{
+		long unsigned chunkSize = (size > ARENA_CHUNK_SIZE) ? size : ARENA_CHUNK_SIZE;
+		ArenaChunk *chunk = (ArenaChunk *) malloc(sizeof(ArenaChunk) + chunkSize);
+		if (chunk == NULL)
+		{
+			return NULL;
+		}
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->cursor = chunk->bytes;
+		arena->left = chunkSize;
+	}
+	char *copy = arena->cursor;
+	memcpy(copy, s, size);
+	arena->cursor += size;
+	arena->left -= size;
+	arena->table[i] = copy;
+	arena->count++;
+	return copy;
+}
+
+RBTree *newStringRBTree()
+{
+	RBTree *tree = newRBTree(stringCompare, NULL);
+	StringArena *arena = (StringArena *) calloc(1, sizeof(StringArena));
+	if (tree == NULL || arena == NULL)
+	{
+		freeRBTree(&tree);
+		free(arena);
+		return NULL;
+	}
+	setNodePool(tree, true);
+	setRBTreeContext(tree, arena, freeStringArena);
+	return tree;
+}
+
+int insertStringToRBTree(RBTree *tree, const char *s)
+{
+	if (tree == NULL || s == NULL || tree->freeContext != freeStringArena)
+	{
+		return false;
+	}
+	const char *copy = internString((StringArena *) tree->context, s);
+	if (copy == NULL)
+	{
+		return false;
+	}
+	return insertToRBTree(tree, (void *) copy);
+}
+
+RBTree *cloneStringRBTree(const RBTree *tree)
+{
+	if (tree == NULL || tree->freeContext != freeStringArena)
+	{
+		return NULL;
+	}
+	RBTree *clone = cloneRBTree(tree, NULL);
+	StringArena *arena = (StringArena *) calloc(1, sizeof(StringArena));
+	if (clone == NULL || arena == NULL)
+	{
+		freeRBTree(&clone);
+		free(arena);
+		return NULL;
+	}
+	setRBTreeContext(clone, arena, freeStringArena);
+	// the copies have the same bytes, so the order, the filter and the index stay valid
+	for (Node *node = clone->min; node != NULL; node = node->next)
+	{
+		const char *copy = internString(arena, (const char *) node->data);
+		if (copy == NULL)
+		{
+			freeRBTree(&clone);
+			return NULL;
+		}
+		node->data = (void *) copy;
+	}
+	return clone;
+}
+
 void freeString(void *s)
 {
 	free(s);
@@ -153,6 +926,139 @@ int stringCompare(const void *a, const void *b)
 	return strcmp(str1, str2);
 }
 
+long unsigned stringHash(const void *s)
+{
+	return hashString((const char *) s);
+}
+
+int addIfPrefixMatches(const void *word, void *pSearch)
+{
+	PrefixSearch *search = (PrefixSearch *) pSearch;
+	if (strncmp((const char *) word, search->prefix, search->prefixLen) != 0)
+	{
+		return false;
+	}
+	search->out[search->found++] = (const char *) word;
+	return true;
+}
+
+long unsigned findStringsWithPrefix(const RBTree *tree, const char *prefix, const char **out,
+									long unsigned limit)
+{
+	if (tree == NULL || prefix == NULL || out == NULL)
+	{
+		return 0;
+	}
+	PrefixSearch search = {prefix, strlen(prefix), out, 0};
+	// every string with the prefix is not smaller than it, and they come one after the other
+	return forEachFromRBTree(tree, prefix, addIfPrefixMatches, &search, limit);
+}
+
+int addDumpLength(const void *word, void *pLength)
+{
+	if (word == NULL)
+	{
+		return false;
+	}
+	*(long unsigned *) pLength += strlen((const char *) word) + 1;
+	return true;
+}
+
+long unsigned stringTreeDumpLength(const RBTree *tree)
+{
+	long unsigned length = 0;
+	if (!forEachRBTree(tree, addDumpLength, &length))
+	{
+		return 0;
+	}
+	return length;
+}
+
+int copyToCursor(const void *word, void *pCursor)
+{
+	char **cursor = (char **) pCursor;
+	long unsigned len = strlen((const char *) word);
+	memcpy(*cursor, word, len);
+	(*cursor)[len] = '\n';
+	*cursor += len + 1;
+	return true;
+}
+
+char *dumpStringTree(const RBTree *tree)
+{
+	if (tree == NULL)
+	{
+		return NULL;
+	}
+	char *dump = (char *) malloc(stringTreeDumpLength(tree) + 1);
+	if (dump == NULL)
+	{
+		return NULL;
+	}
+	char *cursor = dump;
+	forEachRBTree(tree, copyToCursor, &cursor);
+	*cursor = '\0';
+	return dump;
+}
+
+int writeAll(int fd, const char *block, long unsigned len)
+{
+	while (len > 0)
+	{
+		ssize_t written = write(fd, block, len);
+		if (written < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (written <= 0)
+		{
+			return false;
+		}
+		block += written;
+		len -= written;
+	}
+	return true;
+}
+
+int writeToBuffer(const void *word, void *pWriter)
+{
+	StringWriter *writer = (StringWriter *) pWriter;
+	long unsigned len = strlen((const char *) word);
+	if (writer->used + len + 1 > WRITE_BUFFER_SIZE)
+	{
+		if (!writeAll(writer->fd, writer->buffer, writer->used))
+		{
+			return false;
+		}
+		writer->used = 0;
+	}
+	if (len + 1 > WRITE_BUFFER_SIZE)
+	{
+		return writeAll(writer->fd, (const char *) word, len) && writeAll(writer->fd, "\n", 1);
+	}
+	memcpy(writer->buffer + writer->used, word, len);
+	writer->buffer[writer->used + len] = '\n';
+	writer->used += len + 1;
+	return true;
+}
+
+int writeStringTree(const RBTree *tree, int fd)
+{
+	if (tree == NULL || fd < 0)
+	{
+		return false;
+	}
+	StringWriter writer = {fd, (char *) malloc(WRITE_BUFFER_SIZE), 0};
+	if (writer.buffer == NULL)
+	{
+		return false;
+	}
+	int res = forEachRBTree(tree, writeToBuffer, &writer) &&
+			  writeAll(writer.fd, writer.buffer, writer.used);
+	free(writer.buffer);
+	return res;
+}
+
 int concatenate(const void *word, void *pConcatenated)
 {
 	char *src = (char *) word;
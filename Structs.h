@@ -8,14 +8,26 @@
 #define TA_EX3_STRUCTS_H
 
 /**
- * Represents a vector. The double* should be dynamically allocated
+ * Represents a vector. The double* should be dynamically allocated, or point to data when the
+ * vector was made by newVector (then the Vector and its coordinates are one block of memory).
  */
 typedef struct Vector
 {
 	int len;
 	double *vector;
+	double data[]; // used only by vectors from newVector
 } Vector;
 
+/**
+ * Allocates a vector and its coordinates in one block of memory (vector->vector == vector->data),
+ * so it costs one allocation and the coordinates are right after the header. Free it with
+ * freeVector.
+ * @param len the number of coordinates
+ * @param values the coordinates to copy, may be NULL to set all of them to 0.
+ * @return the new vector, NULL on failure.
+ */
+Vector *newVector(int len, const double *values);
+
 
 /**
  * CompFunc for strings (assumes strings end with "\0")
@@ -26,6 +38,26 @@ typedef struct Vector
  */
 int stringCompare(const void *a, const void *b); // implement it in Structs.c
 
+/**
+ * HashFunc for strings (FNV-1a), to turn on the Bloom filter of a string tree (setRBTreeFilter)
+ * @param s - char* pointer
+ * @return the hash of the string
+ */
+long unsigned stringHash(const void *s);
+
+/**
+ * Finds the strings of a tree of strings that start with a prefix, in lexicographic order (for
+ * autocomplete). The scan starts at the first string that is not smaller than the prefix and stops
+ * at the first one that does not start with it, so it costs O(logn + k) for k matches.
+ * @param tree a tree of char* (compared with stringCompare)
+ * @param prefix the prefix ("" matches every string)
+ * @param out array of (at least) limit pointers, filled with the matches (owned by the tree)
+ * @param limit the max number of matches to find
+ * @return the number of strings written to out, 0 on failure
+ */
+long unsigned findStringsWithPrefix(const RBTree *tree, const char *prefix, const char **out,
+									long unsigned limit);
+
 /**
  * ForEach function that concatenates the given word and \n to pConcatenated. pConcatenated is
  * already allocated with enough space.
@@ -35,6 +67,61 @@ int stringCompare(const void *a, const void *b); // implement it in Structs.c
  */
 int concatenate(const void *word, void *pConcatenated); // implement it in Structs.c
 
+/**
+ * Computes the length of the dump of a tree of strings: every string followed by \n, like a
+ * buffer filled by concatenate (without the final \0).
+ * @param tree a tree of char*
+ * @return the length of the dump, 0 for an empty tree or on failure
+ */
+long unsigned stringTreeDumpLength(const RBTree *tree);
+
+/**
+ * Dumps a tree of strings to a new buffer of the exact size. Every string is followed by \n,
+ * like concatenate, but the buffer is written through a cursor, so the running time is linear in
+ * the length of the dump (concatenate scans the whole buffer for every word).
+ * @param tree a tree of char*
+ * @return a new \0 terminated buffer (the caller frees it), NULL on failure
+ */
+char *dumpStringTree(const RBTree *tree);
+
+/**
+ * Writes the dump of a tree of strings (see dumpStringTree) to a file descriptor, through a large
+ * buffer, without building the whole dump in memory.
+ * @param tree a tree of char*
+ * @param fd an open file descriptor
+ * @return 0 on failure, other on success
+ */
+int writeStringTree(const RBTree *tree, int fd);
+
+/**
+ * constructs a new tree of strings that owns its keys in an arena: insertStringToRBTree copies
+ * every key once into large append only chunks (equal keys share one copy), and the nodes are
+ * allocated from a node pool. freeRBTree frees the chunks and does not visit the nodes, and the
+ * keys stay contiguous in memory.
+ * deleteFromRBTree removes the key from the tree, but its bytes stay in the arena until the tree
+ * is freed (they are reused if the key is inserted again).
+ * @return the new tree, NULL on failure.
+ */
+RBTree *newStringRBTree();
+
+/**
+ * Inserts a copy of a string to a tree from newStringRBTree. The copy is made in the arena of
+ * the tree, so the caller keeps the ownership of s.
+ * @param tree a tree from newStringRBTree
+ * @param s the string to insert
+ * @return 0 on failure (or if the string is already in the tree), other on success
+ */
+int insertStringToRBTree(RBTree *tree, const char *s);
+
+/**
+ * Copies a tree from newStringRBTree, with an arena of its own: the keys are copied once more, so
+ * the copy can be changed with insertStringToRBTree and outlives tree. (cloneRBTree does not copy
+ * the arena, so its copy of a string tree can not take new keys.)
+ * @param tree a tree from newStringRBTree
+ * @return the copy, NULL on failure
+ */
+RBTree *cloneStringRBTree(const RBTree *tree);
+
 /**
  * FreeFunc for strings
  */
@@ -71,5 +158,58 @@ int copyIfNormIsLarger(const void *pVector, void *pMaxVector); // implement it i
  */
 Vector *findMaxNormVectorInTree(RBTree *tree); // implement it in Structs.c You must use copyIfNormIsLarger in the implementation!
 
+/**
+ * ValueFunc for Vectors
+ * The squares are added one by one from the first, so the norms, and every answer that depends on
+ * them, are the same on every machine. The SIMD kernels add them in another order, so they only
+ * decide between norms that are too far apart for the order to matter, and the near ties are
+ * computed again one by one. Neither uses FMA: a fused multiply-add would be faster and a little
+ * more accurate, but the result would depend on the cpu.
+ * @param pVector - pointer to Vector
+ * @return the norm of the vector, squared
+ */
+double vectorNormSquared(const void *pVector);
+
+/**
+ * constructs a new tree of Vectors (compared with vectorCompare1By1 and freed with freeVector)
+ * that caches the squared norm of every vector and the max norm of every sub tree, so the vector
+ * with the largest norm is found in O(logn).
+ * @return the new tree, NULL on failure.
+ */
+RBTree *newVectorRBTree();
+
+/**
+ * Finds the vector that has the largest norm (L2 Norm), without copying it. On a tree from
+ * newVectorRBTree this is O(logn), on other trees of Vectors it is one pass over the tree.
+ * @param tree a pointer to a tree of Vectors
+ * @return pointer to the vector in the tree (owned by the tree), NULL if the tree is empty.
+ */
+const Vector *getMaxNormVector(const RBTree *tree);
+
+/**
+ * Finds the k vectors that have the largest norms, without copying them. Sub trees whose max norm
+ * can not be one of the k largest are skipped.
+ * @param tree a tree from newVectorRBTree
+ * @param k the number of vectors to find
+ * @param out array of (at least) k pointers, filled with the vectors (owned by the tree) from the
+ * largest norm to the smallest
+ * @param threads number of threads to search with (1 to search in the calling thread)
+ * @return the number of vectors written to out, 0 on failure or if the tree is not from
+ * newVectorRBTree.
+ */
+long unsigned findTopKNormVectors(const RBTree *tree, long unsigned k, const Vector **out,
+								  int threads);
+
+/**
+ * Activate a function on each vector whose norm is larger than norm, in the order of the tree.
+ * Sub trees whose max norm is not larger are skipped.
+ * @param tree a tree from newVectorRBTree
+ * @param norm the threshold (L2 Norm, not squared)
+ * @param func the function to activate on the vectors
+ * @param args more optional arguments to the function
+ * @return 0 on failure (or if the tree is not from newVectorRBTree), other on success.
+ */
+int forEachVectorAboveNorm(const RBTree *tree, double norm, forEachFunc func, void *args);
+
 
 #endif //TA_EX3_STRUCTS_H
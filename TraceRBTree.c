@@ -0,0 +1,392 @@
+/**
+* @file TraceRBTree.c
+* @author Aviel Shtern Aviel.Shtern@mail.huji.ac.il
+* @version 1.0
+* @date 3 jun 2020
+* @brief Records the calls of a Red Black Tree to a compact binary trace, and reads traces back,
+* so a real workload can be replayed against other configurations of the tree (see Replay.c).
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include "TraceRBTree.h"
+
+/**
+ *@def TRACE_MAGIC "RBTTRAC1"
+ *@brief The first bytes of a trace file.
+ */
+#define TRACE_MAGIC "RBTTRAC1"
+
+/**
+ *@def TRACE_MAGIC_SIZE 8
+ *@brief The size of TRACE_MAGIC, without the '\0'.
+ */
+#define TRACE_MAGIC_SIZE 8
+
+/**
+ *@def FIRST_KEY_CAPACITY 64
+ *@brief The size of the first buffer that the keys are serialized to.
+ */
+#define FIRST_KEY_CAPACITY 64
+
+/**
+ *@def FIRST_RECORDS 1024
+ *@brief The number of records that loadTrace allocates room for first.
+ */
+#define FIRST_RECORDS 1024
+
+/**
+ *@def READ_CHUNK (64 * 1024)
+ *@brief The number of bytes that loadTrace reads at once.
+ */
+#define READ_CHUNK (64 * 1024)
+
+/**
+ *@def VARINT_BITS 7
+ *@brief The number of bits of a number in each byte of a varint.
+ */
+#define VARINT_BITS 7
+
+/**
+ *@def VARINT_MORE 0x80
+ *@brief The bit of a varint byte that says more bytes follow.
+ */
+#define VARINT_MORE 0x80
+
+/**
+ * The time of a monotonic clock
+ * @return the time in nanoseconds
+ */
+long long unsigned traceClock();
+
+/**
+ * Writes a number as a varint
+ * @param file the file
+ * @param number the number
+ */
+void writeVarint(FILE *file, long long unsigned number);
+
+/**
+ * Reads a varint
+ * @param cursor the position in the bytes, moved after the varint
+ * @param end the end of the bytes
+ * @param number set to the number
+ * @return true on success, false if the bytes end in the middle of the varint
+ */
+int readVarint(const unsigned char **cursor, const unsigned char *end, long long unsigned *number);
+
+/**
+ * Serializes a key to the key buffer of the recorder, after the bytes that are already there
+ * @param recorder the recorder
+ * @param key the key
+ * @param offset where to write the key in the buffer
+ * @return the number of bytes of the key, 0 if it could not be serialized
+ */
+long unsigned serializeTraceKey(TraceRecorder *recorder, const void *key, long unsigned offset);
+
+/**
+ * Reads the length and the bytes of a key of a record
+ * @param cursor the position in the bytes, moved after the key
+ * @param end the end of the bytes
+ * @param key set to the bytes
+ * @param length set to the number of bytes
+ * @return true on success, false if the bytes end in the middle of the key
+ */
+int readTraceKey(const unsigned char **cursor, const unsigned char *end,
+				 const unsigned char **key, long unsigned *length);
+
+/**
+ * Reads a whole file
+ * @param path the path of the file
+ * @param size set to the number of bytes
+ * @return the bytes, NULL on failure
+ */
+unsigned char *readTraceFile(const char *path, long unsigned *size);
+
+/**
+ * Whether a call has a key (see TraceFunc)
+ * @param op the call
+ * @return true if it has one
+ */
+int traceOpHasKey(TraceOp op);
+
+long long unsigned traceClock()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long unsigned) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void writeVarint(FILE *file, long long unsigned number)
+{
+	while (number >= VARINT_MORE)
+	{
+		putc((int) (number & (VARINT_MORE - 1)) | VARINT_MORE, file);
+		number >>= VARINT_BITS;
+	}
+	putc((int) number, file);
+}
+
+int readVarint(const unsigned char **cursor, const unsigned char *end, long long unsigned *number)
+{
+	*number = 0;
+	for (int shift = 0; *cursor < end && shift < 64; shift += VARINT_BITS)
+	{
+		unsigned char byte = *(*cursor)++;
+		*number |= (long long unsigned) (byte & (VARINT_MORE - 1)) << shift;
+		if (!(byte & VARINT_MORE))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+int traceOpHasKey(TraceOp op)
+{
+	return op != TRACE_POP_MIN && op != TRACE_POP_MAX && op != TRACE_FOR_EACH;
+}
+
+long unsigned serializeTraceKey(TraceRecorder *recorder, const void *key, long unsigned offset)
+{
+	long unsigned room = recorder->keyCapacity - offset;
+	long unsigned length = recorder->serialize(key, recorder->key + offset, room);
+	if (length == 0 || length <= room)
+	{
+		return length;
+	}
+	unsigned char *bigger = (unsigned char *) realloc(recorder->key, offset + length);
+	if (bigger == NULL)
+	{
+		return 0;
+	}
+	recorder->key = bigger;
+	recorder->keyCapacity = offset + length;
+	return (recorder->serialize(key, recorder->key + offset, length) == length) ? length : 0;
+}
+
+void recordRBTreeCall(void *recorder, TraceOp op, const void *key, const void *key2,
+					  long unsigned count)
+{
+	TraceRecorder *trace = (TraceRecorder *) recorder;
+	if (trace->failed)
+	{
+		return; // the trace ends at the first call that could not be recorded
+	}
+	if ((traceOpHasKey(op) && key == NULL) || (op == TRACE_DELETE_RANGE && key2 == NULL))
+	{
+		trace->failed = true; // never passed to the SerializeFunc, and a record needs the key
+		return;
+	}
+	long long unsigned now = traceClock();
+	long unsigned keyLen = 0, key2Len = 0;
+	// the keys are serialized first, so a failure does not leave half a record in the file
+	if (traceOpHasKey(op))
+	{
+		keyLen = serializeTraceKey(trace, key, 0);
+		trace->failed = keyLen == 0;
+	}
+	if (op == TRACE_DELETE_RANGE && !trace->failed)
+	{
+		key2Len = serializeTraceKey(trace, key2, keyLen);
+		trace->failed = key2Len == 0;
+	}
+	if (trace->failed)
+	{
+		return;
+	}
+	putc(op, trace->file);
+	writeVarint(trace->file, now - trace->lastTime);
+	writeVarint(trace->file, count);
+	if (traceOpHasKey(op))
+	{
+		writeVarint(trace->file, keyLen);
+		fwrite(trace->key, 1, keyLen, trace->file);
+	}
+	if (op == TRACE_DELETE_RANGE)
+	{
+		writeVarint(trace->file, key2Len);
+		fwrite(trace->key + keyLen, 1, key2Len, trace->file);
+	}
+	trace->lastTime = now;
+	trace->records++;
+}
+
+TraceRecorder *startRBTreeTrace(RBTree *tree, const char *path, SerializeFunc serialize)
+{
+	if (tree == NULL || path == NULL || serialize == NULL)
+	{
+		return NULL;
+	}
+	TraceRecorder *recorder = (TraceRecorder *) calloc(1, sizeof(TraceRecorder));
+	if (recorder == NULL)
+	{
+		return NULL;
+	}
+	recorder->serialize = serialize;
+	recorder->key = (unsigned char *) malloc(FIRST_KEY_CAPACITY);
+	recorder->keyCapacity = FIRST_KEY_CAPACITY;
+	recorder->file = fopen(path, "wb");
+	if (recorder->key == NULL || recorder->file == NULL ||
+		fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_SIZE, recorder->file) != TRACE_MAGIC_SIZE)
+	{
+		if (recorder->file != NULL)
+		{
+			fclose(recorder->file);
+		}
+		free(recorder->key);
+		free(recorder);
+		return NULL;
+	}
+	recorder->lastTime = traceClock();
+	setRBTreeTracer(tree, recordRBTreeCall, recorder);
+	return recorder;
+}
+
+int stopRBTreeTrace(RBTree *tree, TraceRecorder **recorder)
+{
+	if (recorder == NULL || *recorder == NULL)
+	{
+		return false;
+	}
+	if (tree != NULL && tree->traceRecorder == *recorder)
+	{
+		setRBTreeTracer(tree, NULL, NULL);
+	}
+	int ok = !(*recorder)->failed && !ferror((*recorder)->file);
+	ok = (fclose((*recorder)->file) == 0) && ok;
+	free((*recorder)->key);
+	free(*recorder);
+	*recorder = NULL;
+	return ok;
+}
+
+unsigned char *readTraceFile(const char *path, long unsigned *size)
+{
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		return NULL;
+	}
+	unsigned char *bytes = NULL;
+	long unsigned capacity = 0;
+	*size = 0;
+	while (true)
+	{
+		if (*size + READ_CHUNK > capacity)
+		{
+			capacity = (capacity == 0) ? READ_CHUNK : 2 * capacity;
+			unsigned char *bigger = (unsigned char *) realloc(bytes, capacity);
+			if (bigger == NULL)
+			{
+				break;
+			}
+			bytes = bigger;
+		}
+		long unsigned got = fread(bytes + *size, 1, READ_CHUNK, file);
+		*size += got;
+		if (got < READ_CHUNK)
+		{
+			break;
+		}
+	}
+	int failed = ferror(file) || !feof(file);
+	fclose(file);
+	if (failed)
+	{
+		free(bytes);
+		return NULL;
+	}
+	return bytes;
+}
+
+int readTraceKey(const unsigned char **cursor, const unsigned char *end,
+				 const unsigned char **key, long unsigned *length)
+{
+	long long unsigned len;
+	if (!readVarint(cursor, end, &len) || len > (long long unsigned) (end - *cursor))
+	{
+		return false;
+	}
+	*key = *cursor;
+	*length = len;
+	*cursor += len;
+	return true;
+}
+
+Trace *loadTrace(const char *path)
+{
+	if (path == NULL)
+	{
+		return NULL;
+	}
+	Trace *trace = (Trace *) calloc(1, sizeof(Trace));
+	if (trace == NULL)
+	{
+		return NULL;
+	}
+	long unsigned size = 0;
+	trace->bytes = readTraceFile(path, &size);
+	if (trace->bytes == NULL || size < TRACE_MAGIC_SIZE ||
+		memcmp(trace->bytes, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0)
+	{
+		freeTrace(&trace);
+		return NULL;
+	}
+	const unsigned char *cursor = trace->bytes + TRACE_MAGIC_SIZE;
+	const unsigned char *end = trace->bytes + size;
+	long unsigned capacity = 0;
+	long long unsigned time = 0;
+	while (cursor < end)
+	{
+		if (trace->count == capacity)
+		{
+			capacity = (capacity == 0) ? FIRST_RECORDS : 2 * capacity;
+			TraceRecord *bigger = (TraceRecord *) realloc(trace->records,
+														  capacity * sizeof(TraceRecord));
+			if (bigger == NULL)
+			{
+				freeTrace(&trace);
+				return NULL;
+			}
+			trace->records = bigger;
+		}
+		TraceRecord *record = &trace->records[trace->count];
+		memset(record, 0, sizeof(TraceRecord));
+		long long unsigned delta, count;
+		unsigned char op = *cursor++;
+		int ok = op < NUM_TRACE_OPS && readVarint(&cursor, end, &delta) &&
+				 readVarint(&cursor, end, &count);
+		ok = ok && (!traceOpHasKey((TraceOp) op) ||
+					readTraceKey(&cursor, end, &record->key, &record->keyLen));
+		ok = ok && (op != TRACE_DELETE_RANGE ||
+					readTraceKey(&cursor, end, &record->key2, &record->key2Len));
+		if (!ok)
+		{
+			freeTrace(&trace);
+			return NULL;
+		}
+		time += delta;
+		record->op = (TraceOp) op;
+		record->time = time;
+		record->count = count;
+		trace->count++;
+	}
+	return trace;
+}
+
+void freeTrace(Trace **trace)
+{
+	if (trace == NULL || *trace == NULL)
+	{
+		return;
+	}
+	free((*trace)->bytes);
+	free((*trace)->records);
+	free(*trace);
+	*trace = NULL;
+}
@@ -0,0 +1,83 @@
+#ifndef RBTREE_TRACERBTREE_H
+#define RBTREE_TRACERBTREE_H
+
+#include <stdio.h>
+#include "RBTree.h"
+
+/**
+ * writes the traced calls of a tree to a file (see startRBTreeTrace). The records are buffered by
+ * the FILE, so recording a call costs a clock read and a copy of the key.
+ */
+typedef struct TraceRecorder
+{
+	FILE *file;
+	SerializeFunc serialize;
+	unsigned char *key; // where the keys are serialized to
+	long unsigned keyCapacity;
+	long long unsigned lastTime; // of the last record (or of the start), in nanoseconds
+	long unsigned records;
+	int failed; // if not 0, a record could not be written
+} TraceRecorder;
+
+/**
+ * one call of a loaded trace. The keys point into the bytes of the trace.
+ */
+typedef struct TraceRecord
+{
+	TraceOp op;
+	long long unsigned time; // nanoseconds from the start of the trace
+	long unsigned count; // the limit of TRACE_FOR_EACH_FROM
+	const unsigned char *key, *key2; // NULL if the call has none (see TraceFunc)
+	long unsigned keyLen, key2Len;
+} TraceRecord;
+
+/**
+ * a trace that was read from a file.
+ */
+typedef struct Trace
+{
+	unsigned char *bytes;
+	TraceRecord *records;
+	long unsigned count;
+} Trace;
+
+/**
+ * start recording the calls of a tree to a new trace file (see setRBTreeTracer for the calls).
+ * The file is: TRACE_MAGIC, then for every call its op (1 byte), the nanoseconds from the previous
+ * call, the count, and the length and bytes of each of its keys (the numbers are LEB128 varints).
+ * @param tree: the tree.
+ * @param path: the path of the trace, an existing file is replaced.
+ * @param serialize: writes the keys as bytes.
+ * @return: the recorder, NULL on failure.
+ */
+TraceRecorder *startRBTreeTrace(RBTree *tree, const char *path, SerializeFunc serialize);
+
+/**
+ * stop recording the calls of a tree, and close the trace.
+ * @param tree: the tree that is recorded.
+ * @param recorder: pointer to the recorder. It is freed and set to NULL.
+ * @return: 0 if a record could not be written, other on success.
+ */
+int stopRBTreeTrace(RBTree *tree, TraceRecorder **recorder);
+
+/**
+ * TraceFunc that writes a call to a trace (startRBTreeTrace sets it as the tracer of the tree).
+ * @param recorder: a TraceRecorder.
+ */
+void recordRBTreeCall(void *recorder, TraceOp op, const void *key, const void *key2,
+					  long unsigned count);
+
+/**
+ * read a whole trace file.
+ * @param path: the path of the trace.
+ * @return: the trace, NULL on failure (an I/O error, or the file is not a whole trace).
+ */
+Trace *loadTrace(const char *path);
+
+/**
+ * free a trace.
+ * @param trace: pointer to the trace. It is set to NULL.
+ */
+void freeTrace(Trace **trace);
+
+#endif //RBTREE_TRACERBTREE_H
@@ -0,0 +1,921 @@
+/**
+* @file TreeTest.c
+* @author Aviel Shtern Aviel.Shtern@mail.huji.ac.il
+* @version 1.0
+* @date 3 jun 2020
+* @brief A randomized test of RBTree.c. Each round builds a tree of long keys in one mode (a
+* balancing policy, with or without the finger, the node pool, compaction, the Bloom filter, the
+* hash index, lazy deletes and values), bulk loads it, and then inserts, deletes, pops, deletes
+* ranges, filters, purges and clones at random while it keeps the keys that should be in the tree
+* in an array. Every few operations the whole tree is checked: the rules of its policy, the
+* parents, the order links and min and max, the max values, the size and the tombstones, and a
+* lookup of every key against the array. At the end of a round every item must be freed exactly
+* once.
+* usage: tree_test [keys] [seed]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "RBTree.h"
+
+/**
+ *@def DEFAULT_KEYS 2000
+ *@brief The keys are 0..keys-1, if the number of keys is not given.
+ */
+#define DEFAULT_KEYS 2000
+
+/**
+ *@def OPS_PER_KEY 10
+ *@brief The number of random operations of a round, for each key.
+ */
+#define OPS_PER_KEY 10
+
+/**
+ *@def CHECK_EVERY 97
+ *@brief The whole tree is checked after every CHECK_EVERY operations.
+ */
+#define CHECK_EVERY 97
+
+/**
+ *@def RANGE_EVERY 211
+ *@brief A range of keys is deleted after every RANGE_EVERY operations.
+ */
+#define RANGE_EVERY 211
+
+/**
+ *@def CLONE_EVERY 1001
+ *@brief The tree is cloned and the clone is changed after every CLONE_EVERY operations.
+ */
+#define CLONE_EVERY 1001
+
+/**
+ *@def FILTER_EVERY 1999
+ *@brief The tree is filtered after every FILTER_EVERY operations.
+ */
+#define FILTER_EVERY 1999
+
+/**
+ *@def PURGE_EVERY 3001
+ *@brief The tombstones of a lazy tree are purged after every PURGE_EVERY operations.
+ */
+#define PURGE_EVERY 3001
+
+/**
+ *@def COMPACT_EVERY 13
+ *@brief A step of compaction runs after every COMPACT_EVERY operations, in the modes that compact.
+ */
+#define COMPACT_EVERY 13
+
+/**
+ *@def OP_KINDS 16
+ *@brief Out of OP_KINDS operations, INSERT_SHARE are inserts, DELETE_SHARE deletes and the rest
+ * pops.
+ */
+#define OP_KINDS 16
+
+/**
+ *@def INSERT_SHARE 8
+ *@brief Out of OP_KINDS operations, the number of inserts.
+ */
+#define INSERT_SHARE 8
+
+/**
+ *@def DELETE_SHARE 5
+ *@brief Out of OP_KINDS operations, the number of deletes.
+ */
+#define DELETE_SHARE 5
+
+/**
+ *@def SCAN_LIMIT 5
+ *@brief The number of items that forEachFromRBTree visits in the test.
+ */
+#define SCAN_LIMIT 5
+
+/**
+ *@def CLONE_OPS 20
+ *@brief The number of changes to a clone.
+ */
+#define CLONE_OPS 20
+
+/**
+ *@def TOP_K 10
+ *@brief The number of items that findTopKByValueInRBTree finds in the test.
+ */
+#define TOP_K 10
+
+/**
+ *@def VALUES 101
+ *@brief The values of the items are 0..VALUES-1, so many items have the same value.
+ */
+#define VALUES 101
+
+/**
+ *@def MAX_REPORTS 5
+ *@brief The number of errors of a round that are printed.
+ */
+#define MAX_REPORTS 5
+
+/**
+ * A mode of the tree that a round tests.
+ * compactBudget: the budget of each step of compaction, 0 not to compact.
+ * index: 0 for no hash index, 1 for a good hash, 2 for a hash with many collisions.
+ * lazyThreshold: the threshold of setRBTreeLazyDelete, 0 for no lazy deletes.
+ * values: if not 0, the tree is made by newAugmentedRBTree (only of RB_POLICY).
+ */
+typedef struct Mode
+{
+	const char *name;
+	BalancePolicy policy;
+	int finger, pool;
+	long unsigned compactBudget;
+	int filter, index;
+	double lazyThreshold;
+	int values;
+} Mode;
+
+/**
+ * The errors of a round.
+ */
+typedef struct Check
+{
+	const char *name; // of the mode
+	long unsigned errors;
+} Check;
+
+/**
+ * The state of the order walks of the test (forEachRBTree and forEachFromRBTree).
+ */
+typedef struct OrderCheck
+{
+	long last;
+	long unsigned count;
+	int ordered;
+} OrderCheck;
+
+/**
+ * The modes that are tested, one round each
+ */
+static const Mode modes[] = {
+	{"rb", RB_POLICY, false, false, 0, false, 0, 0, false},
+	{"rb finger pool compact filter index", RB_POLICY, true, true, 7, true, 1, 0, false},
+	{"rb lazy colliding index", RB_POLICY, true, false, 5, false, 2, 0.3, false},
+	{"avl", AVL_POLICY, false, false, 0, false, 0, 0, false},
+	{"avl finger pool compact filter index", AVL_POLICY, true, true, 7, true, 1, 0, false},
+	{"avl lazy colliding index", AVL_POLICY, true, false, 5, false, 2, 0.3, false},
+	{"wavl", WAVL_POLICY, false, false, 0, false, 0, 0, false},
+	{"wavl finger pool compact filter index", WAVL_POLICY, true, true, 7, true, 1, 0, false},
+	{"wavl lazy colliding index", WAVL_POLICY, true, false, 5, false, 2, 0.3, false},
+	{"treap", TREAP_POLICY, false, false, 0, false, 0, 0, false},
+	{"treap finger pool compact filter index", TREAP_POLICY, true, true, 7, true, 1, 0, false},
+	{"treap lazy filter purged by hand", TREAP_POLICY, false, true, 0, true, 0, 1, false},
+	{"rb values", RB_POLICY, false, false, 0, false, 0, 0, true},
+	{"rb values finger pool compact filter index", RB_POLICY, true, true, 7, true, 1, 0, true}
+};
+
+/**
+ * The number of items that newItem made and that were not freed yet
+ */
+static long liveItems = 0;
+
+/**
+ * Compares two longs
+ */
+int longCompare(const void *a, const void *b);
+
+/**
+ * Allocates an item
+ * @param key the key of the item
+ * @return the item (the test exits if the allocation failed)
+ */
+long *newItem(long key);
+
+/**
+ * FreeFunc that counts the items it frees
+ */
+void freeItem(void *data);
+
+/**
+ * CopyFunc of the clones
+ */
+void *copyItem(const void *data);
+
+/**
+ * ValueFunc of the augmented trees, with many equal values
+ */
+double itemValue(const void *data);
+
+/**
+ * HashFunc that spreads the keys
+ */
+long unsigned hashItem(const void *data);
+
+/**
+ * HashFunc that puts the keys in a few slots
+ */
+long unsigned collidingHash(const void *data);
+
+/**
+ * forEachFunc of filterRBTree that keeps the items that are not divisible by *pDivisor
+ */
+int keepIndivisible(const void *object, void *pDivisor);
+
+/**
+ * forEachFunc that checks the items come in an ascending order, and counts them
+ * @param object pointer to a long
+ * @param pCheck pointer to OrderCheck
+ * @return 1
+ */
+int checkOrder(const void *object, void *pCheck);
+
+/**
+ * @param random the state of the generator, changed
+ * @return the next random number
+ */
+long unsigned nextRandom(long unsigned *random);
+
+/**
+ * Reports an error of a round (only the first ones are printed)
+ * @param check the errors of the round
+ * @param what the error
+ * @param key the key it is about, or -1
+ */
+void report(Check *check, const char *what, long key);
+
+/**
+ * Checks a sub tree by the rules of the policy of the tree, and its parents and max values
+ * @param tree the tree
+ * @param node the root of the sub tree (this function recursive)
+ * @param parent the parent node should have
+ * @param check the errors are counted in it
+ * @return the black height of the sub tree in RB_POLICY, its rank in AVL_POLICY and WAVL_POLICY
+ * (-1 for an empty tree), 0 in TREAP_POLICY
+ */
+int checkSubTree(const RBTree *tree, const Node *node, const Node *parent, Check *check);
+
+/**
+ * Checks that the order links of a sub tree follow its in order walk
+ * @param node the root of the sub tree (this function recursive)
+ * @param last the last node of the walk so far, changed
+ * @param check the errors are counted in it
+ */
+void checkLinks(const Node *node, const Node **last, Check *check);
+
+/**
+ * Checks the queries of the values of a tree (see newAugmentedRBTree) against the keys it should
+ * have
+ * @param tree the tree, with a ValueFunc
+ * @param present present[k] is not 0 if key k should be in the tree
+ * @param keys the number of keys
+ * @param check the errors are counted in it
+ */
+void checkValues(const RBTree *tree, const char *present, long keys, Check *check);
+
+/**
+ * Checks the whole tree: its shape, links, size, tombstones and values, and looks up every key
+ * @param tree the tree
+ * @param present present[k] is not 0 if key k should be in the tree
+ * @param keys the number of keys
+ * @param check the errors are counted in it
+ */
+void checkTree(const RBTree *tree, const char *present, long keys, Check *check);
+
+/**
+ * Bulk loads an empty tree with random keys, some of them more than once
+ * @param tree the tree
+ * @param present set for the loaded keys
+ * @param keys the number of keys
+ * @param threads the threads of loadRBTree
+ * @param random the state of the generator
+ * @param check the errors are counted in it
+ */
+void loadRandomItems(RBTree *tree, char *present, long keys, int threads, long unsigned *random,
+					 Check *check);
+
+/**
+ * Clones the tree, checks the clone, changes it, and checks that the tree did not change
+ * @param tree the tree
+ * @param present present[k] is not 0 if key k should be in the tree
+ * @param keys the number of keys
+ * @param random the state of the generator
+ * @param check the errors are counted in it
+ */
+void checkClone(const RBTree *tree, const char *present, long keys, long unsigned *random,
+				Check *check);
+
+/**
+ * Runs one round of the test
+ * @param mode the mode of the tree
+ * @param keys the number of keys
+ * @param seed the seed of the random operations
+ * @return true if the round passed
+ */
+int runRound(const Mode *mode, long keys, long unsigned seed);
+
+int longCompare(const void *a, const void *b)
+{
+	long first = *(const long *) a, second = *(const long *) b;
+	return (first > second) - (first < second);
+}
+
+long *newItem(long key)
+{
+	long *item = (long *) malloc(sizeof(long));
+	if (item == NULL)
+	{
+		fprintf(stderr, "allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+	*item = key;
+	liveItems++;
+	return item;
+}
+
+void freeItem(void *data)
+{
+	liveItems--;
+	free(data);
+}
+
+void *copyItem(const void *data)
+{
+	return newItem(*(const long *) data);
+}
+
+double itemValue(const void *data)
+{
+	return (double) ((*(const long *) data * 37) % VALUES);
+}
+
+long unsigned hashItem(const void *data)
+{
+	return (long unsigned) *(const long *) data * 0x9E3779B97F4A7C15ul;
+}
+
+long unsigned collidingHash(const void *data)
+{
+	return (long unsigned) *(const long *) data % 7;
+}
+
+int keepIndivisible(const void *object, void *pDivisor)
+{
+	return *(const long *) object % *(const long *) pDivisor != 0;
+}
+
+int checkOrder(const void *object, void *pCheck)
+{
+	OrderCheck *order = (OrderCheck *) pCheck;
+	long value = *(const long *) object;
+	if (order->count > 0 && value <= order->last)
+	{
+		order->ordered = false;
+	}
+	order->last = value;
+	order->count++;
+	return 1;
+}
+
+long unsigned nextRandom(long unsigned *random)
+{
+	*random = *random * 6364136223846793005ul + 1442695040888963407ul;
+	return *random >> 33;
+}
+
+void report(Check *check, const char *what, long key)
+{
+	if (check->errors++ < MAX_REPORTS)
+	{
+		printf("%s: %s (key %ld)\n", check->name, what, key);
+	}
+}
+
+int checkSubTree(const RBTree *tree, const Node *node, const Node *parent, Check *check)
+{
+	if (node == NULL)
+	{
+		return (tree->policy == RB_POLICY) ? 1 : (tree->policy == TREAP_POLICY) ? 0 : -1;
+	}
+	long key = *(const long *) node->data;
+	if (node->parent != parent)
+	{
+		report(check, "wrong parent", key);
+	}
+	int left = checkSubTree(tree, node->left, node, check);
+	int right = checkSubTree(tree, node->right, node, check);
+	if (tree->valueFunc != NULL)
+	{
+		double max = node->value;
+		if (node->left != NULL && node->left->maxValue > max)
+		{
+			max = node->left->maxValue;
+		}
+		if (node->right != NULL && node->right->maxValue > max)
+		{
+			max = node->right->maxValue;
+		}
+		if (node->value != itemValue(node->data) || node->maxValue != max)
+		{
+			report(check, "wrong max value", key);
+		}
+	}
+	switch (tree->policy)
+	{
+		case RB_POLICY:
+			if (node->color == RED && ((node->left != NULL && node->left->color == RED) ||
+									   (node->right != NULL && node->right->color == RED)))
+			{
+				report(check, "RED node with a RED child", key);
+			}
+			if (left != right)
+			{
+				report(check, "different black heights", key);
+			}
+			return left + (node->color == BLACK);
+		case AVL_POLICY:
+			if (left - right > 1 || right - left > 1 ||
+				node->rank != 1 + ((left > right) ? left : right))
+			{
+				report(check, "AVL height or balance", key);
+			}
+			return node->rank;
+		case WAVL_POLICY:
+			if (node->rank - left < 1 || node->rank - left > 2 || node->rank - right < 1 ||
+				node->rank - right > 2 ||
+				(node->left == NULL && node->right == NULL && node->rank != 0))
+			{
+				report(check, "WAVL rank difference", key);
+			}
+			return node->rank;
+		default:
+			if ((node->left != NULL && node->left->rank > node->rank) ||
+				(node->right != NULL && node->right->rank > node->rank))
+			{
+				report(check, "treap priority above its parent", key);
+			}
+			return 0;
+	}
+}
+
+void checkLinks(const Node *node, const Node **last, Check *check)
+{
+	if (node == NULL)
+	{
+		return;
+	}
+	checkLinks(node->left, last, check);
+	if (node->prev != *last || (*last != NULL && (*last)->next != node))
+	{
+		report(check, "wrong order links", *(const long *) node->data);
+	}
+	*last = node;
+	checkLinks(node->right, last, check);
+}
+
+void checkValues(const RBTree *tree, const char *present, long keys, Check *check)
+{
+	long best = -1;
+	long unsigned above = 0, bound = VALUES / 2;
+	long unsigned countOfValue[VALUES] = {0};
+	for (long k = 0; k < keys; k++)
+	{
+		if (present[k])
+		{
+			long item = k;
+			double value = itemValue(&item);
+			best = (best < 0 || value > itemValue(&best)) ? k : best;
+			above += value > bound;
+			countOfValue[(int) value]++;
+		}
+	}
+	const long *max = (const long *) findMaxValueInRBTree(tree);
+	if ((max == NULL) != (best < 0) || (max != NULL && *max != best))
+	{
+		report(check, "findMaxValueInRBTree", best);
+	}
+
+	void *top[TOP_K];
+	long unsigned found = findTopKByValueInRBTree(tree, TOP_K, top, 1);
+	long unsigned expected = (tree->size < TOP_K) ? tree->size : TOP_K;
+	int value = VALUES - 1;
+	for (long unsigned i = 0; i < found; i++)
+	{
+		while (value > 0 && countOfValue[value] == 0)
+		{
+			value--;
+		}
+		if (itemValue(top[i]) != value || !present[*(const long *) top[i]])
+		{
+			report(check, "findTopKByValueInRBTree", *(const long *) top[i]);
+		}
+		countOfValue[value]--;
+	}
+	if (found != expected)
+	{
+		report(check, "findTopKByValueInRBTree count", (long) found);
+	}
+
+	OrderCheck order = {0, 0, true};
+	if (!forEachValueAboveRBTree(tree, bound, checkOrder, &order) || !order.ordered ||
+		order.count != above)
+	{
+		report(check, "forEachValueAboveRBTree", (long) order.count);
+	}
+}
+
+void checkTree(const RBTree *tree, const char *present, long keys, Check *check)
+{
+	checkSubTree(tree, tree->root, NULL, check);
+	if (tree->policy == RB_POLICY && tree->root != NULL && tree->root->color != BLACK)
+	{
+		report(check, "RED root", -1);
+	}
+	const Node *last = NULL;
+	checkLinks(tree->root, &last, check);
+	const Node *first = tree->root;
+	while (first != NULL && first->left != NULL)
+	{
+		first = first->left;
+	}
+	if (tree->min != first || tree->max != last || (last != NULL && last->next != NULL))
+	{
+		report(check, "wrong min or max", -1);
+	}
+
+	long unsigned nodes = 0, tombstones = 0;
+	for (const Node *node = tree->min; node != NULL; node = node->next)
+	{
+		nodes++;
+		tombstones += node->tombstone != 0;
+	}
+	if (nodes != tree->size + tree->tombstones || tombstones != tree->tombstones ||
+		(tree->min != NULL && tree->min->tombstone) || (tree->max != NULL && tree->max->tombstone))
+	{
+		report(check, "wrong tombstones", (long) tombstones);
+	}
+	if (tree->purgeThreshold > 0 && tree->purgeThreshold < 1 &&
+		tree->tombstones > tree->purgeThreshold * nodes + 1)
+	{
+		report(check, "tombstones above the threshold", (long) tombstones);
+	}
+
+	OrderCheck order = {0, 0, true};
+	forEachRBTree(tree, checkOrder, &order);
+	long unsigned expected = 0;
+	const Node *finger = tree->finger;
+	for (long k = 0; k < keys; k++)
+	{
+		long key = k;
+		const long *found = (const long *) RBTreeFind(tree, &key);
+		if ((RBTreeContains(tree, &key) != 0) != (present[k] != 0) ||
+			(found == NULL) != (present[k] == 0) || (found != NULL && *found != k))
+		{
+			report(check, "wrong lookup", k);
+		}
+		expected += present[k] != 0;
+	}
+	if (tree->finger != finger)
+	{
+		report(check, "a lookup moved the finger", -1);
+	}
+	if (!order.ordered || order.count != tree->size || tree->size != expected)
+	{
+		report(check, "wrong size or order", (long) tree->size);
+	}
+	if (tree->valueFunc != NULL)
+	{
+		checkValues(tree, present, keys, check);
+	}
+}
+
+void loadRandomItems(RBTree *tree, char *present, long keys, int threads, long unsigned *random,
+					 Check *check)
+{
+	long unsigned n = (long unsigned) keys / 2;
+	void **items = (void **) malloc(n * sizeof(void *));
+	if (items == NULL)
+	{
+		fprintf(stderr, "allocation failed\n");
+		exit(EXIT_FAILURE);
+	}
+	for (long unsigned i = 0; i < n; i++)
+	{
+		items[i] = newItem((long) (nextRandom(random) % (long unsigned) keys));
+	}
+	if (!loadRBTree(tree, items, n, threads))
+	{
+		report(check, "loadRBTree failed", -1);
+		for (long unsigned i = 0; i < n; i++)
+		{
+			freeItem(items[i]);
+		}
+		free(items);
+		return;
+	}
+	for (long unsigned i = 0; i < tree->size; i++)
+	{
+		long key = *(const long *) items[i];
+		if ((i > 0 && *(const long *) items[i - 1] >= key) || RBTreeFind(tree, &key) != items[i])
+		{
+			report(check, "an added item of loadRBTree", key);
+		}
+		present[key] = 1;
+	}
+	for (long unsigned i = tree->size; i < n; i++)
+	{
+		const void *kept = RBTreeFind(tree, items[i]);
+		if (kept == NULL || kept == items[i])
+		{
+			report(check, "a duplicate of loadRBTree", *(const long *) items[i]);
+		}
+		freeItem(items[i]); // the duplicates stay with the caller
+	}
+	free(items);
+}
+
+void checkClone(const RBTree *tree, const char *present, long keys, long unsigned *random,
+				Check *check)
+{
+	int copies = nextRandom(random) % 2;
+	RBTree *clone = cloneRBTree(tree, copies ? copyItem : NULL);
+	char *clonePresent = (char *) malloc((size_t) keys);
+	if (clone == NULL || clonePresent == NULL)
+	{
+		report(check, "cloneRBTree failed", -1);
+		freeRBTree(&clone);
+		free(clonePresent);
+		return;
+	}
+	for (long k = 0; k < keys; k++)
+	{
+		clonePresent[k] = present[k];
+	}
+	if (clone->tombstones != 0 && !copies)
+	{
+		report(check, "a shared clone with tombstones", (long) clone->tombstones);
+	}
+	checkTree(clone, clonePresent, keys, check);
+	for (int i = 0; i < CLONE_OPS; i++)
+	{
+		long key = (long) (nextRandom(random) % (long unsigned) keys);
+		if (copies && nextRandom(random) % 2)
+		{
+			long *item = newItem(key);
+			if ((insertToRBTree(clone, item) != 0) == (clonePresent[key] != 0))
+			{
+				report(check, "insert to a clone", key);
+			}
+			if (clonePresent[key])
+			{
+				freeItem(item);
+			}
+			clonePresent[key] = 1;
+		}
+		else
+		{
+			// the items of a shared clone are not freed, they belong to tree
+			if ((deleteFromRBTree(clone, &key) != 0) != (clonePresent[key] != 0))
+			{
+				report(check, "delete from a clone", key);
+			}
+			clonePresent[key] = 0;
+		}
+	}
+	checkTree(clone, clonePresent, keys, check);
+	freeRBTree(&clone);
+	free(clonePresent);
+	checkTree(tree, present, keys, check);
+}
+
+int runRound(const Mode *mode, long keys, long unsigned seed)
+{
+	Check check = {mode->name, 0};
+	long unsigned random = seed;
+	liveItems = 0;
+	RBTree *tree = mode->values ? newAugmentedRBTree(longCompare, freeItem, itemValue) :
+				   newRBTreeWithPolicy(longCompare, freeItem, mode->policy);
+	char *present = (char *) calloc((size_t) keys, 1);
+	if (tree == NULL || present == NULL)
+	{
+		fprintf(stderr, "allocation failed\n");
+		freeRBTree(&tree);
+		free(present);
+		return false;
+	}
+	setFingerSearch(tree, mode->finger);
+	setNodePool(tree, mode->pool);
+	if ((mode->filter && !setRBTreeFilter(tree, hashItem)) ||
+		(mode->index && !setRBTreeHashIndex(tree, (mode->index == 2) ? collidingHash : hashItem)) ||
+		(mode->lazyThreshold > 0 && !setRBTreeLazyDelete(tree, mode->lazyThreshold)))
+	{
+		report(&check, "a mode could not be set", -1);
+	}
+	if (mode->values && setRBTreeLazyDelete(tree, 0.5))
+	{
+		report(&check, "lazy deletes on a tree with values", -1);
+	}
+	loadRandomItems(tree, present, keys, 1 + (int) (seed % 2), &random, &check);
+	checkTree(tree, present, keys, &check);
+
+	long compactions = 0;
+	for (long i = 0; i < keys * OPS_PER_KEY && check.errors == 0; i++)
+	{
+		long key = (long) (nextRandom(&random) % (long unsigned) keys);
+		long unsigned op = nextRandom(&random) % OP_KINDS;
+		if (op < INSERT_SHARE)
+		{
+			long *item = newItem(key);
+			if ((insertToRBTree(tree, item) != 0) == (present[key] != 0))
+			{
+				report(&check, "insert", key);
+			}
+			if (present[key])
+			{
+				freeItem(item);
+			}
+			present[key] = 1;
+		}
+		else if (op < INSERT_SHARE + DELETE_SHARE)
+		{
+			if ((deleteFromRBTree(tree, &key) != 0) != (present[key] != 0))
+			{
+				report(&check, "delete", key);
+			}
+			present[key] = 0;
+		}
+		else
+		{
+			int fromMin = nextRandom(&random) % 2;
+			long skipped = 0;
+			while (skipped < keys && !present[fromMin ? skipped : keys - 1 - skipped])
+			{
+				skipped++;
+			}
+			long expected = (skipped == keys) ? -1 : fromMin ? skipped : keys - 1 - skipped;
+			const void *peeked = fromMin ? peekMinRBTree(tree) : peekMaxRBTree(tree);
+			long *popped = (long *) (fromMin ? popMinFromRBTree(tree) : popMaxFromRBTree(tree));
+			if ((popped == NULL) != (expected < 0) || (popped != NULL && *popped != expected) ||
+				(const void *) popped != peeked)
+			{
+				report(&check, fromMin ? "peek or pop of the min" : "peek or pop of the max",
+					   expected);
+			}
+			if (popped != NULL)
+			{
+				present[*popped] = 0;
+				freeItem(popped); // the caller owns it now
+			}
+		}
+
+		if (mode->compactBudget > 0 && i % COMPACT_EVERY == 0)
+		{
+			int result = compactRBTree(tree, mode->compactBudget);
+			if (result == COMPACTION_FAILED)
+			{
+				report(&check, "compaction failed", -1);
+			}
+			compactions += result == COMPACTION_DONE;
+		}
+		if (i % RANGE_EVERY == 0)
+		{
+			long lo = (long) (nextRandom(&random) % (long unsigned) keys);
+			long length = (nextRandom(&random) % 3) ? 20 : keys / 4; // mostly short ranges
+			long hi = lo + (long) (nextRandom(&random) % (long unsigned) length);
+			long unsigned expected = 0;
+			for (long k = lo; k <= hi && k < keys; k++)
+			{
+				expected += present[k] != 0;
+				present[k] = 0;
+			}
+			if (deleteRangeFromRBTree(tree, &lo, &hi) != expected)
+			{
+				report(&check, "deleteRangeFromRBTree", lo);
+			}
+		}
+		if (i % FILTER_EVERY == 0)
+		{
+			long divisor = 2 + (long) (nextRandom(&random) % 5);
+			long unsigned expected = 0;
+			for (long k = 0; k < keys; k += divisor)
+			{
+				expected += present[k] != 0;
+				present[k] = 0;
+			}
+			if (filterRBTree(tree, keepIndivisible, &divisor) != expected)
+			{
+				report(&check, "filterRBTree", divisor);
+			}
+		}
+		if (i % PURGE_EVERY == 0 && mode->lazyThreshold > 0)
+		{
+			long unsigned tombstones = tree->tombstones;
+			if (purgeRBTree(tree) != tombstones || tree->tombstones != 0)
+			{
+				report(&check, "purgeRBTree", (long) tombstones);
+			}
+		}
+		if (i % RANGE_EVERY == 0)
+		{
+			long from = (long) (nextRandom(&random) % (long unsigned) keys);
+			long unsigned expected = 0;
+			for (long k = from; k < keys && expected < SCAN_LIMIT; k++)
+			{
+				expected += present[k] != 0;
+			}
+			OrderCheck order = {0, 0, true};
+			if (forEachFromRBTree(tree, &from, checkOrder, &order, SCAN_LIMIT) != expected ||
+				!order.ordered || (order.count > 0 && order.last < from))
+			{
+				report(&check, "forEachFromRBTree", from);
+			}
+		}
+		if (i % CLONE_EVERY == 0)
+		{
+			checkClone(tree, present, keys, &random, &check);
+		}
+		if (i % CHECK_EVERY == 0)
+		{
+			checkTree(tree, present, keys, &check);
+		}
+	}
+
+	if (mode->compactBudget > 0)
+	{
+		int result;
+		while ((result = compactRBTree(tree, mode->compactBudget)) == COMPACTION_IN_PROGRESS)
+		{
+		}
+		if (result != COMPACTION_DONE || compactRBTree(tree, (long unsigned) -1) != COMPACTION_DONE)
+		{
+			report(&check, "compaction did not end", -1);
+		}
+		for (const Node *node = tree->min; node != NULL && node->next != NULL; node = node->next)
+		{
+			if (node->next != node + 1)
+			{
+				report(&check, "the nodes are not consecutive after a compaction", -1);
+				break;
+			}
+		}
+		compactions++;
+	}
+	checkTree(tree, present, keys, &check);
+
+	long *searched = (long *) malloc((size_t) keys * sizeof(long));
+	const void **pointers = (const void **) malloc((size_t) keys * sizeof(void *));
+	int *results = (int *) malloc((size_t) keys * sizeof(int));
+	if (searched != NULL && pointers != NULL && results != NULL)
+	{
+		for (long i = 0; i < keys; i++)
+		{
+			searched[i] = (long) (nextRandom(&random) % (long unsigned) (keys + 5));
+			pointers[i] = &searched[i];
+		}
+		if (!RBTreeContainsMany(tree, pointers, (long unsigned) keys, results))
+		{
+			report(&check, "RBTreeContainsMany failed", -1);
+		}
+		for (long i = 0; i < keys; i++)
+		{
+			if ((results[i] != 0) != (searched[i] < keys && present[searched[i]]))
+			{
+				report(&check, "RBTreeContainsMany", searched[i]);
+			}
+		}
+	}
+	free(searched);
+	free(pointers);
+	free(results);
+
+	long unsigned size = tree->size;
+	freeRBTree(&tree);
+	free(present);
+	if (liveItems != 0)
+	{
+		report(&check, "items were not freed once", liveItems);
+	}
+	printf("%s: %lu items, %ld compactions, %lu errors, %s\n", mode->name, size, compactions,
+		   check.errors, (check.errors == 0) ? "ok" : "FAILED");
+	return check.errors == 0;
+}
+
+int main(int argc, char *argv[])
+{
+	long keys = (argc > 1) ? atol(argv[1]) : DEFAULT_KEYS;
+	long unsigned seed = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1;
+	if (keys < 2)
+	{
+		fprintf(stderr, "usage: %s [keys] [seed]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	int passed = true;
+	for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+	{
+		passed = runRound(&modes[m], keys, seed + m) && passed;
+	}
+	if (!passed)
+	{
+		return EXIT_FAILURE;
+	}
+	printf("tree test passed\n");
+	return EXIT_SUCCESS;
+}